@@ -32,11 +32,15 @@ public:
       return s_stop != 0;
     }
   
-  DQMCollector(char *appname, int port, bool debugging)
+  DQMCollector(char *appname, int port, bool debugging, size_t compress,
+	       size_t maxunzipped)
     : DQMBasicNet (appname)
     {
       // Establish the server side.
       debug(debugging);
+      compressUpdates(compress);
+      if (maxunzipped)
+	maxUncompressedSize(maxunzipped);
       startLocalServer(port);
     }
 };
@@ -65,11 +69,17 @@ int main (int argc, char **argv)
 
   // Check and process arguments.
   int port = 9090;
+  int compress = 0;
+  long maxunzipped = 0;
   bool debug = false;
   bool bad = false;
   for (int i = 1; i < argc; ++i)
     if (i < argc-1 && ! strcmp(argv[i], "--listen"))
       port = atoi(argv[++i]);
+    else if (i < argc-1 && ! strcmp(argv[i], "--compress"))
+      compress = atoi(argv[++i]);
+    else if (i < argc-1 && ! strcmp(argv[i], "--max-unzipped"))
+      maxunzipped = atol(argv[++i]);
     else if (! strcmp(argv[i], "--debug"))
       debug = true;
     else if (! strcmp(argv[i], "--no-debug"))
@@ -80,14 +90,15 @@ int main (int argc, char **argv)
       break;
     }
 
-  if (bad || ! port)
+  if (bad || ! port || compress < 0 || maxunzipped < 0)
   {
-    std::cerr << "Usage: " << argv[0] << " --listen PORT [--[no-]debug]\n";
+    std::cerr << "Usage: " << argv[0] << " --listen PORT [--compress BYTES]"
+	      << " [--max-unzipped BYTES] [--[no-]debug]\n";
     return 1;
   }
 
   // Start serving.
-  DQMCollector server (argv[0], port, debug);
+  DQMCollector server (argv[0], port, debug, compress, maxunzipped);
   server.run();
   exit(0);
 }
@@ -1,11 +1,32 @@
 #include "DQMServices/Core/interface/Standalone.h"
 #include "DQMServices/Core/interface/DQMStore.h"
 #include "DQMServices/Core/interface/MonitorElement.h"
+#include "DQMServices/Core/src/DQMSnapshot.h"
+#include "DQMServices/Core/src/DQMRootLock.h"
+#include "DQMServices/Core/src/DQMTagString.h"
 #include "classlib/utils/DebugAids.h"
 #include "classlib/utils/Signal.h"
 #include "TROOT.h"
+#include "TThread.h"
+#include "TFile.h"
+#include "TKey.h"
+#include "TClass.h"
+#include "TObjString.h"
 #include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <inttypes.h>
 #include <errno.h>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #ifndef _NSIG
 #define _NSIG NSIG
@@ -60,32 +81,21 @@ kindToName(MonitorElement::Kind kind)
 }
 
 // -------------------------------------------------------------------
-// Extract standard parameters from the DQM data.
-static void
-getMEInfo(DQMStore &store, MonitorElement &me, MEInfo &info)
+// Extract standard parameters from the full monitor element name.
+// Returns true if the run number is to be looked up from the
+// "System/EventInfo/iRun" monitor element of the system.
+static bool
+getMEInfo(const std::string &fullname, MEInfo &info)
 {
   info.style = 'U';
   info.runnr = -1;
   info.system.clear();
   info.category.clear();
   info.name.clear();
-  info.data.clear();
-
-  switch (me.kind())
-  {
-  case MonitorElement::DQM_KIND_INT:
-  case MonitorElement::DQM_KIND_REAL:
-  case MonitorElement::DQM_KIND_STRING:
-    info.data = me.tagString();
-    break;
-
-  default:
-    break;
-  }
 
   // If it's a reference, strip reference part out.
   bool isref = false;
-  std::string name = me.getFullname();
+  std::string name = fullname;
   if (name.size() > 10 && name.compare(0, 10, "Reference/") == 0)
   {
     name.erase(0, 10);
@@ -110,27 +120,47 @@ getMEInfo(DQMStore &store, MonitorElement &me, MEInfo &info)
       info.runnr = -1;
 
     info.style = isref ? 'c' : 'C';
-    return;
+    return false;
   }
 
   // Try "System/EventInfo/iRun" or just "System/Name"
   if ((slash = name.find('/')) != std::string::npos && slash > 0)
   {
-    std::string system(name, 0, slash);
-    info.system = system;
-    info.category.clear();
+    info.system.append(name, 0, slash);
     info.name.append(name, slash+1, std::string::npos);
-    if (MonitorElement *runnr = store.get(system + "/EventInfo/iRun"))
-      info.runnr = runnr->getIntValue();
-    else
-      info.runnr = -1;
-
     info.style = isref ? 's' : 'S';
-    return;
+    return true;
   }
 
   // Otherwise use the defaults but fill in the name.
   info.name = name;
+  return false;
+}
+
+// Extract standard parameters from the DQM data.
+static void
+getMEInfo(DQMStore &store, MonitorElement &me, MEInfo &info)
+{
+  info.data.clear();
+  switch (me.kind())
+  {
+  case MonitorElement::DQM_KIND_INT:
+  case MonitorElement::DQM_KIND_REAL:
+  case MonitorElement::DQM_KIND_STRING:
+    info.data = me.tagString();
+    break;
+
+  default:
+    break;
+  }
+
+  if (getMEInfo(me.getFullname(), info))
+  {
+    if (MonitorElement *runnr = store.get(info.system + "/EventInfo/iRun"))
+      info.runnr = runnr->getIntValue();
+    else
+      info.runnr = -1;
+  }
 }
 
 std::string
@@ -148,6 +178,415 @@ hexlify(const std::string &x)
   return result;
 }
 
+// Print one monitor element line.
+static void
+printME(std::ostream &out, const MEInfo &info,
+	const std::string &dataset, const std::string &step,
+	MonitorElement::Kind kind, uint32_t tag, uint32_t flags)
+{
+  out << "ME STYLE=" << info.style
+      << " RUN=" << info.runnr
+      << " DATASET='" << dataset
+      << "' STEP='" << step
+      << "' SYSTEM='" << info.system
+      << "' CATEGORY='" << info.category
+      << "' KIND='" << kindToName(kind)
+      << "' TAG=" << tag
+      << " FLAGS=0x" << std::hex << flags << std::dec
+      << " NAME='" << info.name
+      << "' DATA='" << hexlify(info.data)
+      << "'\n";
+}
+
+// -------------------------------------------------------------------
+// Streaming dump.  The monitor elements of a file are gathered from
+// the keys of the ROOT file, or the index of a snapshot file, without
+// reading any histogram and without a DQMStore.  Kinds, flags, tags
+// and values come out as DQMStore::open() would make them, and in the
+// same order.
+struct StreamME
+{
+  uint32_t		flags;	//< Monitor element flags.
+  uint32_t		tag;	//< Monitor element tag.
+  std::string		data;	//< Tagged value string of scalars.
+
+  StreamME(void) : flags(0), tag(0) {}
+};
+
+typedef std::pair<std::string, std::string> StreamKey; //< Directory and name.
+typedef std::map<StreamKey, StreamME> StreamMEs;
+
+static bool
+isReferenceDir(const std::string &dir)
+{
+  return dir.compare(0, 9, "Reference") == 0
+    && (dir.size() == 9 || dir[9] == '/');
+}
+
+// Record a quality report with status <code> for monitor element <name>
+// in directory <dir>, see MonitorElement::updateQReportStats().
+static void
+streamReport(StreamMEs &mes, const std::string &dir, const std::string &name, int code)
+{
+  StreamMEs::iterator i = mes.find(StreamKey(dir, name));
+  if (i == mes.end() || isReferenceDir(dir))
+    return;
+
+  if (code == dqm::qstatus::WARNING)
+    i->second.flags |= DQMNet::DQM_PROP_REPORT_WARN;
+  else if (code == dqm::qstatus::ERROR)
+    i->second.flags |= DQMNet::DQM_PROP_REPORT_ERROR;
+  else if (code != dqm::qstatus::STATUS_OK)
+    i->second.flags |= DQMNet::DQM_PROP_REPORT_OTHER;
+}
+
+// Record a tagged value of kind <kind> for monitor element <label> in
+// directory <dir>, see DQMStore::extractValue().
+static void
+streamValue(StreamMEs &mes, const std::string &dir, const std::string &label,
+	    const std::string &kind, const std::string &value)
+{
+  if (kind == "i" || kind == "f" || kind == "s")
+  {
+    StreamKey key(dir, label);
+    if (mes.count(key))
+      return;
+
+    char buf[64];
+    StreamME &me = mes[key];
+    me.data.reserve(6 + 2*label.size() + value.size());
+    me.data += '<'; me.data += label; me.data += '>';
+    if (kind == "i")
+    {
+      me.flags = MonitorElement::DQM_KIND_INT;
+      me.data.append(buf, snprintf(buf, sizeof(buf), "i=%" PRId64,
+				   (int64_t) atoll(value.c_str())));
+    }
+    else if (kind == "f")
+    {
+      me.flags = MonitorElement::DQM_KIND_REAL;
+      me.data.append(buf, snprintf(buf, sizeof(buf), "f=%.*g",
+				   DBL_DIG+2, atof(value.c_str())));
+    }
+    else
+    {
+      me.flags = MonitorElement::DQM_KIND_STRING;
+      me.data += "s=";
+      me.data += value;
+    }
+    me.data += '<'; me.data += '/'; me.data += label; me.data += '>';
+    me.flags |= DQMNet::DQM_PROP_NEW;
+  }
+  else if (kind == "e")
+  {
+    StreamMEs::iterator i = mes.find(StreamKey(dir, label));
+    if (i != mes.end())
+      i->second.flags |= DQMNet::DQM_PROP_EFFICIENCY_PLOT;
+  }
+  else if (kind == "t")
+  {
+    StreamMEs::iterator i = mes.find(StreamKey(dir, label));
+    char *endp = 0;
+    errno = 0;
+    unsigned long val = strtoul(value.c_str(), &endp, 10);
+    if (i != mes.end() && val && ! errno && ! *endp && val <= ~uint32_t(0))
+    {
+      i->second.tag = val;
+      i->second.flags |= DQMNet::DQM_PROP_TAGGED;
+    }
+  }
+  else if (kind == "qr")
+  {
+    size_t dot = label.find('.');
+    DQMQualityString qs;
+    if (dot != std::string::npos && qs.parse(value.data(), value.size()))
+      streamReport(mes, dir, label.substr(0, dot), qs.code);
+  }
+}
+
+// Read the next length-prefixed field of a metadata table.
+static bool
+unpackField(const char *&p, const char *end, std::string &value)
+{
+  char *colon = 0;
+  unsigned long len = strtoul(p, &colon, 10);
+  if (colon == p || colon >= end || *colon != ':'
+      || len > (unsigned long) (end - colon - 1))
+    return false;
+
+  value.assign(colon+1, len);
+  p = colon+1+len;
+  return true;
+}
+
+// Record the monitor element metadata table <table> of directory
+// <dir>, see DQMStore::readMetadata().
+static void
+streamTable(StreamMEs &mes, const std::string &dir, const char *table)
+{
+  static const char header[] = "DQMMETA 1\n";
+  if (strncmp(table, header, sizeof(header)-1) != 0)
+    return;
+
+  const char *p = table + sizeof(header)-1;
+  const char *end = p + strlen(p);
+  std::string name, kind, flags, tagval, value, nqr;
+  std::string qtname, code, result, algorithm, message;
+  while (p < end)
+  {
+    if (! unpackField(p, end, name)
+	|| ! unpackField(p, end, kind)
+	|| ! unpackField(p, end, flags)
+	|| ! unpackField(p, end, tagval)
+	|| ! unpackField(p, end, value)
+	|| ! unpackField(p, end, nqr))
+      return;
+
+    if (kind != "h")
+      streamValue(mes, dir, name, kind, value);
+    if (flags.find('e') != std::string::npos)
+      streamValue(mes, dir, name, "e", "");
+    if (flags.find('t') != std::string::npos)
+      streamValue(mes, dir, name, "t", tagval);
+
+    for (unsigned long i = 0, n = strtoul(nqr.c_str(), 0, 10); i < n; ++i)
+    {
+      if (! unpackField(p, end, qtname)
+	  || ! unpackField(p, end, code)
+	  || ! unpackField(p, end, result)
+	  || ! unpackField(p, end, algorithm)
+	  || ! unpackField(p, end, message))
+	return;
+
+      streamReport(mes, dir, name, atoi(code.c_str()));
+    }
+  }
+}
+
+// Gather the monitor elements in directory <curdir> of <file> and its
+// subdirectories.  Histograms are known from their keys alone; values,
+// tags and quality reports from the keys of the strings, which are the
+// strings themselves.  Only metadata tables and old-style named values
+// need reading.
+static void
+streamDirectory(TFile *file, const std::string &curdir, StreamMEs &mes)
+{
+  TDirectory *tdir = file->GetDirectory(curdir.c_str());
+  if (! tdir)
+    throw std::runtime_error("Failed to process directory '" + curdir
+			     + "' while reading file '" + file->GetName() + "'");
+
+  std::string dirpart = curdir;
+  if (dirpart.compare(0, 7, "DQMData") == 0
+      && (dirpart.size() == 7 || dirpart[7] == '/'))
+    dirpart.erase(0, dirpart.size() == 7 ? 7 : 8);
+
+  TKey *key;
+  TIter next(tdir->GetListOfKeys());
+  std::list<std::string> delayed;
+  std::list<TKey *> tables;
+  while ((key = (TKey *) next()))
+  {
+    TClass *cl = TClass::GetClass(key->GetClassName());
+    MonitorElement::Kind kind = MonitorElement::kindFromClass(key->GetClassName());
+    if (curdir.empty() && ! strcmp(key->GetName(), "DQMDelta"))
+      ;
+    else if (cl && cl->InheritsFrom(TDirectory::Class()))
+      streamDirectory(file, curdir.empty() ? std::string(key->GetName())
+		      : curdir + '/' + key->GetName(), mes);
+    else if (kind != MonitorElement::DQM_KIND_INVALID)
+    {
+      StreamKey k(dirpart, key->GetName());
+      if (! mes.count(k))
+	mes[k].flags = kind | DQMNet::DQM_PROP_NEW;
+    }
+    else if (cl && cl->InheritsFrom(TObjString::Class()))
+    {
+      if (! strcmp(key->GetName(), "dqm.metadata"))
+	tables.push_back(key);
+      else
+	delayed.push_back(key->GetName());
+    }
+    else if (cl && cl->InheritsFrom(TNamed::Class()) && ! cl->InheritsFrom(TH1::Class()))
+    {
+      // Old DQM data keeps the value in the title.
+      std::auto_ptr<TObject> obj(key->ReadObj());
+      if (obj.get())
+	delayed.push_back(std::string("<") + obj->GetName() + '>' + obj->GetTitle()
+			  + "</" + obj->GetName() + '>');
+    }
+  }
+
+  for ( ; ! delayed.empty(); delayed.pop_front())
+  {
+    DQMTagString ts;
+    const std::string &s = delayed.front();
+    if (ts.parse(s.data(), s.size()))
+      streamValue(mes, dirpart,
+		  std::string(ts.label, ts.labelLen),
+		  std::string(ts.kind, ts.kindLen),
+		  std::string(ts.value, ts.valueLen));
+  }
+
+  for ( ; ! tables.empty(); tables.pop_front())
+  {
+    std::auto_ptr<TObject> obj(tables.front()->ReadObj());
+    if (obj.get())
+      streamTable(mes, dirpart, obj->GetName());
+  }
+}
+
+// Gather the monitor elements of a snapshot file from its index.
+static void
+streamSnapshot(const std::string &filename, StreamMEs &mes)
+{
+  DQMSnapshot::Reader r(filename);
+  std::vector<DQMSnapshot::Section> sections;
+  for (uint64_t i = 0, e = r.size(); i < e; ++i)
+  {
+    std::string path = r.path(i);
+    size_t slash = path.rfind('/');
+    StreamKey k(path.substr(0, slash == std::string::npos ? 0 : slash),
+		path.substr(slash == std::string::npos ? 0 : slash+1));
+    StreamME &me = mes[k];
+    me.flags = r.flags(i);
+    me.tag = r.tag(i);
+
+    MonitorElement::Kind kind = MonitorElement::Kind(me.flags & DQMNet::DQM_PROP_TYPE_MASK);
+    if (kind == MonitorElement::DQM_KIND_INT
+	|| kind == MonitorElement::DQM_KIND_REAL
+	|| kind == MonitorElement::DQM_KIND_STRING)
+    {
+      r.sections(i, sections);
+      for (size_t s = 0; s < sections.size(); ++s)
+	if (sections[s].type == DQMSnapshot::SEC_SCALAR)
+	  me.data.assign(sections[s].data, sections[s].size);
+    }
+  }
+}
+
+// Dump the monitor elements of file <filename> into <out>.  Run
+// numbers are looked up once per system.  ROOT files are read under
+// the ROOT lock, so with several dump threads only the snapshot files
+// and the formatting of the output run in parallel.
+static void
+streamFile(const std::string &filename, const std::string &dataset,
+	   const std::string &step, std::ostream &out)
+{
+  StreamMEs mes;
+  if (DQMSnapshot::isSnapshot(filename))
+    streamSnapshot(filename, mes);
+  else
+  {
+    {
+      DQMRootLock gate;
+      std::unique_ptr<TFile> f(TFile::Open(filename.c_str()));
+      if (! f.get() || f->IsZombie())
+	throw std::runtime_error("Failed to open file '" + filename + "'");
+      streamDirectory(f.get(), "", mes);
+    }
+
+    // Histograms with a reference are flagged when it is linked.
+    for (StreamMEs::iterator i = mes.begin(), e = mes.end(); i != e; ++i)
+      if ((i->second.flags & DQMNet::DQM_PROP_TYPE_MASK) >= MonitorElement::DQM_KIND_TH1F
+	  && ! isReferenceDir(i->first.first)
+	  && mes.count(StreamKey("Reference/" + i->first.first, i->first.second)))
+	i->second.flags |= DQMNet::DQM_PROP_HAS_REFERENCE;
+  }
+
+  out << "FILE NAME='" << filename << "'\n";
+
+  MEInfo info;
+  std::map<std::string, int> runs;
+  for (StreamMEs::iterator i = mes.begin(), e = mes.end(); i != e; ++i)
+  {
+    const std::string &dir = i->first.first;
+    const std::string &name = i->first.second;
+    info.data = i->second.data;
+    if (getMEInfo(dir.empty() ? name : dir + '/' + name, info))
+    {
+      std::map<std::string, int>::iterator r = runs.find(info.system);
+      if (r == runs.end())
+      {
+	int runnr = -1;
+	DQMTagString ts;
+	StreamMEs::iterator run = mes.find(StreamKey(info.system + "/EventInfo", "iRun"));
+	if (run != e
+	    && (run->second.flags & DQMNet::DQM_PROP_TYPE_MASK) == MonitorElement::DQM_KIND_INT
+	    && ts.parse(run->second.data.data(), run->second.data.size()))
+	  runnr = atoi(std::string(ts.value, ts.valueLen).c_str());
+	r = runs.insert(std::make_pair(info.system, runnr)).first;
+      }
+      info.runnr = r->second;
+    }
+
+    printME(out, info, dataset, step,
+	    MonitorElement::Kind(i->second.flags & DQMNet::DQM_PROP_TYPE_MASK),
+	    i->second.tag, i->second.flags);
+  }
+}
+
+// Files dumped ahead of the output by the dump threads.  The output
+// is printed strictly in the order of the files.
+struct DumpInput
+{
+  std::string		name;	//< File name.
+  std::string		output;	//< Dump output.
+  std::string		error;	//< Error message if dumping failed.
+  bool			done;	//< Whether dumping has finished.
+};
+
+struct DumpQueue
+{
+  std::vector<DumpInput>	inputs;
+  std::string			dataset;
+  std::string			step;
+  size_t			next;	//< Next input to dump.
+  size_t			printed; //< Inputs printed so far.
+  size_t			ahead;	//< Maximum inputs dumped but not printed.
+  bool				stop;
+  std::mutex			lock;
+  std::condition_variable	cond;
+};
+
+static void
+dumpInput(DumpQueue *q, DumpInput &in)
+{
+  std::ostringstream out;
+  try
+  {
+    streamFile(in.name, q->dataset, q->step, out);
+    in.output = out.str();
+  }
+  catch (std::exception &e)
+  {
+    in.error = e.what();
+    if (in.error.empty())
+      in.error = "unknown error";
+  }
+}
+
+static void
+dumpInputs(DumpQueue *q)
+{
+  std::unique_lock<std::mutex> gate(q->lock);
+  while (true)
+  {
+    // Bound the number of outputs held in memory.
+    while (! q->stop && q->next < q->inputs.size() && q->next >= q->printed + q->ahead)
+      q->cond.wait(gate);
+    if (q->stop || q->next >= q->inputs.size())
+      break;
+
+    DumpInput &in = q->inputs[q->next++];
+    gate.unlock();
+    dumpInput(q, in);
+    gate.lock();
+    in.done = true;
+    q->cond.notify_all();
+  }
+}
+
 // -------------------------------------------------------------------
 // Main program.
 int main(int argc, char **argv)
@@ -164,6 +603,9 @@ int main(int argc, char **argv)
   // Check command line arguments.
   int arg = 1;
   int bad = 0;
+  int status = 0;
+  bool stream = false;
+  unsigned nthreads = 1;
   std::string dataset;
   std::string step;
   for ( ; arg < argc; ++arg)
@@ -171,6 +613,13 @@ int main(int argc, char **argv)
       dataset = argv[++arg];
     else if (arg < argc-1 && !strcmp(argv[arg], "--step"))
       step = argv[++arg];
+    else if (!strcmp(argv[arg], "--stream"))
+      stream = true;
+    else if (arg < argc-1 && !strcmp(argv[arg], "-j"))
+    {
+      nthreads = std::max(atoi(argv[++arg]), 1);
+      stream = true;
+    }
     else if (argv[arg][0] == '-')
       ++bad;
     else
@@ -181,10 +630,75 @@ int main(int argc, char **argv)
     std::cerr << "Usage: " << argv[0]
 	      << " [--dataset NAME]"
 	      << " [--step NAME]"
-	      << " FILE...\n";
+	      << " [--stream]"
+	      << " [-j THREADS]"
+	      << " FILE...\n"
+	      << "With --stream the files are dumped from their keys without"
+	      << " reading histograms into a DQMStore.  With -j, which implies"
+	      << " --stream, THREADS files are dumped at once; the output is"
+	      << " still in the order of the files.  ROOT files are read one"
+	      << " at a time, snapshot files in parallel.\n"
+	      << "The exit status is non-zero if any file could not be read.\n";
     return 1;
   }
 
+  if (stream)
+  {
+    DumpQueue q;
+    q.dataset = dataset;
+    q.step = step;
+    q.next = 0;
+    q.printed = 0;
+    q.ahead = 2 * nthreads;
+    q.stop = false;
+    q.inputs.resize(argc - arg);
+    for (size_t i = 0; i < q.inputs.size(); ++i)
+    {
+      q.inputs[i].name = argv[arg+i];
+      q.inputs[i].done = false;
+    }
+
+    std::vector<std::thread> dumpers;
+    if (nthreads > 1)
+    {
+      TThread::Initialize();
+      for (unsigned i = 0; i < nthreads && i < q.inputs.size(); ++i)
+	dumpers.push_back(std::thread(dumpInputs, &q));
+    }
+
+    for (size_t i = 0; i < q.inputs.size(); ++i)
+    {
+      DumpInput &in = q.inputs[i];
+      if (dumpers.empty())
+	dumpInput(&q, in);
+      else
+      {
+	std::unique_lock<std::mutex> gate(q.lock);
+	while (! in.done)
+	  q.cond.wait(gate);
+      }
+
+      if (in.error.empty())
+	std::cout << in.output;
+      else
+      {
+	std::cerr << "*** FAILED TO READ FILE " << in.name << ":\n"
+		  << in.error << std::endl;
+	status = 1;
+      }
+
+      std::lock_guard<std::mutex> gate(q.lock);
+      std::string().swap(in.output);
+      ++q.printed;
+      q.cond.notify_all();
+    }
+
+    for (size_t i = 0; i < dumpers.size(); ++i)
+      dumpers[i].join();
+
+    return status;
+  }
+
   // Process each file given as argument.
   edm::ParameterSet emptyps;
   std::vector<edm::ParameterSet> emptyset;
@@ -206,29 +720,19 @@ int main(int argc, char **argv)
       {
         MonitorElement &me = *mes[m];
         getMEInfo(store, me, info);
-        std::cout << "ME STYLE=" << info.style
-		  << " RUN=" << info.runnr
-		  << " DATASET='" << dataset
-		  << "' STEP='" << step
-		  << "' SYSTEM='" << info.system
-		  << "' CATEGORY='" << info.category
-		  << "' KIND='" << kindToName(me.kind())
-		  << "' TAG=" << me.getTag()
-		  << " FLAGS=0x" << std::hex << me.flags() << std::dec
-		  << " NAME='" << info.name
-		  << "' DATA='" << hexlify(info.data)
-		  << "'\n";
+        printME(std::cout, info, dataset, step, me.kind(), me.getTag(), me.flags());
       }
     }
     catch (std::exception &e)
     {
       std::cerr << "*** FAILED TO READ FILE " << argv[arg] << ":\n"
 		<< e.what() << std::endl;
+      status = 1;
     }
 
     // Now clear the DQM store for the next file.
     store.rmdir("");
   }
 
-  return 0;
+  return status;
 }
@@ -1,12 +1,23 @@
 #include "DQMServices/Core/interface/Standalone.h"
 #include "DQMServices/Core/interface/DQMStore.h"
 #include "DQMServices/Core/interface/MonitorElement.h"
+#include "DQMServices/Core/src/DQMSnapshot.h"
+#include "DQMServices/Core/src/DQMTagString.h"
 #include "classlib/utils/DebugAids.h"
 #include "classlib/utils/Signal.h"
 #include "TROOT.h"
+#include "TFile.h"
+#include "TKey.h"
+#include "TClass.h"
+#include "TObjString.h"
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 #include <errno.h>
+#include <memory>
+#include <stdexcept>
+#include <map>
+#include <set>
 
 #ifndef _NSIG
 #define _NSIG NSIG
@@ -28,6 +39,204 @@ onAssertFail(const char *message)
   return 'a';
 }
 
+// -------------------------------------------------------------------
+// Merge <files> into <store> in order, reading only directory
+// <onlypath> if not empty.  The files are read one after another
+// straight into <store>: reading them on parallel threads into stores
+// of their own gains nothing as ROOT I/O must be serialised, and
+// merging in any other order than that of the files would change the
+// floating point sums.  Returns non-zero if reading a file failed.
+static int
+mergeFiles(DQMStore &store, const std::vector<std::string> &files,
+	   const std::string &onlypath)
+{
+  std::string base;
+  unsigned lastseq = 0;
+  for (size_t i = 0; i < files.size(); ++i)
+    try
+    {
+      // Read in the file, applying delta files on top of what was
+      // read so far.  Warn if the deltas do not form a chain.
+      std::string deltabase;
+      unsigned seq = 0;
+      if (store.openFileOrDelta(files[i], onlypath, true, &deltabase, &seq))
+      {
+	if (base.empty()
+	    || deltabase.substr(deltabase.rfind('/')+1) != base.substr(base.rfind('/')+1))
+	  std::cerr << "*** WARNING: delta file " << files[i]
+		    << " belongs to base file " << deltabase << "\n";
+	if (seq != lastseq+1)
+	  std::cerr << "*** WARNING: delta file " << files[i]
+		    << " has sequence number " << seq << ", expected "
+		    << lastseq+1 << "\n";
+	lastseq = seq;
+      }
+      else
+      {
+	base = files[i];
+	lastseq = 0;
+      }
+    }
+    catch (std::exception &e)
+    {
+      std::cerr << "*** FAILED TO READ FILE " << files[i] << ":\n"
+		<< e.what() << std::endl;
+      return 1;
+    }
+
+  return 0;
+}
+
+// -------------------------------------------------------------------
+// Partitioned merging.  The directory tree is cut into slices, each a
+// directory with everything below it, and the inputs are merged one
+// slice at a time so only one slice of the inputs is held in memory.
+// Directories holding nothing but subdirectories in every input are
+// split into their subdirectories, down to s_sliceDepth levels, which
+// gives one slice per subsystem for "Run NNN/System" trees.
+static const int s_sliceDepth = 2;
+
+struct SliceDir
+{
+  bool			objects;	//< Whether monitor elements are in it.
+  std::set<std::string>	subdirs;	//< Subdirectories.
+
+  SliceDir(void) : objects(false) {}
+};
+
+typedef std::map<std::string, SliceDir> SliceTree;
+
+// Scan directory <curdir> of <file>, at <depth> levels below the top,
+// into <tree>, using directory names as DQMStore reads them.
+static void
+scanDirectory(TFile *file, const std::string &curdir, int depth, SliceTree &tree)
+{
+  TDirectory *tdir = file->GetDirectory(curdir.c_str());
+  if (! tdir)
+    return;
+
+  std::string dirpart = curdir;
+  if (dirpart.compare(0, 7, "DQMData") == 0
+      && (dirpart.size() == 7 || dirpart[7] == '/'))
+    dirpart.erase(0, dirpart.size() == 7 ? 7 : 8);
+
+  SliceDir &dir = tree[dirpart];
+  TKey *key;
+  TIter next(tdir->GetListOfKeys());
+  while ((key = (TKey *) next()))
+  {
+    TClass *cl = TClass::GetClass(key->GetClassName());
+    DQMTagString ts;
+    if (curdir.empty() && ! strcmp(key->GetName(), "DQMDelta"))
+      throw std::runtime_error("delta files cannot be merged in slices");
+    else if (cl && cl->InheritsFrom(TDirectory::Class()))
+    {
+      std::string sub = curdir.empty() ? std::string(key->GetName())
+			: curdir + '/' + key->GetName();
+      if (curdir.empty() && sub == "DQMData")
+	// The top directory is read as the top itself.
+	scanDirectory(file, sub, depth, tree);
+      else
+      {
+	dir.subdirs.insert(dirpart.empty() ? std::string(key->GetName())
+			   : dirpart + '/' + key->GetName());
+	if (depth+1 < s_sliceDepth)
+	  scanDirectory(file, sub, depth+1, tree);
+      }
+    }
+    else if (! (cl && cl->InheritsFrom(TObjString::Class()))
+	     || ! strcmp(key->GetName(), "dqm.metadata")
+	     || ts.parse(key->GetName(), strlen(key->GetName())))
+      // Version strings and the like are not monitor elements.
+      dir.objects = true;
+  }
+}
+
+// Scan the index of snapshot file <filename> into <tree>.
+static void
+scanSnapshot(const std::string &filename, SliceTree &tree)
+{
+  DQMSnapshot::Reader r(filename);
+  for (uint64_t i = 0, e = r.size(); i < e; ++i)
+  {
+    std::string path = r.path(i);
+    size_t slash = path.rfind('/');
+    std::string dir(path, 0, slash == std::string::npos ? 0 : slash);
+    std::string parent;
+    for (int depth = 0; depth < s_sliceDepth; ++depth)
+    {
+      if (parent.size() == dir.size())
+      {
+	tree[parent].objects = true;
+	break;
+      }
+
+      std::string sub(dir, 0, dir.find('/', parent.empty() ? 0 : parent.size()+1));
+      tree[parent].subdirs.insert(sub);
+      parent = sub;
+    }
+  }
+}
+
+// Cut the scanned tree below <dir> at <depth> into slices.
+static void
+collectSlices(const SliceTree &tree, const std::string &dir, int depth,
+	      std::vector<std::string> &slices)
+{
+  SliceTree::const_iterator i = tree.find(dir);
+  if (depth >= s_sliceDepth
+      || i == tree.end()
+      || i->second.objects
+      || i->second.subdirs.empty())
+    slices.push_back(dir);
+  else
+    for (std::set<std::string>::const_iterator
+	   si = i->second.subdirs.begin(), se = i->second.subdirs.end();
+	 si != se; ++si)
+      collectSlices(tree, *si, depth+1, slices);
+}
+
+// Merge <files> slice by slice into <output>.
+static int
+mergeSlices(const std::string &output, const std::vector<std::string> &files)
+{
+  SliceTree tree;
+  std::vector<std::string> slices;
+  for (size_t i = 0; i < files.size(); ++i)
+    try
+    {
+      if (DQMSnapshot::isSnapshot(files[i]))
+	scanSnapshot(files[i], tree);
+      else
+      {
+	std::unique_ptr<TFile> f(TFile::Open(files[i].c_str()));
+	if (! f.get() || f->IsZombie())
+	  throw std::runtime_error("Failed to open file '" + files[i] + "'");
+	scanDirectory(f.get(), "", 0, tree);
+      }
+    }
+    catch (std::exception &e)
+    {
+      std::cerr << "*** FAILED TO READ FILE " << files[i] << ":\n"
+		<< e.what() << std::endl;
+      return 1;
+    }
+
+  collectSlices(tree, "", 0, slices);
+
+  edm::ParameterSet emptyps;
+  for (size_t i = 0; i < slices.size(); ++i)
+  {
+    DQMStore store(emptyps);
+    if (int status = mergeFiles(store, files, slices[i]))
+      return status;
+    store.save(output, "", "", "", DQMStore::SaveWithReference,
+	       dqm::qstatus::STATUS_OK, i == 0 ? "RECREATE" : "UPDATE");
+  }
+
+  return 0;
+}
+
 // -------------------------------------------------------------------
 // Main program.
 int main(int argc, char **argv)
@@ -42,32 +251,39 @@ int main(int argc, char **argv)
   lat::Signal::handleFatal(argv[0], IOFD_INVALID, 0, 0, FATAL_OPTS);
 
   // Check command line arguments.
-  char *output = (argc > 1 ? argv[1] : 0);
+  int arg = 1;
+  bool sliced = false;
+  for ( ; arg < argc; ++arg)
+    if (! strcmp(argv[arg], "--slices"))
+      sliced = true;
+    else
+      break;
+
+  char *output = (arg < argc ? argv[arg++] : 0);
   if (! output)
   {
     std::cerr << "Usage: " << argv[0]
-	      << " OUTPUT-FILE FILE...\n";
+	      << " [--slices] OUTPUT-FILE FILE...\n"
+	      << "Delta files written by DQMStore::saveDelta() are applied"
+	      << " on top of the files before them, so a full file can be"
+	      << " rebuilt with: " << argv[0] << " OUTPUT-FILE BASE DELTA...\n"
+	      << "With --slices the files are merged one directory tree"
+	      << " slice at a time, bounding memory use by the largest"
+	      << " slice; delta files cannot be merged this way.\n";
     return 1;
   }
 
-  // Process each file given as argument.
   edm::ParameterSet emptyps;
   std::vector<edm::ParameterSet> emptyset;
   edm::ServiceToken services(edm::ServiceRegistry::createSet(emptyset));	 
   edm::ServiceRegistry::Operate operate(services);	 
+  std::vector<std::string> files(argv + arg, argv + argc);
+  if (sliced)
+    return mergeSlices(output, files);
+
   DQMStore store(emptyps);	
-  for (int arg = 2; arg < argc; ++arg)
-    try
-    {
-      // Read in the file.
-      store.open(argv[arg]);
-    }
-    catch (std::exception &e)
-    {
-      std::cerr << "*** FAILED TO READ FILE " << argv[arg] << ":\n"
-		<< e.what() << std::endl;
-      exit(1);
-    }
+  if (int status = mergeFiles(store, files, ""))
+    return status;
 
   store.save(output);
   return 0;
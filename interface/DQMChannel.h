@@ -1,6 +1,11 @@
 #ifndef DQMSERVICES_CORE_DQM_CHANNEL_H
 # define DQMSERVICES_CORE_DQM_CHANNEL_H
 
+# include <vector>
+# include <utility>
+# include <cstddef>
+# include <stdint.h>
+
 struct DQMChannel
 {
   int binx;      //< bin # in x-axis (or bin # for 1D histogram)
@@ -35,4 +40,49 @@ struct DQMChannel
     }
 };
 
+/** Compact set of channels flagged by a quality test.  Once the test
+    declares the binning with reshape(), each flagged cell costs one
+    bit in a cell bitmap plus its content and error in side arrays
+    ordered by cell; a non-zero @a binz is kept in a further sparse
+    array.  Channels that do not fit the declared shape are kept as
+    plain DQMChannel objects.  expand() recreates the DQMChannel list,
+    ordered by cell, with the unshaped channels at the end.  */
+class DQMChannelSet
+{
+public:
+  DQMChannelSet(void);
+
+  void clear(void);
+  void reshape(int nbinsx, int nbinsy = 0);
+  void add(int binx, int biny, int binz, float content, float rms);
+  bool contains(int binx, int biny = 0) const;
+  void expand(std::vector<DQMChannel> &into) const;
+  void swap(DQMChannelSet &x);
+
+  /// number of channels in the set
+  size_t size(void) const
+    { return content_.size() + extra_.size(); }
+
+  /// true if no channel was flagged
+  bool empty(void) const
+    { return content_.empty() && extra_.empty(); }
+
+private:
+  typedef std::pair<uint32_t, int> CellValue;
+
+  bool cell(int binx, int biny, uint32_t &key) const;
+  bool flagged(uint32_t key) const;
+  size_t rank(uint32_t key) const;
+
+  int				nbinsx_;  //< Bins along x, without under/overflow.
+  int				nbinsy_;  //< Bins along y, zero for 1D shapes.
+  bool				shaped_;  //< Whether reshape() was called.
+  uint32_t			last_;	  //< Highest cell added so far.
+  std::vector<uint64_t>		bits_;	  //< One bit per cell if any is flagged.
+  std::vector<float>		content_; //< Contents of flagged cells, by cell.
+  std::vector<float>		rms_;	  //< Errors of flagged cells, by cell.
+  std::vector<CellValue>	binz_;	  //< Non-zero binz values, by cell.
+  std::vector<DQMChannel>	extra_;	  //< Channels outside the shape.
+};
+
 #endif // DQMSERVICES_CORE_DQM_CHANNEL_H
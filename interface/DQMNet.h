@@ -71,6 +71,11 @@ public:
   static const uint32_t DQM_REPLY_LIST_END	 = 102;
   static const uint32_t DQM_REPLY_NONE		 = 103;
   static const uint32_t DQM_REPLY_OBJECT	 = 104;
+  static const uint32_t DQM_REPLY_DELTA		 = 105;
+  static const uint32_t DQM_REPLY_ZOBJECT	 = 106;
+
+  static const uint32_t DQM_CAP_DELTA		 = 0x00000001;
+  static const uint32_t DQM_CAP_ZLIB		 = 0x00000002;
 
   static const uint32_t MAX_PEER_WAITREQS	 = 128;
 
@@ -109,6 +114,14 @@ public:
     DataBlob		rawdata;
     std::string		scalar;
     std::string		qdata;
+    uint64_t		dataversion;	// version of rawdata
+    DataBlob		basedata;	// data last sent to baseserial, one peer only
+    uint64_t		baseversion;	// version of basedata
+    uint64_t		baseserial;	// serial of the peer basedata was sent to
+    uint32_t		deltas;		// deltas sent since the last full object
+    DataBlob		zdata;		// rawdata compressed, empty if it does not compress
+    uint64_t		zversion;	// dataversion zdata was made for
+    size_t		zsize;		// size of rawdata zdata was made for
   };
 
   struct Bucket
@@ -129,12 +142,14 @@ public:
   struct Peer
   {
     std::string		peeraddr;
+    uint64_t		serial;		// unique per connection, never reused
     lat::Socket		*socket;
     DataBlob		incoming;
     Bucket		*sendq;
     size_t		sendpos;
 
     unsigned		mask;
+    uint32_t		caps;
     bool		source;
     bool		update;
     bool		updated;
@@ -157,6 +172,9 @@ public:
 
   void			debug(bool doit);
   void			delay(int delay);
+  void			deltaUpdates(unsigned keyframe);
+  void			compressUpdates(size_t minsize);
+  void			maxUncompressedSize(size_t maxsize);
   void			startLocalServer(int port);
   void			startLocalServer(const char *path);
   void			staleObjectWaitLimit(lat::TimeSpan time);
@@ -269,11 +287,16 @@ public:
 
   static void		packQualityData(std::string &into, const QReports &qr);
   static void		unpackQualityData(QReports &qr, uint32_t &flags, const char *from);
+  static void		diffData(DataBlob &into, const DataBlob &base, const DataBlob &data);
+  static bool		patchData(DataBlob &data, const unsigned char *delta, size_t len);
 
 protected:
   std::ostream &	logme(void);
   static void		copydata(Bucket *b, const void *data, size_t len);
   virtual void		sendObjectToPeer(Bucket *msg, Object &o, bool data);
+  void			sendObjectUpdateToPeer(Bucket *msg, Peer *p, Object &o, bool data, bool delta);
+  void			sendCompressedObjectToPeer(Bucket *msg, Object &o);
+  static bool		compressObject(Object &o);
 
   virtual bool		shouldStop(void);
   void			waitForData(Peer *p, const std::string &name, const std::string &info, Peer *owner);
@@ -290,7 +313,7 @@ protected:
   virtual Peer *	getPeer(lat::Socket *s) = 0;
   virtual Peer *	createPeer(lat::Socket *s) = 0;
   virtual void		removePeer(Peer *p, lat::Socket *s) = 0;
-  virtual void		sendObjectListToPeer(Bucket *msg, bool all, bool clear) = 0;
+  virtual void		sendObjectListToPeer(Bucket *msg, Peer *p, bool all, bool clear) = 0;
   virtual void		sendObjectListToPeers(bool all) = 0;
 
   void			updateMask(Peer *p);
@@ -299,6 +322,7 @@ protected:
 
   bool			debug_;
   pthread_mutex_t	lock_;
+  uint64_t		peerSerial_;
 
 private:
   void			losePeer(const char *reason,
@@ -329,6 +353,9 @@ private:
   sig_atomic_t		shutdown_;
 
   int			delay_;
+  unsigned		keyframe_;
+  size_t		compress_;
+  size_t		maxUnzipped_;
   lat::TimeSpan		waitStale_;
   lat::TimeSpan		waitMax_;
   bool			flush_;
@@ -417,6 +444,12 @@ protected:
       o.tag = 0;
       o.version = 0;
       o.lastreq = 0;
+      o.dataversion = 0;
+      o.baseversion = 0;
+      o.baseserial = 0;
+      o.deltas = 0;
+      o.zversion = 0;
+      o.zsize = 0;
       o.dirname = &*ip->dirs.insert(name.substr(0, dirpos)).first;
       o.objname.append(name, namepos, std::string::npos);
       o.hash = dqmhash(name.c_str(), name.size());
@@ -473,10 +506,12 @@ protected:
   createPeer(lat::Socket *s)
     {
       ImplPeer *ip = &peers_[s];
+      ip->serial = ++peerSerial_;
       ip->socket = 0;
       ip->sendq = 0;
       ip->sendpos = 0;
       ip->mask = 0;
+      ip->caps = 0;
       ip->source = false;
       ip->update = false;
       ip->updated = false;
@@ -504,9 +539,10 @@ protected:
 	sendLocalChanges();
     }
 
-  /// Send all objects to a peer and optionally mark sent objects old.
+  /// Send all objects to peer @a p and optionally mark sent objects
+  /// old.  Objects with data are sent as deltas if the peer takes them.
   virtual void
-  sendObjectListToPeer(Bucket *msg, bool all, bool clear)
+  sendObjectListToPeer(Bucket *msg, Peer *p, bool all, bool clear)
     {
       typename PeerMap::iterator pi, pe;
       typename ObjectMap::iterator oi, oe;
@@ -533,7 +569,7 @@ protected:
 	for (oi = pi->second.objs.begin(), oe = pi->second.objs.end(); oi != oe; ++oi)
 	  if (all || (oi->flags & DQM_PROP_NEW))
 	  {
-	    sendObjectToPeer(msg, const_cast<ObjType &>(*oi), oi->lastreq > 0);
+	    sendObjectUpdateToPeer(msg, p, const_cast<ObjType &>(*oi), oi->lastreq > 0, true);
 	    if (clear)
 	      const_cast<ObjType &>(*oi).flags &= ~DQM_PROP_NEW;
 	    ++nupdates;
@@ -561,7 +597,7 @@ protected:
 
 	Bucket msg;
         msg.next = 0;
-	sendObjectListToPeer(&msg, !p.updated || all, true);
+	sendObjectListToPeer(&msg, &p, !p.updated || all, true);
 
 	if (! msg.data.empty())
 	{
@@ -12,6 +12,8 @@
 # include <list>
 # include <map>
 # include <set>
+# include <stdint.h>
+# include <memory>
 # include <execinfo.h>
 # include <stdio.h>
 # include <stdlib.h>
@@ -21,8 +23,11 @@ namespace edm { class DQMHttpSource; class ParameterSet; class ActivityRegistry;
 namespace lat { class Regexp; }
 
 class MonitorElement;
+class MonitorElementSource;
+struct DQMTagString;
 class QCriterion;
 class TFile;
+class TDirectory;
 class TObject;
 class TH1;
 class TObjString;
@@ -50,6 +55,7 @@ public:
   ~fastmatch();
 
   bool match (std::string const& s) const;
+  std::string const& pattern (void) const { return pattern_; }
 
 private:
   // checks if two strings are equal, starting at the back of the strings
@@ -60,6 +66,7 @@ private:
 			std::string const& input) const;
 
   lat::Regexp * regexp_;
+  std::string pattern_;
   std::string fastString_;
   MatchingHeuristicEnum matching_;
 };
@@ -334,16 +341,56 @@ public:
 				     const std::string &rewrite = "",
 				     SaveReferenceTag ref = SaveWithReference,
                                      int minStatus = dqm::qstatus::STATUS_OK,
-				     const std::string &fileupdate = "RECREATE");
+				     const std::string &fileupdate = "RECREATE",
+				     int compression = 1);
+  uint64_t			saveAsync(const std::string &filename,
+					  const std::string &path = "",
+					  const std::string &pattern = "",
+					  const std::string &rewrite = "",
+					  SaveReferenceTag ref = SaveWithReference,
+					  int minStatus = dqm::qstatus::STATUS_OK,
+					  const std::string &fileupdate = "RECREATE",
+					  int compression = 1);
+  void				waitForSave(uint64_t save);
+  void				waitForSaves(void);
+  void				saveDelta(const std::string &filename,
+					  SaveReferenceTag ref = SaveWithReference,
+					  int minStatus = dqm::qstatus::STATUS_OK);
+  void				saveSnapshot(const std::string &filename,
+					     const std::string &path = "",
+					     SaveReferenceTag ref = SaveWithReference,
+					     int minStatus = dqm::qstatus::STATUS_OK);
+  void				checkpoint(const std::string &filename,
+					   unsigned int run = 0);
+  uint64_t			checkpointAsync(const std::string &filename,
+						unsigned int run = 0);
   bool				open(const std::string &filename,
 				     bool overwrite = false,
 				     const std::string &path ="",
 				     const std::string &prepend = "",
   				     OpenRunDirs stripdirs = KeepRunDirs,
 				     bool fileMustExist = true);
+  bool				openLazy(const std::string &filename,
+					 const std::string &path = "",
+					 const std::string &prepend = "",
+					 OpenRunDirs stripdirs = KeepRunDirs);
+  bool				openDelta(const std::string &filename,
+					  std::string *base = 0,
+					  unsigned *sequence = 0);
+  bool				openFileOrDelta(const std::string &filename,
+						const std::string &path,
+						bool applyDelta,
+						std::string *base = 0,
+						unsigned *sequence = 0);
   bool                          load(const std::string &filename,
 				     OpenRunDirs stripdirs = StripRunDirs,
 				     bool fileMustExist = true);
+  bool				loadMany(const std::vector<std::string> &files,
+					 OpenRunDirs stripdirs = StripRunDirs,
+					 bool fileMustExist = true);
+  unsigned int			restore(const std::string &filename,
+					unsigned int run = 0);
+  void				merge(const DQMStore &from, bool overwrite = false);
 
   //-------------------------------------------------------------------------
   // ---------------------- Public print methods -----------------------------
@@ -360,11 +407,43 @@ public:
   int				useQTestByMatch(const std::string &pattern, const std::string &qtname);
   void				runQTests(void);
   int				getStatus(const std::string &path = "") const;
+  void				getAllQTestAlgorithms(std::vector<std::string> &into) const;
+  void				showQTestStats(void) const;
+  void				publishQTestStats(const std::string &dir);
+  void				resetQTestStats(void);
   void        scaleElements(void);
 
 private:
   // ---------------- Navigation -----------------------
-  bool				cdInto(const std::string &path) const;
+  typedef std::map<std::string, TDirectory *> DirCache;
+  static TDirectory *		cdInto(TDirectory *top, const std::string &path, DirCache &cache);
+
+  // ---------------- Saving ---------------------------
+  struct SaveJob;
+  class SaveWriter;
+  void				collectSave(SaveJob &job,
+					    const std::string &path,
+					    const std::string &pattern,
+					    const std::string &rewrite,
+					    SaveReferenceTag ref,
+					    int minStatus,
+					    bool snapshot,
+					    bool changedOnly);
+  void				collectSnapshot(SaveJob &job,
+						const std::string &path,
+						SaveReferenceTag ref,
+						int minStatus,
+						bool checkpoint,
+						unsigned int run = 0);
+  static void			writeSave(SaveJob &job);
+  static void			packMetadata(std::string &into,
+					     const MonitorElement &me,
+					     bool qreports);
+  bool				isSaveSelected(const MonitorElement &me,
+					       const std::string &refpath,
+					       SaveReferenceTag ref,
+					       int minStatus) const;
+  void				listPaths(std::set<std::string> &paths) const;
 
   // ------------------- Reference ME -------------------------------
   bool				isCollateME(MonitorElement *me) const;
@@ -376,15 +455,39 @@ private:
 					 const std::string &prepend = "",
 					 OpenRunDirs stripdirs = StripRunDirs,
 					 bool fileMustExist = true);
+  unsigned			readTFile(TFile *f,
+					  const std::string &filename,
+					  bool overwrite,
+					  const std::string &path,
+					  const std::string &prepend,
+					  OpenRunDirs stripdirs);
+  bool				readDelta(TFile *f,
+					  const std::string &filename,
+					  std::string *base,
+					  unsigned *sequence);
   void				makeDirectory(const std::string &path);
   unsigned int			readDirectory(TFile *file,
 					      bool overwrite,
 					      const std::string &path,
 					      const std::string &prepend,
 					      const std::string &curdir,
-					      OpenRunDirs stripdirs);
+					      OpenRunDirs stripdirs,
+					      const std::shared_ptr<TFile> &lazy
+					      = std::shared_ptr<TFile>());
+  bool				readDirectoryName(std::string &dirpart,
+						  const std::string &prepend,
+						  OpenRunDirs stripdirs) const;
+  unsigned int			readSnapshot(const std::string &filename,
+					     bool overwrite,
+					     const std::string &onlypath,
+					     const std::string &prepend,
+					     OpenRunDirs stripdirs,
+					     bool map = false);
+  void				readReferenceCache(const std::string &ref,
+						   const std::string &cache);
 
   MonitorElement *		findObject(const std::string &dir, const std::string &name) const;
+  MonitorElement *		findMaster(const std::string &refdir, const std::string &name) const;
 
 public:
   void				getAllTags(std::vector<std::string> &into) const;
@@ -397,7 +500,13 @@ private:
   void				reset(void);
   void        forceReset(void);
 
-  bool				extract(TObject *obj, const std::string &dir, bool overwrite);
+  bool				extract(TObject *obj, const std::string &dir, bool overwrite, bool adopt = false);
+  bool				extractValue(const std::string &dir,
+					     const DQMTagString &ts,
+					     bool overwrite);
+  unsigned int			readMetadata(const char *table,
+					     const std::string &dir,
+					     bool overwrite);
 
   // ---------------------- Booking ------------------------------------
   MonitorElement *		initialise(MonitorElement *me, const std::string &path);
@@ -408,6 +517,14 @@ private:
   MonitorElement *		book(const std::string &dir, const std::string &name,
 				     const char *context, int kind,
 				     HISTO *h, COLLATE collate);
+  void				attachBooked(MonitorElement *me,
+					     const std::string &dir,
+					     const std::string &name,
+					     const std::string &path);
+  MonitorElement *		bookLazy(const std::string &dir,
+					 const std::string &name,
+					 int kind,
+					 MonitorElementSource *source);
 
   MonitorElement *		bookInt(const std::string &dir, const std::string &name);
   MonitorElement *		bookFloat(const std::string &dir, const std::string &name);
@@ -422,8 +539,6 @@ private:
   MonitorElement *		bookProfile(const std::string &dir, const std::string &name, TProfile *h);
   MonitorElement *		bookProfile2D(const std::string &folder, const std::string &name, TProfile2D *h);
 
-  static bool                   checkBinningMatches(MonitorElement *me, TH1 *h);
-
   static void			collate1D(MonitorElement *me, TH1F *h);
   static void			collate1S(MonitorElement *me, TH1S *h);
   static void			collate1DD(MonitorElement *me, TH1D *h);
@@ -457,6 +572,16 @@ private:
   double				scaleFlag_;
   bool				collateHistograms_;
   std::string			readSelectedDirectory_;
+  unsigned			maxPendingSaves_;
+  unsigned			loadPrefetchMB_;
+  unsigned			saveThreads_;
+  bool				metadataTable_;
+  SaveWriter			*saveWriter_;
+  std::string			deltaBase_;
+  std::string			pendingDeltaBase_;
+  std::set<std::string>		deltaKnown_;
+  std::set<std::string>		pendingDeltaKnown_;
+  unsigned			deltaSequence_;
 
   std::string			pwd_;
   MEMap				data_;
@@ -29,12 +29,42 @@
 # endif
 
 class QCriterion;
+struct QReferenceCache;
+
+/** Deferred source of the ROOT object of a monitor element which was
+    opened without reading its object, see DQMStore::openLazy().  The
+    monitor element owns the source and drops it after the first load.  */
+class MonitorElementSource
+{
+public:
+  virtual ~MonitorElementSource(void) {}
+
+  /// Read the object; the caller takes ownership.  Returns null on failure.
+  virtual TH1 *load(void) = 0;
+};
+
+/** Arrays of the ROOT object of a monitor element which point into
+    memory shared read-only with other processes rather than to memory
+    of their own, see DQMStore::readReferenceCache().  The monitor
+    element owns the mapping.  It copies the arrays before the object
+    is handed out or modified, and deletes the mapping, which detaches
+    the arrays, before deleting the object.  */
+class MonitorElementMapping
+{
+public:
+  virtual ~MonitorElementMapping(void) {}
+
+  /// Give the arrays memory of their own with a copy of the contents.
+  virtual void copy(void) = 0;
+};
 
 /** The base class for all MonitorElements (ME) */
 class MonitorElement
 {
   friend class DQMStore;
   friend class DQMService;
+  friend class QCriterion;
+  friend class DQMCollate;
 public:
   struct Scalar
   {
@@ -69,6 +99,13 @@ private:
   TH1			*reference_; //< Current ROOT reference object.
   TH1			*refvalue_;  //< Soft reference if any.
   std::vector<QReport>	qreports_;   //< QReports associated to this object.
+  QReferenceCache	*refcache_;  //< Reference quantities cached by quality tests.
+  MonitorElement	*refme_;     //< Linked reference monitor element, if any.
+  std::vector<MonitorElement *> masters_; //< Monitor elements linked to this as reference.
+  MonitorElementSource	*source_;    //< Source of the object not yet loaded, if any.
+  MonitorElementMapping	*mapping_;   //< Shared memory of the object arrays, if any.
+  uint64_t		version_;    //< Content version, bumped on every change.
+  uint64_t		savedVersion_; //< Content version last saved, ~0 if never.
 
   MonitorElement *initialise(Kind kind);
   MonitorElement *initialise(Kind kind, TH1 *rootobj);
@@ -91,6 +128,8 @@ public:
   Kind kind(void) const
     { return Kind(data_.flags & DQMNet::DQM_PROP_TYPE_MASK); }
 
+  static Kind kindFromClass(const char *classname);
+
   /// Get the object flags.
   uint32_t flags(void) const
     { return data_.flags; }
@@ -119,9 +158,13 @@ public:
   bool wasUpdated(void) const
     { return data_.flags & DQMNet::DQM_PROP_NEW; }
 
-  /// Mark the object updated.
+  /// Mark the object updated and its contents changed.
   void update(void)
-    { data_.flags |= DQMNet::DQM_PROP_NEW; }
+    { data_.flags |= DQMNet::DQM_PROP_NEW; ++version_; }
+
+  /// get content version, which increases whenever the contents change
+  uint64_t contentVersion(void) const
+    { return version_; }
 
   /// specify whether ME should be reset at end of monitoring cycle (default:false);
   /// (typically called by Sources that control the original ME)
@@ -218,6 +261,10 @@ private:
   void doFill(int64_t x);
   void incompatible(const char *func) const;
   TH1 *accessRootObject(const char *func, int reqdim) const;
+  TH1 *accessRefObject(void) const;
+  TH1 *unmapRefObject(void) const;
+  void loadObject(void) const;
+  void unmapObject(void) const;
 
 public:
 #if DQM_ROOT_METHODS
@@ -289,6 +336,10 @@ private:
     { data_.flags |= DQMNet::DQM_PROP_ACCUMULATE; }
 
   TAxis *getAxis(const char *func, int axis) const;
+  void setReference(TH1 *ref);
+  void linkReference(MonitorElement *ref);
+  void unlinkReference(void);
+  void unlinkMasters(void);
 
   // ------------ Operations for MEs that are normally never reset ---------
   void softReset(void);
@@ -3,6 +3,7 @@
 
 # include "DQMServices/Core/interface/DQMDefinitions.h"
 # include "DQMServices/Core/interface/DQMNet.h"
+# include "DQMServices/Core/interface/DQMChannel.h"
 # include <vector>
 # include <string>
 
@@ -31,7 +32,18 @@ public:
   /// get vector of channels that failed test
   /// (not relevant for all quality tests!)
   const std::vector<DQMChannel> &getBadChannels(void) const
-    { return badChannels_; }
+    {
+      if (! expanded_)
+      {
+	badChannelSet_.expand(badChannels_);
+	expanded_ = true;
+      }
+      return badChannels_;
+    }
+
+  /// get compact set of channels that failed test
+  const DQMChannelSet &getBadChannelSet(void) const
+    { return badChannelSet_; }
 
   /// get QCriterion
   const QCriterion *getQCriterion(void) const
@@ -44,12 +56,25 @@ private:
 
   QReport(DQMNet::QValue *value, QCriterion *qc)
     : qvalue_ (value),
-      qcriterion_ (qc)
+      qcriterion_ (qc),
+      expanded_ (true),
+      version_ (0),
+      paramVersion_ (0),
+      entries_ (0),
+      refEntries_ (0),
+      runTime_ (0)
     {}
 
   DQMNet::QValue	  *qvalue_;	//< Pointer to the actual data.
   QCriterion		  *qcriterion_;	//< Pointer to QCriterion algorithm.
-  std::vector<DQMChannel> badChannels_; //< Bad channels from QCriterion.
+  DQMChannelSet		  badChannelSet_; //< Bad channels from QCriterion.
+  mutable std::vector<DQMChannel> badChannels_; //< Expanded bad channels, on demand.
+  mutable bool		  expanded_;	//< Whether badChannels_ is up to date.
+  uint64_t		  version_;	//< ME content version last tested.
+  uint64_t		  paramVersion_; //< QCriterion parameters last used.
+  double		  entries_;	//< ME entries last tested.
+  double		  refEntries_;	//< Reference entries last tested.
+  uint64_t		  runTime_;	//< Time of the last run in ns, zero if never run.
 }; 
 
 #endif // DQMSERVICES_CORE_Q_REPORT_H
@@ -30,6 +30,50 @@ class AllContentAlongDiagonal;		typedef AllContentAlongDiagonal RuleAllContentAl
 class CompareToMedian;                  typedef CompareToMedian CompareToMedianROOT;
 class CompareLastFilledBin;             typedef CompareLastFilledBin CompareLastFilledBinROOT;
 
+/** Quantities derived from a reference histogram which the comparison
+    to reference tests would otherwise recompute on every run.  Kept
+    on the reference monitor element if one is linked, otherwise on
+    the monitor element the reference belongs to.  References are
+    matched by path, so a reference has at most one monitor element
+    linked to it and the cache is not shared between monitor elements
+    with identical references.  Rebuilt if the reference object or its
+    number of entries or cells changes.  */
+struct QReferenceCache
+{
+  const TH1		*ref;		//< Reference object described.
+  double		entries;	//< Reference entries when cached.
+  int			ncells;		//< Cells including under/overflow.
+  std::vector<double>	content;	//< Contents by global bin number.
+  std::vector<double>	error2;		//< Squared errors, filled on demand.
+  int			first;		//< First bin summed in @a sum.
+  int			last;		//< Last bin summed in @a sum.
+  double		sum;		//< Sum of contents in [first, last].
+  bool			kolmogorov;	//< Kolmogorov quantities are valid.
+  double		kssum;		//< Sum of contents in [1, nbins].
+  double		ksw2;		//< Sum of squared errors in [1, nbins].
+  double		kstsum;		//< @a kssum plus under/overflow.
+  std::vector<double>	cumulative;	//< Normalised cumulative contents.
+
+  double rangeSum(int from, int to);
+  void prepareErrors(void);
+  void prepareKolmogorov(void);
+};
+
+/** Execution statistics of a quality test, accumulated over all the
+    monitor elements it ran on since the last reset.  */
+struct QCriterionStats
+{
+  uint64_t		calls;		//< Number of test runs.
+  uint64_t		totalTime;	//< Total wall time in nanoseconds.
+  uint64_t		maxTime;	//< Longest single run in nanoseconds.
+  uint64_t		bins;		//< Bins processed, incl. under/overflow.
+  std::string		worstME;	//< Monitor element of the longest run.
+
+  QCriterionStats(void)
+    : calls(0), totalTime(0), maxTime(0), bins(0)
+    {}
+};
+
 /** Base class for quality tests run on Monitoring Elements;
 
     Currently supporting the following tests:
@@ -57,12 +101,20 @@ public:
   /// get algorithm name
   std::string algoName(void) const      { return algoName_; }
   /// set probability limit for warning and error (default: 90% and 50%)
-  void setWarningProb(float prob)       { warningProb_ = prob; }
-  void setErrorProb(float prob)         { errorProb_ = prob; }
+  void setWarningProb(float prob)       { warningProb_ = prob; ++paramVersion_; }
+  void setErrorProb(float prob)         { errorProb_ = prob; ++paramVersion_; }
+  /// set minimum time in seconds between two runs of the test on the
+  /// same monitor element (default: 0, run whenever the inputs change)
+  void setMinInterval(double seconds)   { minInterval_ = uint64_t(seconds * 1e9); }
+  double getMinInterval(void) const     { return minInterval_ * 1e-9; }
   /// get vector of channels that failed test
   /// (not relevant for all quality tests!)
   virtual std::vector<DQMChannel> getBadChannels(void) const
                                         { return std::vector<DQMChannel>(); }
+  /// get execution statistics of the test
+  const QCriterionStats &getStats(void) const { return stats_; }
+  /// reset execution statistics of the test
+  void resetStats(void)                 { stats_ = QCriterionStats(); }
 
 protected:
   QCriterion(std::string qtname)        { qtname_ = qtname; init(); }
@@ -74,6 +126,14 @@ protected:
   virtual float runTest(const MonitorElement *me);
   /// set algorithm name
   void setAlgoName(std::string name)    { algoName_ = name; }
+  /// get the reference of monitor element @a me for reading only;
+  /// unlike getRef*() this does not copy references shared with other
+  /// processes out of their read-only memory
+  static TH1 *reference(const MonitorElement *me) { return me->accessRefObject(); }
+  /// get cached reference quantities for monitor element @a me
+  static QReferenceCache *referenceCache(const MonitorElement *me, const TH1 *ref);
+  /// account a run on monitor element @a me which took @a ns nanoseconds
+  void recordRun(const MonitorElement *me, uint64_t ns);
 
   float runTest(const MonitorElement *me, QReport &qr, DQMNet::QValue &qv)   {
       assert(qr.qcriterion_ == this);
@@ -98,13 +158,17 @@ protected:
       qv.qtname = qtname_;
       qv.algorithm = algoName_;
       qv.qtresult = prob_;
-      qr.badChannels_ = getBadChannels();
+      swapBadChannels(qr.badChannelSet_);
+      qr.expanded_ = false;
 
       return prob_;
     }
 
   /// set message after test has run
   virtual void setMessage(void) = 0;
+  /// hand over channels that failed the last test run to @a into
+  virtual void swapBadChannels(DQMChannelSet &into)
+                                        { into.clear(); }
 
   std::string qtname_;  /// name of quality test
   std::string algoName_;  /// name of algorithm
@@ -114,6 +178,9 @@ protected:
   float warningProb_, errorProb_;  /// probability limits for warnings, errors
   void setVerbose(int verbose)          { verbose_ = verbose; }
   int verbose_;  
+  QCriterionStats stats_;  /// execution statistics
+  uint64_t paramVersion_;  /// bumped whenever a test parameter changes
+  uint64_t minInterval_;  /// minimum time between runs in ns
 
 private:
   /// default "probability" values for setting warnings & errors when running tests
@@ -139,11 +206,16 @@ public:
   {}
 
   /// set minimum # of entries needed
-  void setMinimumEntries(unsigned n) { minEntries_ = n; }
-  /// get vector of channels that failed test (not always relevant!)
+  void setMinimumEntries(unsigned n) { minEntries_ = n; ++paramVersion_; }
+  /// get vector of channels that failed test (not always relevant!);
+  /// after a run through MonitorElement::runQTests() they are found
+  /// in the QReport instead
   virtual std::vector<DQMChannel> getBadChannels(void) const
   { 
-    return keepBadChannels_ ? badChannels_ : QCriterion::getBadChannels(); 
+    std::vector<DQMChannel> channels;
+    if (keepBadChannels_)
+      badChannels_.expand(channels);
+    return channels;
   }
 
 protected:
@@ -154,8 +226,19 @@ protected:
     message_.clear();
   }
 
+  /// move bad channels into the report without copying; the
+  /// test's own set is left empty for the next run
+  virtual void swapBadChannels(DQMChannelSet &into)
+  {
+    if (keepBadChannels_)
+      into.swap(badChannels_);
+    else
+      into.clear();
+    badChannels_.clear();
+  }
+
   unsigned minEntries_;  //< minimum # of entries needed
-  std::vector<DQMChannel> badChannels_;
+  DQMChannelSet badChannels_;
   bool keepBadChannels_;
  };
 
@@ -237,6 +320,7 @@ public:
   { 
     xmin_ = xmin; xmax_ = xmax; 
     rangeInitialized_ = true; 
+    ++paramVersion_;
   }
 
 protected: 
@@ -257,11 +341,12 @@ public:
   static std::string getAlgoName(void) { return "ContentsYRange"; }
   float runTest(const MonitorElement *me);
 
-  void setUseEmptyBins(unsigned int useEmptyBins) { useEmptyBins_ = useEmptyBins; }
+  void setUseEmptyBins(unsigned int useEmptyBins) { useEmptyBins_ = useEmptyBins; ++paramVersion_; }
   virtual void setAllowedYRange(double ymin, double ymax)
   { 
     ymin_ = ymin; ymax_ = ymax; 
     rangeInitialized_ = true; 
+    ++paramVersion_;
   }
 
 protected:
@@ -289,6 +374,7 @@ public:
   { 
     ymin_ = ymin;  
     rangeInitialized_ = true; 
+    ++paramVersion_;
   } /// ymin - threshold
 
 protected:
@@ -318,7 +404,7 @@ public:
   /// Will use rollover when bin+i or bin-i is beyond histogram limits (e.g.
   /// for histogram with N bins, bin N+1 corresponds to bin 1,
   /// and bin -1 corresponds to bin N)
-  void setNumNeighbors(unsigned n) { if (n > 0) numNeighbors_ = n; }
+  void setNumNeighbors(unsigned n) { if (n > 0) numNeighbors_ = n; ++paramVersion_; }
 
   /// set (percentage) tolerance for considering a channel noisy;
   /// eg. if tolerance = 20%, a channel will be noisy
@@ -330,6 +416,7 @@ public:
     {
       tolerance_ = percentage;
       rangeInitialized_ = true;
+      ++paramVersion_;
     }
   }
 
@@ -362,6 +449,7 @@ public:
 
   void setUseEmptyBins(unsigned int useEmptyBins) { 
     useEmptyBins_ = useEmptyBins; 
+    ++paramVersion_;
   }
   void setMeanRange(double xmin, double xmax);
   void setRMSRange(double xmin, double xmax);
@@ -373,6 +461,7 @@ public:
     {
       toleranceMean_ = fracTolerance;
       checkMeanTolerance_ = true;
+      ++paramVersion_;
     }
   }
 
@@ -399,7 +488,7 @@ public:
   static std::string getAlgoName(void) { return "MeanWithinExpected"; }
   float runTest(const MonitorElement*me);
 
-  void setExpectedMean(double mean) { expMean_ = mean; }
+  void setExpectedMean(double mean) { expMean_ = mean; ++paramVersion_; }
   void useRange(double xmin, double xmax);
   void useSigma(double expectedSigma);
   void useRMS(void) ;
@@ -540,12 +629,12 @@ public:
 
   static std::string getAlgoName(void) { return "RuleFixedFlatOccupancy1d"; }
 
-  void set_Occupancy(double level)     { b = level; }
-  void set_ExclusionMask(double *mask) { ExclusionMask = mask; }
-  void set_epsilon_min(double epsilon) { epsilon_min = epsilon; }
-  void set_epsilon_max(double epsilon) { epsilon_max = epsilon; }
-  void set_S_fail(double S)            { S_fail = S; }
-  void set_S_pass(double S)            { S_pass = S; }
+  void set_Occupancy(double level)     { b = level; ++paramVersion_; }
+  void set_ExclusionMask(double *mask) { ExclusionMask = mask; ++paramVersion_; }
+  void set_epsilon_min(double epsilon) { epsilon_min = epsilon; ++paramVersion_; }
+  void set_epsilon_max(double epsilon) { epsilon_max = epsilon; ++paramVersion_; }
+  void set_S_fail(double S)            { S_fail = S; ++paramVersion_; }
+  void set_S_pass(double S)            { S_pass = S; ++paramVersion_; }
   double get_FailedBins(void)          { return *FailedBins[1]; } // FIXME: WRONG! OFF BY ONE!?
   int get_result()                     { return result; }
 
@@ -571,9 +660,9 @@ public:
   }
   static std::string getAlgoName(void) { return "RuleCSC01"; }
 
-  void set_epsilon_max(double epsilon) { epsilon_max = epsilon; }
-  void set_S_fail(double S)	       { S_fail = S; }
-  void set_S_pass(double S)	       { S_pass = S; }
+  void set_epsilon_max(double epsilon) { epsilon_max = epsilon; ++paramVersion_; }
+  void set_S_fail(double S)	       { S_fail = S; ++paramVersion_; }
+  void set_S_pass(double S)	       { S_pass = S; ++paramVersion_; }
   double get_epsilon_obs() 	       { return epsilon_obs; }
   double get_S_fail_obs()  	       { return S_fail_obs;  }
   double get_S_pass_obs()  	       { return S_pass_obs;  }
@@ -611,12 +700,12 @@ public:
   static std::string getAlgoName(void) { return "CompareToMedian"; }
 
   float runTest(const MonitorElement *me);
-  void setMin(float min){_min = min;};
-  void setMax(float max){_max = max;};
-  void setEmptyBins(int eB){eB > 0 ? _emptyBins = 1 : _emptyBins = 0;};
-  void setMaxMedian(float max){_maxMed = max;};
-  void setMinMedian(float min){_minMed = min;};
-  void setStatCut(float cut){_statCut = (cut > 0) ? cut : 0;};
+  void setMin(float min){_min = min; ++paramVersion_;};
+  void setMax(float max){_max = max; ++paramVersion_;};
+  void setEmptyBins(int eB){eB > 0 ? _emptyBins = 1 : _emptyBins = 0; ++paramVersion_;};
+  void setMaxMedian(float max){_maxMed = max; ++paramVersion_;};
+  void setMinMedian(float min){_minMed = min; ++paramVersion_;};
+  void setStatCut(float cut){_statCut = (cut > 0) ? cut : 0; ++paramVersion_;};
 
 protected :
   void setMessage(void){
@@ -659,9 +748,9 @@ public:
   static std::string getAlgoName(void) { return "CompareLastFilledBin"; }
 
   float runTest(const MonitorElement *me);
-  void setAverage(float average){_average = average;};
-  void setMin(float min){_min = min;};
-  void setMax(float max){_max = max;};
+  void setAverage(float average){_average = average; ++paramVersion_;};
+  void setMin(float min){_min = min; ++paramVersion_;};
+  void setMax(float max){_max = max; ++paramVersion_;};
 
 
 protected :
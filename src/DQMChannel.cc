@@ -0,0 +1,187 @@
+#include "DQMServices/Core/interface/DQMChannel.h"
+#include <algorithm>
+
+DQMChannelSet::DQMChannelSet(void)
+  : nbinsx_(0),
+    nbinsy_(0),
+    shaped_(false),
+    last_(0)
+{}
+
+/// Remove all channels and forget the shape.  The storage is kept
+/// so that the next test run can refill the set without allocating.
+void
+DQMChannelSet::clear(void)
+{
+  nbinsx_ = nbinsy_ = 0;
+  shaped_ = false;
+  last_ = 0;
+  bits_.clear();
+  content_.clear();
+  rms_.clear();
+  binz_.clear();
+  extra_.clear();
+}
+
+/// Remove all channels and declare the binning of the histogram the
+/// channels refer to: @a nbinsx bins along x and, for 2D histograms,
+/// @a nbinsy bins along y.  Under- and overflow bins are included.
+/// The cell bitmap is allocated by the first add(), so tests which
+/// flag nothing, the common case, never pay for it.
+void
+DQMChannelSet::reshape(int nbinsx, int nbinsy /* = 0 */)
+{
+  clear();
+  if (nbinsx < 0 || nbinsy < 0)
+    return;
+
+  uint64_t ncells = uint64_t(nbinsx) + 2;
+  if (nbinsy)
+    ncells *= uint64_t(nbinsy) + 2;
+  if (ncells > 0xffffffffULL)
+    return;
+
+  nbinsx_ = nbinsx;
+  nbinsy_ = nbinsy;
+  shaped_ = true;
+}
+
+/// Compute the cell number of a channel.  Returns false if the set
+/// has no shape or the channel lies outside of it.
+bool
+DQMChannelSet::cell(int binx, int biny, uint32_t &key) const
+{
+  if (! shaped_ || binx < 0 || binx > nbinsx_+1)
+    return false;
+
+  if (! nbinsy_)
+  {
+    key = binx;
+    return biny == 0;
+  }
+
+  if (biny < 0 || biny > nbinsy_+1)
+    return false;
+
+  key = uint32_t(binx) * uint32_t(nbinsy_+2) + biny;
+  return true;
+}
+
+/// Check whether cell @a key is flagged.
+bool
+DQMChannelSet::flagged(uint32_t key) const
+{
+  return ! bits_.empty() && (bits_[key/64] & (1ULL << (key % 64)));
+}
+
+/// Number of flagged cells before cell @a key.
+size_t
+DQMChannelSet::rank(uint32_t key) const
+{
+  size_t n = 0;
+  size_t word = key / 64;
+  for (size_t i = 0; i < word; ++i)
+    n += __builtin_popcountll(bits_[i]);
+  if (key % 64)
+    n += __builtin_popcountll(bits_[word] & ((1ULL << (key % 64)) - 1));
+  return n;
+}
+
+/// Flag a channel.  Channels are expected to be added in cell order,
+/// which is what the quality tests do; out of order additions are
+/// supported but shift the side arrays.
+void
+DQMChannelSet::add(int binx, int biny, int binz, float content, float rms)
+{
+  uint32_t key = 0;
+  if (! cell(binx, biny, key) || flagged(key))
+  {
+    extra_.push_back(DQMChannel(binx, biny, binz, content, rms));
+    return;
+  }
+
+  if (bits_.empty())
+  {
+    uint64_t ncells = uint64_t(nbinsx_) + 2;
+    if (nbinsy_)
+      ncells *= uint64_t(nbinsy_) + 2;
+    bits_.assign((ncells + 63) / 64, 0);
+  }
+
+  bits_[key/64] |= 1ULL << (key % 64);
+  if (content_.empty() || key > last_)
+  {
+    content_.push_back(content);
+    rms_.push_back(rms);
+    if (binz)
+      binz_.push_back(CellValue(key, binz));
+    last_ = key;
+  }
+  else
+  {
+    size_t pos = rank(key);
+    content_.insert(content_.begin() + pos, content);
+    rms_.insert(rms_.begin() + pos, rms);
+    if (binz)
+      binz_.insert(std::lower_bound(binz_.begin(), binz_.end(),
+				    CellValue(key, 0)),
+		   CellValue(key, binz));
+  }
+}
+
+/// Check whether a channel was flagged.
+bool
+DQMChannelSet::contains(int binx, int biny /* = 0 */) const
+{
+  uint32_t key = 0;
+  if (cell(binx, biny, key) && flagged(key))
+    return true;
+
+  for (size_t i = 0, e = extra_.size(); i < e; ++i)
+    if (extra_[i].binx == binx && extra_[i].biny == biny)
+      return true;
+
+  return false;
+}
+
+/// Recreate the list of channels in the DQMChannel representation.
+void
+DQMChannelSet::expand(std::vector<DQMChannel> &into) const
+{
+  into.clear();
+  into.reserve(size());
+
+  std::vector<CellValue>::const_iterator zi = binz_.begin();
+  std::vector<CellValue>::const_iterator ze = binz_.end();
+  size_t index = 0;
+  for (size_t word = 0, nwords = bits_.size(); word < nwords; ++word)
+    for (uint64_t bits = bits_[word]; bits; bits &= bits - 1)
+    {
+      uint32_t key = word * 64 + __builtin_ctzll(bits);
+      int binx = nbinsy_ ? key / (nbinsy_+2) : key;
+      int biny = nbinsy_ ? key % (nbinsy_+2) : 0;
+      int binz = 0;
+      if (zi != ze && zi->first == key)
+	binz = (zi++)->second;
+
+      into.push_back(DQMChannel(binx, biny, binz, content_[index], rms_[index]));
+      ++index;
+    }
+
+  into.insert(into.end(), extra_.begin(), extra_.end());
+}
+
+/// Exchange the contents of two sets without copying.
+void
+DQMChannelSet::swap(DQMChannelSet &x)
+{
+  std::swap(nbinsx_, x.nbinsx_);
+  std::swap(nbinsy_, x.nbinsy_);
+  std::swap(shaped_, x.shaped_);
+  std::swap(last_, x.last_);
+  bits_.swap(x.bits_);
+  content_.swap(x.content_);
+  rms_.swap(x.rms_);
+  binz_.swap(x.binz_);
+  extra_.swap(x.extra_);
+}
@@ -0,0 +1,450 @@
+#include "DQMServices/Core/src/DQMCollate.h"
+#include "DQMServices/Core/interface/MonitorElement.h"
+#include "TClass.h"
+#include <iostream>
+#include <cmath>
+#include <cstring>
+
+// Profile bin entries are not reachable through the public interface
+// as an array; name them through a derived class instead.
+struct DQMCollateProfile : public TProfile
+{
+  static TArrayD TProfile::*binEntries(void) { return &DQMCollateProfile::fBinEntries; }
+};
+
+struct DQMCollateProfile2D : public TProfile2D
+{
+  static TArrayD TProfile2D::*binEntries(void) { return &DQMCollateProfile2D::fBinEntries; }
+};
+
+/// Add @a n elements of @a from to @a to.  The arrays never overlap,
+/// which lets the compiler vectorise the loop.
+template <class T>
+static inline void
+sumArray(T *__restrict__ to, const T *__restrict__ from, Int_t n)
+{
+  for (Int_t i = 0; i < n; ++i)
+    to[i] += from[i];
+}
+
+/// Add the absolute values of @a n elements of @a from to @a to, the
+/// squared weights of bins filled with unit weights.
+template <class T>
+static inline void
+sumAbsArray(Double_t *__restrict__ to, const T *__restrict__ from, Int_t n)
+{
+  for (Int_t i = 0; i < n; ++i)
+    to[i] += std::fabs(Double_t(from[i]));
+}
+
+/// Set @a n elements of @a to to the difference of @a a and @a b.
+template <class T>
+static inline void
+diffArray(T *__restrict__ to, const T *__restrict__ a, const T *__restrict__ b, Int_t n)
+{
+  for (Int_t i = 0; i < n; ++i)
+    to[i] = a[i] - b[i];
+}
+
+/// Set, or with @a add add to, @a to the squared weights of a histogram
+/// with @a n cells: @a sumw2 if it has them, else the absolute contents.
+template <class T>
+static inline void
+weights(Double_t *to, const TArrayD *sumw2, const T *cells, Int_t n, bool add)
+{
+  if (sumw2->fN == n && add)
+    sumArray(to, sumw2->fArray, n);
+  else if (sumw2->fN == n)
+    memcpy(to, sumw2->fArray, n * sizeof(Double_t));
+  else if (add)
+    sumAbsArray(to, cells, n);
+  else
+    for (Int_t i = 0; i < n; ++i)
+      to[i] = std::fabs(Double_t(cells[i]));
+}
+
+/// Check whether @a a and @a b have the same number of bins, range
+/// and, if variable, bin edges on every axis.
+static bool
+sameBinning(const TH1 *a, const TH1 *b)
+{
+  const TAxis *aaxes[3] = { a->GetXaxis(), a->GetYaxis(), a->GetZaxis() };
+  const TAxis *baxes[3] = { b->GetXaxis(), b->GetYaxis(), b->GetZaxis() };
+  for (int i = 0; i < 3; ++i)
+  {
+    const TAxis *aa = aaxes[i];
+    const TAxis *ba = baxes[i];
+    if (aa->GetNbins() != ba->GetNbins()
+	|| aa->GetXmin() != ba->GetXmin()
+	|| aa->GetXmax() != ba->GetXmax())
+      return false;
+
+    const TArrayD *aedges = aa->GetXbins();
+    const TArrayD *bedges = ba->GetXbins();
+    if ((aedges->fN || bedges->fN)
+	&& (aedges->fN != bedges->fN
+	    || memcmp(aedges->fArray, bedges->fArray, aedges->fN * sizeof(Double_t))))
+      return false;
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Check whether @a from has the binning of @a to, the object of @a me.
+/// Warns if the binning differs.
+bool
+DQMCollate::matches(MonitorElement *me, TH1 *to, TH1 *from)
+{
+  if (sameBinning(to, from))
+    return true;
+
+  std::cout << "*** DQMStore: WARNING:"
+	    << "checkBinningMatches: different binning - cannot add object '"
+	    << from->GetName() << "' of type "
+	    << from->IsA()->GetName() << " to existing ME: '"
+	    << me->getFullname() << "'\n";
+  return false;
+}
+
+/// Check whether the histograms can be handled as plain arrays of @a n
+/// cells: @a h has @a n cells, no buffer and is not an average.
+template <class A>
+static bool
+plainArrays(TH1 *h, A *cells, Int_t n)
+{
+  return cells->fN == n
+    && ! h->GetBuffer()
+    && ! h->TestBit(TH1::kIsAverage);
+}
+
+/// Add the histogram @a from into @a to, which have the same binning.
+template <class H, class A>
+static void
+sumHisto(H *to, H *from)
+{
+  A *tocells = to;
+  A *fromcells = from;
+
+  // Take the statistics first, they may be computed from the bins.
+  Double_t tostats[TH1::kNstat];
+  Double_t fromstats[TH1::kNstat];
+  for (int i = 0; i < TH1::kNstat; ++i)
+    tostats[i] = fromstats[i] = 0;
+  to->GetStats(tostats);
+  from->GetStats(fromstats);
+  Double_t entries = to->GetEntries() + from->GetEntries();
+
+  // Same as TH1::Add(): sum the squared weights if either has them,
+  // using the contents for a histogram filled with unit weights.
+  TArrayD *tosumw2 = to->GetSumw2();
+  if (tosumw2->fN == 0 && from->GetSumw2N() != 0)
+    to->Sumw2();
+  if (tosumw2->fN == tocells->fN)
+    weights(tosumw2->fArray, from->GetSumw2(), fromcells->fArray, tosumw2->fN, true);
+
+  sumArray(tocells->fArray, fromcells->fArray, tocells->fN);
+
+  for (int i = 0; i < TH1::kNstat; ++i)
+    tostats[i] += fromstats[i];
+  to->PutStats(tostats);
+  to->SetEntries(entries);
+}
+
+/// Add the histogram @a from into @a to, the object of @a me, where
+/// A is the array base class holding the bin contents.
+template <class H, class A>
+bool
+DQMCollate::addHisto(MonitorElement *me, H *to, H *from)
+{
+  A *tocells = to;
+  A *fromcells = from;
+  Int_t n = tocells->fN;
+  if (! matches(me, to, from))
+    return false;
+
+  if (plainArrays(to, tocells, n) && plainArrays(from, fromcells, n))
+    sumHisto<H, A>(to, from);
+  else
+    to->Add(from);
+  return true;
+}
+
+/// Check whether the profiles can be handled as plain arrays of @a n
+/// cells, and whether they have the same bin squared weights.
+template <class P>
+static bool
+plainProfiles(P *a, P *b, TArrayD P::*entries, Int_t n)
+{
+  TArrayD *acells = a;
+  TArrayD *bcells = b;
+  return acells->fN == n && bcells->fN == n
+    && (a->*entries).fN == n && (b->*entries).fN == n
+    && a->GetSumw2()->fN == n && b->GetSumw2()->fN == n
+    && a->GetBinSumw2()->fN == b->GetBinSumw2()->fN
+    && ! a->GetBuffer() && ! b->GetBuffer();
+}
+
+/// Add the profile @a from into @a to, the object of @a me.  A profile
+/// bin holds the sums of weighted values, of weighted squared values
+/// and of weights, so adding profiles is adding those three arrays.
+template <class P>
+bool
+DQMCollate::addProfile(MonitorElement *me, P *to, P *from, TArrayD P::*entries)
+{
+  TArrayD *tocells = to;
+  TArrayD *fromcells = from;
+  Int_t n = tocells->fN;
+  if (! matches(me, to, from))
+    return false;
+
+  if (! plainProfiles(to, from, entries, n))
+  {
+    me->addProfiles(from, to, to, 1, 1);
+    return true;
+  }
+
+  Double_t tostats[TH1::kNstat];
+  Double_t fromstats[TH1::kNstat];
+  for (int i = 0; i < TH1::kNstat; ++i)
+    tostats[i] = fromstats[i] = 0;
+  to->GetStats(tostats);
+  from->GetStats(fromstats);
+  Double_t nentries = to->GetEntries() + from->GetEntries();
+
+  sumArray(tocells->fArray, fromcells->fArray, n);
+  sumArray(to->GetSumw2()->fArray, from->GetSumw2()->fArray, n);
+  sumArray((to->*entries).fArray, (from->*entries).fArray, n);
+  if (to->GetBinSumw2()->fN == n)
+    sumArray(to->GetBinSumw2()->fArray, from->GetBinSumw2()->fArray, n);
+
+  for (int i = 0; i < TH1::kNstat; ++i)
+    tostats[i] += fromstats[i];
+  to->PutStats(tostats);
+  to->SetEntries(nentries);
+  return true;
+}
+
+/// Copy the histogram @a from into @a to, the object of @a me, as
+/// MonitorElement::copyFrom() does: minus @a subtract if not null,
+/// else added to the current contents unless @a reset.  Returns false
+/// without changing anything if the histograms are not plain arrays
+/// with the same binning.
+template <class H, class A>
+bool
+DQMCollate::copyHisto(MonitorElement *me, H *to, H *from, H *subtract, bool reset)
+{
+  A *tocells = to;
+  A *fromcells = from;
+  A *subcells = subtract;
+  Int_t n = tocells->fN;
+  if (from == to
+      || ! plainArrays(to, tocells, n)
+      || ! plainArrays(from, fromcells, n)
+      || (subtract && ! plainArrays(subtract, subcells, n))
+      || ! sameBinning(to, from)
+      || (subtract && ! sameBinning(to, subtract)))
+    return false;
+
+  if (reset)
+    to->TH1::Reset();
+
+  if (! subtract && ! reset)
+  {
+    sumHisto<H, A>(to, from);
+    return true;
+  }
+
+  // TH1::Add() only keeps the statistics for positive coefficients;
+  // a difference has them recomputed from the bins.
+  Double_t stats[TH1::kNstat];
+  for (int i = 0; i < TH1::kNstat; ++i)
+    stats[i] = 0;
+  if (! subtract)
+    from->GetStats(stats);
+  Double_t entries = from->GetEntries();
+  if (subtract)
+    entries = std::fabs(entries - subtract->GetEntries());
+
+  TArrayD *tosumw2 = to->GetSumw2();
+  if (tosumw2->fN == 0
+      && (from->GetSumw2N() != 0 || (subtract && subtract->GetSumw2N() != 0)))
+    to->Sumw2();
+  if (tosumw2->fN == n)
+  {
+    weights(tosumw2->fArray, from->GetSumw2(), fromcells->fArray, n, false);
+    if (subtract)
+      weights(tosumw2->fArray, subtract->GetSumw2(), subcells->fArray, n, true);
+  }
+
+  if (subtract)
+    diffArray(tocells->fArray, fromcells->fArray, subcells->fArray, n);
+  else
+    memcpy(tocells->fArray, fromcells->fArray, n * sizeof(tocells->fArray[0]));
+
+  if (subtract)
+    to->ResetStats();
+  else
+    to->PutStats(stats);
+  to->SetEntries(entries);
+  return true;
+}
+
+/// Copy the profile @a from into @a to, the object of @a me, as
+/// MonitorElement::copyFrom() does, see copyHisto().  The difference
+/// of two profiles is the difference of their arrays.
+template <class P>
+bool
+DQMCollate::copyProfile(MonitorElement *me, P *to, P *from, P *subtract,
+			bool reset, TArrayD P::*entries)
+{
+  TArrayD *tocells = to;
+  TArrayD *fromcells = from;
+  TArrayD *subcells = subtract;
+  Int_t n = tocells->fN;
+  if (from == to
+      || ! plainProfiles(to, from, entries, n)
+      || (subtract && ! plainProfiles(to, subtract, entries, n))
+      || ! sameBinning(to, from)
+      || (subtract && ! sameBinning(to, subtract)))
+    return false;
+
+  if (reset)
+    to->TH1::Reset();
+
+  Double_t stats[TH1::kNstat];
+  Double_t tostats[TH1::kNstat];
+  for (int i = 0; i < TH1::kNstat; ++i)
+    stats[i] = tostats[i] = 0;
+  from->GetStats(stats);
+  Double_t nentries = from->GetEntries();
+
+  TArrayD *tosumw2 = to->GetSumw2();
+  TArrayD *tobinsumw2 = to->GetBinSumw2();
+  if (subtract)
+  {
+    // As addProfiles(from, subtract, to, 1, -1), which leaves the bin
+    // squared weights alone.
+    Double_t substats[TH1::kNstat];
+    for (int i = 0; i < TH1::kNstat; ++i)
+      substats[i] = 0;
+    subtract->GetStats(substats);
+    for (int i = 0; i < TH1::kNstat; ++i)
+      stats[i] -= substats[i];
+    nentries -= subtract->GetEntries();
+
+    diffArray(tocells->fArray, fromcells->fArray, subcells->fArray, n);
+    diffArray(tosumw2->fArray, from->GetSumw2()->fArray, subtract->GetSumw2()->fArray, n);
+    diffArray((to->*entries).fArray, (from->*entries).fArray, (subtract->*entries).fArray, n);
+    if (reset && tobinsumw2->fN == n)
+      memset(tobinsumw2->fArray, 0, n * sizeof(Double_t));
+  }
+  else if (reset)
+  {
+    memcpy(tocells->fArray, fromcells->fArray, n * sizeof(Double_t));
+    memcpy(tosumw2->fArray, from->GetSumw2()->fArray, n * sizeof(Double_t));
+    memcpy((to->*entries).fArray, (from->*entries).fArray, n * sizeof(Double_t));
+    if (tobinsumw2->fN == n)
+      memcpy(tobinsumw2->fArray, from->GetBinSumw2()->fArray, n * sizeof(Double_t));
+  }
+  else
+  {
+    to->GetStats(tostats);
+    nentries += to->GetEntries();
+    sumArray(tocells->fArray, fromcells->fArray, n);
+    sumArray(tosumw2->fArray, from->GetSumw2()->fArray, n);
+    sumArray((to->*entries).fArray, (from->*entries).fArray, n);
+    if (tobinsumw2->fN == n)
+      sumArray(tobinsumw2->fArray, from->GetBinSumw2()->fArray, n);
+  }
+
+  for (int i = 0; i < TH1::kNstat; ++i)
+    stats[i] += tostats[i];
+  to->PutStats(stats);
+  to->SetEntries(nentries);
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Add @a h into the object of @a me.  Returns false, after a warning,
+/// if the binning differs and nothing was added.
+bool
+DQMCollate::add(MonitorElement *me, TH1F *h)
+{ return addHisto<TH1F, TArrayF>(me, me->getTH1F(), h); }
+
+bool
+DQMCollate::add(MonitorElement *me, TH1S *h)
+{ return addHisto<TH1S, TArrayS>(me, me->getTH1S(), h); }
+
+bool
+DQMCollate::add(MonitorElement *me, TH1D *h)
+{ return addHisto<TH1D, TArrayD>(me, me->getTH1D(), h); }
+
+bool
+DQMCollate::add(MonitorElement *me, TH2F *h)
+{ return addHisto<TH2F, TArrayF>(me, me->getTH2F(), h); }
+
+bool
+DQMCollate::add(MonitorElement *me, TH2S *h)
+{ return addHisto<TH2S, TArrayS>(me, me->getTH2S(), h); }
+
+bool
+DQMCollate::add(MonitorElement *me, TH2D *h)
+{ return addHisto<TH2D, TArrayD>(me, me->getTH2D(), h); }
+
+bool
+DQMCollate::add(MonitorElement *me, TH3F *h)
+{ return addHisto<TH3F, TArrayF>(me, me->getTH3F(), h); }
+
+bool
+DQMCollate::add(MonitorElement *me, TProfile *h)
+{ return addProfile(me, me->getTProfile(), h, DQMCollateProfile::binEntries()); }
+
+bool
+DQMCollate::add(MonitorElement *me, TProfile2D *h)
+{ return addProfile(me, me->getTProfile2D(), h, DQMCollateProfile2D::binEntries()); }
+
+/// Copy @a from into @a to, the object of @a me, as copyFrom() does
+/// with @a subtract its soft reset reference if any and @a reset if it
+/// does not accumulate.  Returns false if there is no fast path for the
+/// histograms and the caller should copy them the general way.
+bool
+DQMCollate::copy(MonitorElement *me, TH1 *to, TH1 *from, TH1 *subtract, bool reset)
+{
+  if (from->IsA() != to->IsA() || (subtract && subtract->IsA() != to->IsA()))
+    return false;
+
+  switch (me->kind())
+  {
+  case MonitorElement::DQM_KIND_TH1F:
+    return copyHisto<TH1F, TArrayF>(me, static_cast<TH1F *>(to), static_cast<TH1F *>(from),
+				    static_cast<TH1F *>(subtract), reset);
+  case MonitorElement::DQM_KIND_TH1S:
+    return copyHisto<TH1S, TArrayS>(me, static_cast<TH1S *>(to), static_cast<TH1S *>(from),
+				    static_cast<TH1S *>(subtract), reset);
+  case MonitorElement::DQM_KIND_TH1D:
+    return copyHisto<TH1D, TArrayD>(me, static_cast<TH1D *>(to), static_cast<TH1D *>(from),
+				    static_cast<TH1D *>(subtract), reset);
+  case MonitorElement::DQM_KIND_TH2F:
+    return copyHisto<TH2F, TArrayF>(me, static_cast<TH2F *>(to), static_cast<TH2F *>(from),
+				    static_cast<TH2F *>(subtract), reset);
+  case MonitorElement::DQM_KIND_TH2S:
+    return copyHisto<TH2S, TArrayS>(me, static_cast<TH2S *>(to), static_cast<TH2S *>(from),
+				    static_cast<TH2S *>(subtract), reset);
+  case MonitorElement::DQM_KIND_TH2D:
+    return copyHisto<TH2D, TArrayD>(me, static_cast<TH2D *>(to), static_cast<TH2D *>(from),
+				    static_cast<TH2D *>(subtract), reset);
+  case MonitorElement::DQM_KIND_TH3F:
+    return copyHisto<TH3F, TArrayF>(me, static_cast<TH3F *>(to), static_cast<TH3F *>(from),
+				    static_cast<TH3F *>(subtract), reset);
+  case MonitorElement::DQM_KIND_TPROFILE:
+    return copyProfile(me, static_cast<TProfile *>(to), static_cast<TProfile *>(from),
+		       static_cast<TProfile *>(subtract), reset,
+		       DQMCollateProfile::binEntries());
+  case MonitorElement::DQM_KIND_TPROFILE2D:
+    return copyProfile(me, static_cast<TProfile2D *>(to), static_cast<TProfile2D *>(from),
+		       static_cast<TProfile2D *>(subtract), reset,
+		       DQMCollateProfile2D::binEntries());
+  default:
+    return false;
+  }
+}
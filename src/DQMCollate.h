@@ -0,0 +1,60 @@
+#ifndef DQMSERVICES_CORE_DQM_COLLATE_H
+# define DQMSERVICES_CORE_DQM_COLLATE_H
+
+# include "Rtypes.h"
+
+class MonitorElement;
+class TH1;
+class TH1F;
+class TH1S;
+class TH1D;
+class TH2F;
+class TH2S;
+class TH2D;
+class TH3F;
+class TProfile;
+class TProfile2D;
+class TArrayD;
+
+/** Collation of histograms into monitor elements, used when the store
+    collates histograms booked or read under the same name.  Once the
+    binning matches, the bin contents, squared weights and, for
+    profiles, the bin entries are summed as plain arrays, and the
+    statistics are added without going through TH1::Add() bin by bin.
+    TH1::Add() and MonitorElement::addProfiles() remain the fallback
+    for histograms with buffers, averaged histograms, and arrays which
+    do not line up.  MonitorElement::copyFrom() uses the same array
+    operations to replace or soft reset histograms in place.
+
+    The binning is compared on both histograms every time, axes can
+    change through SetBins() or SetLimits() without any sign on the
+    monitor element.  */
+class DQMCollate
+{
+public:
+  static bool		add(MonitorElement *me, TH1F *h);
+  static bool		add(MonitorElement *me, TH1S *h);
+  static bool		add(MonitorElement *me, TH1D *h);
+  static bool		add(MonitorElement *me, TH2F *h);
+  static bool		add(MonitorElement *me, TH2S *h);
+  static bool		add(MonitorElement *me, TH2D *h);
+  static bool		add(MonitorElement *me, TH3F *h);
+  static bool		add(MonitorElement *me, TProfile *h);
+  static bool		add(MonitorElement *me, TProfile2D *h);
+  static bool		copy(MonitorElement *me, TH1 *to, TH1 *from,
+			     TH1 *subtract, bool reset);
+
+private:
+  template <class H, class A>
+  static bool		addHisto(MonitorElement *me, H *to, H *from);
+  template <class P>
+  static bool		addProfile(MonitorElement *me, P *to, P *from, TArrayD P::*entries);
+  template <class H, class A>
+  static bool		copyHisto(MonitorElement *me, H *to, H *from, H *subtract, bool reset);
+  template <class P>
+  static bool		copyProfile(MonitorElement *me, P *to, P *from, P *subtract,
+				    bool reset, TArrayD P::*entries);
+  static bool		matches(MonitorElement *me, TH1 *to, TH1 *from);
+};
+
+#endif // DQMSERVICES_CORE_DQM_COLLATE_H
@@ -21,6 +21,7 @@
 #include <cassert>
 #include <cfloat>
 #include <inttypes.h>
+#include <zlib.h>
 
 #if __APPLE__
 # define MESSAGE_SIZE_LIMIT (1*1024*1024)
@@ -252,6 +253,79 @@ DQMNet::unpackQualityData(QReports &qr, uint32_t &flags, const char *from)
   }
 }
 
+/// Encode the difference of @a data from @a base, which must be of
+/// the same size, into @a into as a sequence of changed byte ranges,
+/// each an offset and a length followed by the new bytes.  Ranges
+/// closer than the size of a range header are joined.  Leaves @a
+/// into empty if nothing changed.  For a streamed histogram whose
+/// binning did not change, the ranges are the changed bins and
+/// statistics.
+void
+DQMNet::diffData(DataBlob &into, const DataBlob &base, const DataBlob &data)
+{
+  static const size_t GAP = 2*sizeof(uint32_t);
+  assert(base.size() == data.size());
+  size_t n = data.size();
+  const unsigned char *a = n ? &base[0] : 0;
+  const unsigned char *b = n ? &data[0] : 0;
+  size_t i = 0;
+
+  into.clear();
+  while (i < n)
+  {
+    // Skip unchanged bytes, several at a time while possible.
+    while (i + GAP <= n && memcmp(a + i, b + i, GAP) == 0)
+      i += GAP;
+    while (i < n && a[i] == b[i])
+      ++i;
+    if (i == n)
+      break;
+
+    // Extend the range until enough unchanged bytes follow.
+    size_t start = i, end = ++i, same = 0;
+    for ( ; i < n && same < GAP; ++i)
+      if (a[i] == b[i])
+	++same;
+      else
+	same = 0, end = i+1;
+
+    uint32_t words[2] = { uint32_t(start), uint32_t(end - start) };
+    into.insert(into.end(), (const unsigned char *) words,
+		(const unsigned char *) words + sizeof(words));
+    into.insert(into.end(), b + start, b + end);
+    i = end;
+  }
+}
+
+/// Apply the byte ranges in @a delta of length @a len, as encoded by
+/// diffData(), on @a data.  Returns false if the delta is corrupt or
+/// does not fit in @a data, in which case @a data may have been
+/// partially modified.
+bool
+DQMNet::patchData(DataBlob &data, const unsigned char *delta, size_t len)
+{
+  while (len)
+  {
+    uint32_t words[2];
+    if (len < sizeof(words))
+      return false;
+
+    memcpy(&words[0], delta, sizeof(words));
+    delta += sizeof(words);
+    len -= sizeof(words);
+    if (words[1] > len
+	|| words[0] > data.size()
+	|| words[1] > data.size() - words[0])
+      return false;
+
+    memcpy(&data[words[0]], delta, words[1]);
+    delta += words[1];
+    len -= words[1];
+  }
+
+  return true;
+}
+
 #if 0
 // Deserialise a ROOT object from a buffer at the current position.
 static TObject *
@@ -392,7 +466,7 @@ void
 DQMNet::releaseFromWait(Bucket *msg, WaitObject &w, Object *o)
 {
   if (o)
-    sendObjectToPeer(msg, *o, true);
+    sendObjectUpdateToPeer(msg, w.peer, *o, true, false);
   else
   {
     uint32_t words [3];
@@ -457,6 +531,170 @@ DQMNet::sendObjectToPeer(Bucket *msg, Object &o, bool data)
     copydata(msg, &o.qdata[0], qlen);
 }
 
+/// Compress the data of object @a o into its compressed data cache,
+/// unless already done for this version of the data.  Returns true
+/// if the compressed data is available, false if the data does not
+/// compress; that too is remembered for the version.
+bool
+DQMNet::compressObject(Object &o)
+{
+  if (o.zversion == o.dataversion && o.zsize == o.rawdata.size())
+    return ! o.zdata.empty();
+
+  uLongf zlen = compressBound(o.rawdata.size());
+  o.zdata.resize(zlen);
+  if (compress2(&o.zdata[0], &zlen, &o.rawdata[0], o.rawdata.size(),
+		Z_BEST_SPEED) != Z_OK
+      || zlen >= o.rawdata.size())
+    DataBlob().swap(o.zdata);
+  else
+    o.zdata.resize(zlen);
+
+  o.zversion = o.dataversion;
+  o.zsize = o.rawdata.size();
+  return ! o.zdata.empty();
+}
+
+// Send an object to a peer with its data compressed, see
+// compressObject().  The message is an 'OBJECT' message with the
+// uncompressed data size as an extra word.
+void
+DQMNet::sendCompressedObjectToPeer(Bucket *msg, Object &o)
+{
+  uint32_t words [10];
+  uint32_t namelen = o.dirname->size() + o.objname.size() + 1;
+  uint32_t datalen = o.zdata.size();
+  uint32_t qlen = o.qdata.size();
+
+  if (o.dirname->empty())
+    --namelen;
+
+  words[0] = 10*sizeof(uint32_t) + namelen + datalen + qlen;
+  words[1] = DQM_REPLY_ZOBJECT;
+  words[2] = o.flags & ~DQM_PROP_DEAD;
+  words[3] = (o.version >> 0 ) & 0xffffffff;
+  words[4] = (o.version >> 32) & 0xffffffff;
+  words[5] = o.tag;
+  words[6] = namelen;
+  words[7] = datalen;
+  words[8] = qlen;
+  words[9] = o.rawdata.size();
+
+  msg->data.reserve(msg->data.size() + words[0]);
+  copydata(msg, &words[0], 10*sizeof(uint32_t));
+  if (namelen)
+  {
+    copydata(msg, &(*o.dirname)[0], o.dirname->size());
+    if (! o.dirname->empty())
+      copydata(msg, "/", 1);
+    copydata(msg, &o.objname[0], o.objname.size());
+  }
+  copydata(msg, &o.zdata[0], datalen);
+  if (qlen)
+    copydata(msg, &o.qdata[0], qlen);
+}
+
+/// Send an object to peer @a p as sendObjectToPeer() does.  If @a p
+/// accepts compressed data, send the data compressed if it arrived
+/// compressed, or if compression is enabled and the data is at least
+/// the configured size.  If @a p accepts deltas
+/// and delta updates are enabled, remember the data sent as the base
+/// for the next update.  If also @a delta and the peer has been sent
+/// the base, send only the byte ranges changed since, see diffData().
+/// TCP delivers the messages in order, so the peer has the base by
+/// the time the delta arrives; it checks the base version and asks
+/// for the full object if it does not.  A full object goes out every
+/// keyframe changes, after a change of the data size, and when the
+/// delta would not be much smaller.
+void
+DQMNet::sendObjectUpdateToPeer(Bucket *msg, Peer *p, Object &o, bool data, bool delta)
+{
+  bool hasdata = (p && data && ! o.rawdata.empty()
+		  && (o.flags & DQM_PROP_TYPE_MASK) > DQM_PROP_TYPE_SCALAR);
+  bool track = (hasdata && keyframe_ && (p->caps & DQM_CAP_DELTA));
+
+  if (track
+      && delta
+      && o.baseserial == p->serial
+      && o.deltas < keyframe_
+      && o.dataversion == o.version
+      && o.basedata.size() == o.rawdata.size())
+  {
+    DataBlob objdata;
+    if (o.baseversion != o.version)
+      diffData(objdata, o.basedata, o.rawdata);
+
+    if (objdata.size() < o.rawdata.size() / 2)
+    {
+      uint32_t words [11];
+      uint32_t namelen = o.dirname->size() + o.objname.size() + 1;
+      uint32_t datalen = objdata.size();
+      uint32_t qlen = o.qdata.size();
+
+      if (o.dirname->empty())
+	--namelen;
+
+      words[0] = 11*sizeof(uint32_t) + namelen + datalen + qlen;
+      words[1] = DQM_REPLY_DELTA;
+      words[2] = o.flags & ~DQM_PROP_DEAD;
+      words[3] = (o.version >> 0 ) & 0xffffffff;
+      words[4] = (o.version >> 32) & 0xffffffff;
+      words[5] = o.tag;
+      words[6] = namelen;
+      words[7] = datalen;
+      words[8] = qlen;
+      words[9] = (o.baseversion >> 0 ) & 0xffffffff;
+      words[10] = (o.baseversion >> 32) & 0xffffffff;
+
+      msg->data.reserve(msg->data.size() + words[0]);
+      copydata(msg, &words[0], 11*sizeof(uint32_t));
+      if (namelen)
+      {
+	copydata(msg, &(*o.dirname)[0], o.dirname->size());
+	if (! o.dirname->empty())
+	  copydata(msg, "/", 1);
+	copydata(msg, &o.objname[0], o.objname.size());
+      }
+      if (datalen)
+	copydata(msg, &objdata[0], datalen);
+      if (qlen)
+	copydata(msg, &o.qdata[0], qlen);
+
+      // Bring the base up to date with the ranges just sent.
+      if (datalen)
+      {
+	patchData(o.basedata, &objdata[0], datalen);
+	o.deltas++;
+      }
+      o.baseversion = o.version;
+      return;
+    }
+  }
+
+  // Compressed data received for this version is passed on as it is
+  // even if this end does not compress.
+  bool zipped = (o.zversion == o.dataversion
+		 && o.zsize == o.rawdata.size()
+		 && ! o.zdata.empty());
+  if (hasdata
+      && (p->caps & DQM_CAP_ZLIB)
+      && (zipped
+	  || (compress_
+	      && o.rawdata.size() >= compress_
+	      && compressObject(o))))
+    sendCompressedObjectToPeer(msg, o);
+  else
+    sendObjectToPeer(msg, o, data);
+
+  if (track)
+  {
+    o.basedata = o.rawdata;
+    o.baseversion = o.dataversion;
+    o.baseserial = p->serial;
+    o.deltas = 0;
+  }
+}
+
 //////////////////////////////////////////////////////////////////////
 // Handle peer messages.
 bool
@@ -467,6 +705,37 @@ DQMNet::onMessage(Bucket *msg, Peer *p, unsigned char *data, size_t len)
   memcpy (&type, data + sizeof(uint32_t), sizeof (type));
   switch (type)
   {
+  case DQM_MSG_HELLO:
+    {
+      uint32_t words[4];
+      if (len != sizeof(words))
+      {
+	logme()
+	  << "ERROR: corrupt 'HELLO' message of length " << len
+	  << " from peer " << p->peeraddr << std::endl;
+	return false;
+      }
+
+      memcpy(&words[0], data, sizeof(words));
+      if (debug_)
+	logme()
+	  << "DEBUG: received message 'HELLO " << words[2]
+	  << (words[3] ? " REPLY" : "") << "' from peer "
+	  << p->peeraddr << ", size " << len << std::endl;
+
+      // Remember what the peer accepts, and tell the peer what we
+      // accept unless this is the answer to our own greeting.  We
+      // always accept deltas and compressed data.
+      p->caps = words[2];
+      if (! words[3])
+      {
+	words[2] = DQM_CAP_DELTA | DQM_CAP_ZLIB;
+	words[3] = 1;
+	copydata(msg, &words[0], sizeof(words));
+      }
+    }
+    return true;
+
   case DQM_MSG_UPDATE_ME:
     {
       if (len != 2*sizeof(uint32_t))
@@ -494,7 +763,7 @@ DQMNet::onMessage(Bucket *msg, Peer *p, unsigned char *data, size_t len)
 	  << p->peeraddr << ", size " << len << std::endl;
 
       // Send over current status: list of known objects.
-      sendObjectListToPeer(msg, true, false);
+      sendObjectListToPeer(msg, p, true, false);
     }
     return true;
 
@@ -535,7 +804,7 @@ DQMNet::onMessage(Bucket *msg, Peer *p, unsigned char *data, size_t len)
 	    && (o->flags & DQM_PROP_TYPE_MASK) > DQM_PROP_TYPE_SCALAR)
 	  waitForData(p, name, "", owner);
 	else
-	  sendObjectToPeer(msg, *o, true);
+	  sendObjectUpdateToPeer(msg, p, *o, true, false);
       }
       else
       {
@@ -619,27 +888,32 @@ DQMNet::onMessage(Bucket *msg, Peer *p, unsigned char *data, size_t len)
     return true;
 
   case DQM_REPLY_OBJECT:
+  case DQM_REPLY_ZOBJECT:
     {
-      uint32_t words[9];
-      if (len < sizeof(words))
+      // A compressed object has the uncompressed data size as an
+      // extra word, otherwise the messages are the same.
+      const char *what = (type == DQM_REPLY_ZOBJECT ? "ZOBJECT" : "OBJECT");
+      uint32_t words[10];
+      size_t hdrlen = (type == DQM_REPLY_ZOBJECT ? 10 : 9) * sizeof(uint32_t);
+      if (len < hdrlen)
       {
 	logme()
-	  << "ERROR: corrupt 'OBJECT' message of length " << len
+	  << "ERROR: corrupt '" << what << "' message of length " << len
 	  << " from peer " << p->peeraddr << std::endl;
 	return false;
       }
 
-      memcpy (&words[0], data, sizeof(words));
+      memcpy (&words[0], data, hdrlen);
       uint32_t &namelen = words[6];
       uint32_t &datalen = words[7];
       uint32_t &qlen = words[8];
 
-      if (len != sizeof(words) + namelen + datalen + qlen)
+      if (len != hdrlen + namelen + datalen + qlen)
       {
 	logme()
-	  << "ERROR: corrupt 'OBJECT' message of length " << len
+	  << "ERROR: corrupt '" << what << "' message of length " << len
 	  << " from peer " << p->peeraddr
-	  << ", expected length " << sizeof(words)
+	  << ", expected length " << hdrlen
 	  << " + " << namelen
 	  << " + " << datalen
 	  << " + " << qlen
@@ -647,7 +921,7 @@ DQMNet::onMessage(Bucket *msg, Peer *p, unsigned char *data, size_t len)
 	return false;
       }
 
-      unsigned char *namedata = data + sizeof(words);
+      unsigned char *namedata = data + hdrlen;
       unsigned char *objdata = namedata + namelen;
       unsigned char *qdata = objdata + datalen;
       unsigned char *enddata = qdata + qlen;
@@ -656,10 +930,46 @@ DQMNet::onMessage(Bucket *msg, Peer *p, unsigned char *data, size_t len)
 
       if (debug_)
 	logme()
-	  << "DEBUG: received message 'OBJECT " << name
+	  << "DEBUG: received message '" << what << " " << name
 	  << "' from " << p->peeraddr
 	  << ", size " << len << std::endl;
 
+      // Uncompress the data.  Deflate compresses at most 1032:1,
+      // anything claiming more is corrupt.  Refuse sizes above the
+      // configured limit before allocating anything.
+      DataBlob unzipped;
+      if (type == DQM_REPLY_ZOBJECT)
+      {
+	uLongf rawlen = words[9];
+	if (rawlen > maxUnzipped_)
+	{
+	  logme()
+	    << "ERROR: compressed data for '" << name << "' from peer "
+	    << p->peeraddr << " claims " << rawlen
+	    << " bytes uncompressed, more than the limit of "
+	    << maxUnzipped_ << " bytes\n";
+	  return false;
+	}
+
+	if (! datalen || ! rawlen || rawlen / 1032 > datalen)
+	  rawlen = 0;
+	else
+	{
+	  unzipped.resize(rawlen);
+	  if (uncompress(&unzipped[0], &rawlen, objdata, datalen) != Z_OK)
+	    rawlen = 0;
+	}
+
+	if (rawlen != words[9])
+	{
+	  logme()
+	    << "ERROR: corrupt compressed data of " << datalen
+	    << " bytes for '" << name << "' from peer " << p->peeraddr
+	    << ", expected " << words[9] << " bytes\n";
+	  return false;
+	}
+      }
+
       // Mark the peer as a known object source.
       p->source = true;
 
@@ -676,12 +986,25 @@ DQMNet::onMessage(Bucket *msg, Peer *p, unsigned char *data, size_t len)
       if ((o->flags & DQM_PROP_TYPE_MASK) <= DQM_PROP_TYPE_SCALAR)
       {
 	o->rawdata.clear();
-        o->scalar.insert(o->scalar.end(), objdata, qdata);
+	if (type == DQM_REPLY_ZOBJECT)
+	  o->scalar.insert(o->scalar.end(), unzipped.begin(), unzipped.end());
+	else
+          o->scalar.insert(o->scalar.end(), objdata, qdata);
       }
       else if (datalen)
       {
 	o->rawdata.clear();
-        o->rawdata.insert(o->rawdata.end(), objdata, qdata);
+	o->dataversion = o->version;
+	if (type == DQM_REPLY_ZOBJECT)
+	{
+	  // Keep the compressed data to pass on as it is.
+	  o->rawdata.swap(unzipped);
+	  o->zdata.assign(objdata, qdata);
+	  o->zversion = o->dataversion;
+	  o->zsize = o->rawdata.size();
+	}
+	else
+          o->rawdata.insert(o->rawdata.end(), objdata, qdata);
       }
       else if (! o->rawdata.empty())
 	o->flags |= DQM_PROP_STALE;
@@ -700,6 +1023,92 @@ DQMNet::onMessage(Bucket *msg, Peer *p, unsigned char *data, size_t len)
     }
     return true;
 
+  case DQM_REPLY_DELTA:
+    {
+      uint32_t words[11];
+      if (len < sizeof(words))
+      {
+	logme()
+	  << "ERROR: corrupt 'DELTA' message of length " << len
+	  << " from peer " << p->peeraddr << std::endl;
+	return false;
+      }
+
+      memcpy (&words[0], data, sizeof(words));
+      uint32_t &namelen = words[6];
+      uint32_t &datalen = words[7];
+      uint32_t &qlen = words[8];
+
+      if (len != sizeof(words) + namelen + datalen + qlen)
+      {
+	logme()
+	  << "ERROR: corrupt 'DELTA' message of length " << len
+	  << " from peer " << p->peeraddr
+	  << ", expected length " << sizeof(words)
+	  << " + " << namelen
+	  << " + " << datalen
+	  << " + " << qlen
+	  << std::endl;
+	return false;
+      }
+
+      unsigned char *namedata = data + sizeof(words);
+      unsigned char *objdata = namedata + namelen;
+      unsigned char *qdata = objdata + datalen;
+      unsigned char *enddata = qdata + qlen;
+      std::string name ((char *) namedata, namelen);
+      assert (enddata == data + len);
+
+      if (debug_)
+	logme()
+	  << "DEBUG: received message 'DELTA " << name
+	  << "' from " << p->peeraddr
+	  << ", size " << len << std::endl;
+
+      // Mark the peer as a known object source.
+      p->source = true;
+
+      // Initialise or update an object entry.
+      Object *o = findObject(p, name);
+      if (! o)
+	o = makeObject(p, name);
+
+      uint64_t base = ((uint64_t) words[10] << 32 | words[9]);
+      o->flags = words[2] | DQM_PROP_NEW | DQM_PROP_RECEIVED;
+      o->tag = words[5];
+      o->version = ((uint64_t) words[4] << 32 | words[3]);
+      o->scalar.clear();
+      o->qdata.clear();
+      o->qdata.insert(o->qdata.end(), qdata, enddata);
+
+      // Apply the delta on the data it was made against.  If we do
+      // not have that, keep what we have as stale and ask for the
+      // full object if someone wants it; the next full object from
+      // the peer will bring us back in sync otherwise.
+      if (! o->rawdata.empty()
+	  && o->dataversion == base
+	  && patchData(o->rawdata, objdata, datalen))
+      {
+	o->dataversion = o->version;
+	releaseWaiters(name, o);
+      }
+      else
+      {
+	if (debug_)
+	  logme()
+	    << "DEBUG: cannot apply delta for '" << name
+	    << "' from " << p->peeraddr << ", data is not the base\n";
+
+	if (o->dataversion == base)
+	  o->rawdata.clear();
+	if (! o->rawdata.empty())
+	  o->flags |= DQM_PROP_STALE;
+	if (o->lastreq)
+	  requestObjectData(p, (namelen ? &name[0] : 0), namelen);
+      }
+    }
+    return true;
+
   case DQM_REPLY_NONE:
     {
       uint32_t words[3];
@@ -1063,6 +1472,7 @@ DQMNet::updateMask(Peer *p)
 //////////////////////////////////////////////////////////////////////
 DQMNet::DQMNet (const std::string &appname /* = "" */)
   : debug_ (false),
+    peerSerial_ (0),
     appname_ (appname.empty() ? "DQMNet" : appname.c_str()),
     pid_ (getpid()),
     server_ (0),
@@ -1070,6 +1480,9 @@ DQMNet::DQMNet (const std::string &appname /* = "" */)
     communicate_ ((pthread_t) -1),
     shutdown_ (0),
     delay_ (1000),
+    keyframe_ (0),
+    compress_ (0),
+    maxUnzipped_ (8*MESSAGE_SIZE_LIMIT),
     waitStale_ (0, 0, 0, 0, 500000000 /* 500 ms */),
     waitMax_ (0, 0, 0, 5 /* seconds */, 0),
     flush_ (false)
@@ -1108,6 +1521,46 @@ DQMNet::delay(int delay)
   delay_ = delay;
 }
 
+/// Send updates as deltas to peers which accept them, with the full
+/// object after every @a keyframe changes; zero disables deltas.  If
+/// enabled, greets automatic peers with a 'HELLO' message, which
+/// peers older than delta updates do not understand.  Must be called
+/// before calling run() or start().
+///
+/// Each object keeps one base, a copy of its data as last sent in
+/// full, for the one peer that full object went to.  Deltas are meant
+/// for the single upstream link of a source to its collector.  If
+/// several peers accepting deltas receive the same object, every full
+/// update moves the base to its peer, and the others keep getting
+/// full objects.  Keeping a base per peer would hold one more copy of
+/// the data per peer instead of one per object.
+void
+DQMNet::deltaUpdates(unsigned keyframe)
+{
+  keyframe_ = keyframe;
+}
+
+/// Send object data of at least @a minsize bytes compressed to peers
+/// which accept it; zero disables compression.  The data is compressed
+/// once per version and kept with the object for all peers.  If
+/// enabled, greets automatic peers with a 'HELLO' message as for
+/// deltaUpdates().  Must be called before calling run() or start().
+void
+DQMNet::compressUpdates(size_t minsize)
+{
+  compress_ = minsize;
+}
+
+/// Refuse compressed object data which would uncompress to more than
+/// @a maxsize bytes.  The size is checked before any memory is set
+/// aside, so a corrupt or hostile peer cannot make this end allocate
+/// more.  Must be called before calling run() or start().
+void
+DQMNet::maxUncompressedSize(size_t maxsize)
+{
+  maxUnzipped_ = maxsize;
+}
+
 /// Set the time limit for waiting updates to stale objects.
 /// Once limit has been exhausted whatever data exists is returned.
 /// Applies only when data has been received, another time limit is
@@ -1350,12 +1803,21 @@ DQMNet::run(void)
 	  p->automatic = ap;
 	  p->socket = s;
 	  sel_.attach(s, p->mask, CreateHook(this, &DQMNet::onPeerData, p));
+	  if (keyframe_ || compress_ || ap == &upstream_)
+	  {
+	    p->sendq = new Bucket;
+	    p->sendq->next = 0;
+	  }
+	  if (keyframe_ || compress_)
+	  {
+	    uint32_t words[4] = { 4*sizeof(uint32_t), DQM_MSG_HELLO,
+				  DQM_CAP_DELTA | DQM_CAP_ZLIB, 0 };
+	    copydata(p->sendq, words, sizeof(words));
+	  }
 	  if (ap == &upstream_)
 	  {
 	    uint32_t words[4] = { 2*sizeof(uint32_t), DQM_MSG_LIST_OBJECTS,
 				  2*sizeof(uint32_t), DQM_MSG_UPDATE_ME };
-	    p->sendq = new Bucket;
-	    p->sendq->next = 0;
 	    copydata(p->sendq, words, sizeof(words));
 	  }
 
@@ -1456,7 +1918,19 @@ DQMBasicNet::updateLocalObject(Object &o)
 {
   o.dirname = &*local_->dirs.insert(*o.dirname).first;
   std::pair<ObjectMap::iterator, bool> info(local_->objs.insert(o));
-  if (! info.second)
+  if (info.second)
+  {
+    Object &obj = const_cast<Object &>(*info.first);
+    obj.dataversion = obj.version;
+    obj.basedata.clear();
+    obj.baseversion = 0;
+    obj.baseserial = 0;
+    obj.deltas = 0;
+    obj.zdata.clear();
+    obj.zversion = 0;
+    obj.zsize = 0;
+  }
+  else
   {
     // Somewhat hackish. Sets are supposedly immutable, but we
     // need to change the non-key parts of the object. Erasing
@@ -1469,6 +1943,7 @@ DQMBasicNet::updateLocalObject(Object &o)
     std::swap(old.rawdata,   o.rawdata);
     std::swap(old.scalar,    o.scalar);
     std::swap(old.qdata,     o.qdata);
+    old.dataversion = old.version;
   }
 }
 
@@ -0,0 +1,44 @@
+#ifndef DQMSERVICES_CORE_DQM_ROOT_LOCK_H
+# define DQMSERVICES_CORE_DQM_ROOT_LOCK_H
+
+# include "TH1.h"
+# include <pthread.h>
+
+/** Scoped lock serialising the ROOT calls made by the threads of the
+    DQM core: the saveAsync() writer, the loadMany() reader and the
+    threads using the stores.  ROOT 5 keeps the open files, the
+    directories and the object lists in global state without locking
+    of its own.  Only calls which touch that state need the lock, that
+    is opening, reading, writing and closing files, and creating,
+    cloning and deleting objects other threads may see; filling an
+    object of one's own does not.
+
+    The lock is recursive.  While it is held new histograms are not
+    attached to the current directory, so objects created under it
+    are never reachable from another thread through a directory.  */
+class DQMRootLock
+{
+public:
+  DQMRootLock(void)
+    {
+      pthread_mutex_lock(mutex());
+      addDirectory_ = TH1::AddDirectoryStatus();
+      TH1::AddDirectory(kFALSE);
+    }
+
+  ~DQMRootLock(void)
+    {
+      TH1::AddDirectory(addDirectory_);
+      pthread_mutex_unlock(mutex());
+    }
+
+private:
+  DQMRootLock(const DQMRootLock &);
+  DQMRootLock &operator=(const DQMRootLock &);
+
+  static pthread_mutex_t *mutex(void);
+
+  bool		addDirectory_;	//< Directory setting to restore on release.
+};
+
+#endif // DQMSERVICES_CORE_DQM_ROOT_LOCK_H
@@ -11,6 +11,8 @@
 # include <iostream>
 # include <string>
 # include <memory>
+# include <algorithm>
+# include <unistd.h>
 #include "TBufferFile.h"
 
 // -------------------------------------------------------------------
@@ -49,7 +51,12 @@ DQMService::DQMService(const edm::ParameterSet &pset, edm::ActivityRegistry &ar)
     net_(0),
     filter_(0),
     lastFlush_(0),
-    publishFrequency_(5.0)
+    publishFrequency_(5.0),
+    checkpointFrequency_(300.0),
+    lastCheckpoint_(0),
+    restoreCheckpoint_(false),
+    checkpointSave_(0),
+    run_(0)
 {
   ar.watchPreSourceConstruction(&restrictDQMAccessM);
   ar.watchPostSourceConstruction(&releaseDQMAccessM);
@@ -57,19 +64,27 @@ DQMService::DQMService(const edm::ParameterSet &pset, edm::ActivityRegistry &ar)
   ar.watchPostSource(&releaseDQMAccess);
   ar.watchPreModule(&restrictDQMAccessM);
   ar.watchPostModule(&releaseDQMAccessM);
+  ar.watchPreProcessEvent(this, &DQMService::restore);
   ar.watchPostProcessEvent(this, &DQMService::flush);
   ar.watchPostEndJob(this, &DQMService::shutdown);
 
   std::string host = pset.getUntrackedParameter<std::string>("collectorHost", ""); 
   int port = pset.getUntrackedParameter<int>("collectorPort", 9090);
   bool verbose = pset.getUntrackedParameter<bool>("verbose", false);
+  int keyframe = pset.getUntrackedParameter<int>("deltaKeyframeInterval", 0);
+  int compress = pset.getUntrackedParameter<int>("compressMinSize", 0);
   publishFrequency_ = pset.getUntrackedParameter<double>("publishFrequency", publishFrequency_);
   std::string filter = pset.getUntrackedParameter<std::string>("filter", "");
+  checkpointFile_ = pset.getUntrackedParameter<std::string>("checkpointFile", "");
+  checkpointFrequency_ = pset.getUntrackedParameter<double>("checkpointFrequency", checkpointFrequency_);
+  restoreCheckpoint_ = pset.getUntrackedParameter<bool>("restoreCheckpoint", false);
 
   if (host != "" && port > 0)
   {
     net_ = new DQMBasicNet;
     net_->debug(verbose);
+    net_->deltaUpdates(std::max(keyframe, 0));
+    net_->compressUpdates(std::max(compress, 0));
     net_->updateToCollector(host, port);
     net_->start();
   }
@@ -164,9 +179,11 @@ void DQMService::flushStandalone()
       default:
 	{
           TBufferFile buffer(TBufferFile::kWrite);
+          TH1 *ref = me.accessRefObject();
+          me.loadObject();
           buffer.WriteObject(me.object_);
-          if (me.reference_)
-	    buffer.WriteObject(me.reference_);
+          if (ref)
+	    buffer.WriteObject(ref);
           else
 	    buffer.WriteObjectAny(0, 0);
           o.rawdata.resize(buffer.Length());
@@ -199,8 +216,42 @@ void DQMService::flushStandalone()
   store_->reset();
   lastFlush_ = lat::Time::current().ns() * 1e-9;
 
+  // Checkpoint every so often, the file is written in the background.
+  if (! checkpointFile_.empty() && lastFlush_ - lastCheckpoint_ >= checkpointFrequency_)
+  {
+    // Report a failure of the previous checkpoint, it is done by now.
+    try
+    {
+      store_->waitForSave(checkpointSave_);
+    }
+    catch (std::exception &e)
+    {
+      std::cout << "*** DQMService: WARNING: checkpoint to '" << checkpointFile_
+		<< "' failed: " << e.what() << "\n";
+    }
+
+    checkpointSave_ = store_->checkpointAsync(checkpointFile_, run_);
+    lastCheckpoint_ = lastFlush_;
+  }
+}
 
+// Record the run of each event for the checkpoints, and resume from the
+// checkpoint of a previous process of the same run before the first
+// event.  The modules have booked their monitor elements in their begin
+// job and begin run by then, booking would otherwise reset the restored
+// contents, and nothing has been filled yet.
+void
+DQMService::restore(const edm::EventID &id, const edm::Timestamp &)
+{
+  run_ = id.run();
+  if (restoreCheckpoint_)
+  {
+    restoreCheckpoint_ = false;
+    if (! checkpointFile_.empty() && access(checkpointFile_.c_str(), R_OK) == 0)
+      store_->restore(checkpointFile_, run_);
+  }
 }
+
 void
 DQMService::flush(const edm::Event &, const edm::EventSetup &)
 {
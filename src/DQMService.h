@@ -2,8 +2,12 @@
 # define DQMSERVICES_CORE_DQM_SERVICE_H
 
 # include "FWCore/Framework/interface/Event.h"
+# include "DataFormats/Provenance/interface/EventID.h"
+# include "DataFormats/Provenance/interface/Timestamp.h"
 # include "FWCore/ParameterSet/interface/ParameterSet.h"
 # include "FWCore/ServiceRegistry/interface/ActivityRegistry.h"
+# include <string>
+# include <stdint.h>
 
 class DQMStore;
 class DQMBasicNet;
@@ -19,6 +23,7 @@ public:
 public:
   void flush(const edm::Event &, const edm::EventSetup &);
 private:
+  void restore(const edm::EventID &, const edm::Timestamp &);
   void shutdown(void);
 
   DQMStore	*store_;
@@ -26,6 +31,12 @@ private:
   lat::Regexp	*filter_;
   double	lastFlush_;
   double	publishFrequency_;
+  std::string	checkpointFile_;
+  double	checkpointFrequency_;
+  double	lastCheckpoint_;
+  bool		restoreCheckpoint_;
+  uint64_t	checkpointSave_;
+  unsigned int	run_;
 public:
   void flushStandalone();
 };
@@ -0,0 +1,771 @@
+#include "DQMServices/Core/src/DQMSnapshot.h"
+#include "DQMServices/Core/src/DQMError.h"
+#include "DQMServices/Core/interface/MonitorElement.h"
+#include "THashList.h"
+#include <algorithm>
+#include <memory>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+const char DQMSnapshot::MAGIC[8] = { 'D', 'Q', 'M', 'S', 'N', 'A', 'P', 0 };
+
+// Profile bin entries are not reachable through the public interface
+// as an array; name them through a derived class instead.
+struct DQMSnapshotProfile : public TProfile
+{
+  static TArrayD TProfile::*binEntries(void) { return &DQMSnapshotProfile::fBinEntries; }
+};
+
+struct DQMSnapshotProfile2D : public TProfile2D
+{
+  static TArrayD TProfile2D::*binEntries(void) { return &DQMSnapshotProfile2D::fBinEntries; }
+  static Double_t TProfile2D::*zmin(void) { return &DQMSnapshotProfile2D::fZmin; }
+  static Double_t TProfile2D::*zmax(void) { return &DQMSnapshotProfile2D::fZmax; }
+};
+
+// Size of the file header before the source description was added.
+static const size_t V1_HEADER_SIZE = offsetof(DQMSnapshot::FileHeader, sourceLength);
+
+static inline size_t
+padded(size_t n)
+{
+  return (n + 7) & ~size_t(7);
+}
+
+static bool
+byPath(const std::pair<const std::string *, size_t> &a,
+       const std::pair<const std::string *, size_t> &b)
+{
+  return *a.first < *b.first;
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Pad the record data to the next 8-byte boundary.
+void
+DQMSnapshot::Writer::pad(void)
+{
+  data_.append(padded(data_.size()) - data_.size(), '\0');
+}
+
+/// Start the record of the monitor element @a path.
+void
+DQMSnapshot::Writer::begin(const std::string &path, uint32_t flags, uint32_t tag)
+{
+  Entry e;
+  e.path = path;
+  e.flags = flags;
+  e.offset = data_.size();
+  entries_.push_back(e);
+  sections_ = 0;
+
+  RecordHeader hdr;
+  hdr.flags = flags;
+  hdr.tag = tag;
+  hdr.nsections = 0;
+  hdr.reserved = 0;
+  data_.append((const char *) &hdr, sizeof(hdr));
+}
+
+/// Add a section to the current record.
+void
+DQMSnapshot::Writer::section(uint32_t type, const void *data, uint64_t size)
+{
+  assert(! entries_.empty());
+
+  SectionHeader hdr;
+  hdr.type = type;
+  hdr.reserved = 0;
+  hdr.size = size;
+  data_.append((const char *) &hdr, sizeof(hdr));
+  data_.append((const char *) data, size);
+  pad();
+
+  uint32_t nsections = ++sections_;
+  memcpy(&data_[entries_.back().offset + offsetof(RecordHeader, nsections)],
+	 &nsections, sizeof(nsections));
+}
+
+/// Add a string section to the current record.
+void
+DQMSnapshot::Writer::section(uint32_t type, const std::string &data)
+{
+  section(type, data.data(), data.size());
+}
+
+/// Add the sections describing the histogram @a h to the current record.
+void
+DQMSnapshot::Writer::object(TH1 *h)
+{
+  section(SEC_TITLE, std::string(h->GetTitle()));
+
+  // Axes, with their bin edges if variable, titles and bin labels.
+  TAxis *axes[3] = { h->GetXaxis(), h->GetYaxis(), h->GetZaxis() };
+  for (int i = 0, e = h->GetDimension(); i < e; ++i)
+  {
+    TAxis *a = axes[i];
+    const TArrayD *edges = a->GetXbins();
+    std::string title(a->GetTitle());
+    std::string buf(sizeof(AxisHeader), '\0');
+    AxisHeader *hdr = (AxisHeader *) &buf[0];
+    hdr->axis = i;
+    hdr->nbins = a->GetNbins();
+    hdr->nedges = edges->fN;
+    hdr->titleLength = title.size();
+    hdr->xmin = a->GetXmin();
+    hdr->xmax = a->GetXmax();
+    buf.append((const char *) edges->fArray, edges->fN * sizeof(double));
+    buf += title;
+    section(SEC_AXIS, buf);
+
+    if (THashList *labels = a->GetLabels())
+    {
+      int32_t header[2] = { i, labels->GetSize() };
+      buf.assign((const char *) header, sizeof(header));
+      TIter next(labels);
+      while (TObject *label = next())
+      {
+	int32_t bin = label->GetUniqueID();
+	uint32_t len = strlen(label->GetName());
+	buf.append((const char *) &bin, sizeof(bin));
+	buf.append((const char *) &len, sizeof(len));
+	buf.append(label->GetName(), len);
+      }
+      section(SEC_LABELS, buf);
+    }
+  }
+
+  // Bin contents, straight from the histogram arrays.
+  ArrayHeader ahdr;
+  ahdr.reserved = 0;
+  std::string buf;
+  if (TArrayF *a = dynamic_cast<TArrayF *>(h))
+  {
+    ahdr.type = ARRAY_FLOAT;
+    ahdr.n = a->fN;
+    buf.assign((const char *) &ahdr, sizeof(ahdr));
+    buf.append((const char *) a->fArray, a->fN * sizeof(float));
+  }
+  else if (TArrayD *a = dynamic_cast<TArrayD *>(h))
+  {
+    ahdr.type = ARRAY_DOUBLE;
+    ahdr.n = a->fN;
+    buf.assign((const char *) &ahdr, sizeof(ahdr));
+    buf.append((const char *) a->fArray, a->fN * sizeof(double));
+  }
+  else if (TArrayS *a = dynamic_cast<TArrayS *>(h))
+  {
+    ahdr.type = ARRAY_SHORT;
+    ahdr.n = a->fN;
+    buf.assign((const char *) &ahdr, sizeof(ahdr));
+    buf.append((const char *) a->fArray, a->fN * sizeof(short));
+  }
+  else
+    raiseDQMError("DQMSnapshot", "Cannot save histogram '%s' of unknown"
+		  " array type", h->GetName());
+  section(SEC_CONTENTS, buf);
+
+  if (const TArrayD *sumw2 = h->GetSumw2())
+    if (sumw2->fN)
+      section(SEC_SUMW2, sumw2->fArray, sumw2->fN * sizeof(double));
+
+  // Profile specific data.
+  const TArrayD *entries = 0;
+  const TArrayD *binsumw2 = 0;
+  ProfileHeader phdr;
+  const char *option = 0;
+  if (TProfile *p = dynamic_cast<TProfile *>(h))
+  {
+    phdr.low = p->GetYmin();
+    phdr.high = p->GetYmax();
+    option = p->GetErrorOption();
+    entries = &(p->*DQMSnapshotProfile::binEntries());
+    binsumw2 = p->GetBinSumw2();
+  }
+  else if (TProfile2D *p = dynamic_cast<TProfile2D *>(h))
+  {
+    phdr.low = p->GetZmin();
+    phdr.high = p->GetZmax();
+    option = p->GetErrorOption();
+    entries = &(p->*DQMSnapshotProfile2D::binEntries());
+    binsumw2 = p->GetBinSumw2();
+  }
+
+  if (option)
+  {
+    buf.assign((const char *) &phdr, sizeof(phdr));
+    buf += option;
+    section(SEC_PROFILE, buf);
+    section(SEC_BINENTRIES, entries->fArray, entries->fN * sizeof(double));
+    if (binsumw2 && binsumw2->fN)
+      section(SEC_BINSUMW2, binsumw2->fArray, binsumw2->fN * sizeof(double));
+  }
+
+  // Statistics.
+  double stats[TH1::kNstat];
+  std::fill(stats, stats + TH1::kNstat, 0.);
+  h->GetStats(stats);
+  StatsHeader shdr;
+  shdr.entries = h->GetEntries();
+  shdr.minimum = h->GetMinimumStored();
+  shdr.maximum = h->GetMaximumStored();
+  shdr.nstats = TH1::kNstat;
+  shdr.reserved = 0;
+  buf.assign((const char *) &shdr, sizeof(shdr));
+  buf.append((const char *) stats, sizeof(stats));
+  section(SEC_STATS, buf);
+}
+
+/// Write the snapshot file.
+void
+DQMSnapshot::Writer::write(const std::string &filename)
+{
+  // Sort the index by path name.
+  std::vector< std::pair<const std::string *, size_t> > order;
+  order.reserve(entries_.size());
+  for (size_t i = 0, e = entries_.size(); i < e; ++i)
+    order.push_back(std::make_pair(&entries_[i].path, i));
+  std::sort(order.begin(), order.end(), byPath);
+
+  // Lay out the file.
+  std::vector<IndexEntry> index(entries_.size());
+  std::string strings;
+  for (size_t i = 0, e = order.size(); i < e; ++i)
+  {
+    const Entry &entry = entries_[order[i].second];
+    size_t next = (order[i].second+1 < entries_.size()
+		   ? entries_[order[i].second+1].offset : data_.size());
+    IndexEntry &ie = index[i];
+    ie.pathOffset = strings.size();
+    ie.pathLength = entry.path.size();
+    ie.flags = entry.flags;
+    ie.recordOffset = entry.offset;
+    ie.recordSize = next - entry.offset;
+    strings += entry.path;
+    strings += '\0';
+  }
+  strings.append(padded(strings.size()) - strings.size(), '\0');
+
+  FileHeader hdr;
+  memcpy(hdr.magic, MAGIC, sizeof(hdr.magic));
+  hdr.version = VERSION;
+  hdr.headerSize = sizeof(FileHeader);
+  hdr.nobjects = index.size();
+  hdr.indexOffset = padded(sizeof(FileHeader) + source_.size());
+  hdr.stringsOffset = hdr.indexOffset + index.size() * sizeof(IndexEntry);
+  hdr.dataOffset = hdr.stringsOffset + strings.size();
+  hdr.fileSize = hdr.dataOffset + data_.size();
+  hdr.sourceLength = source_.size();
+  hdr.reserved = 0;
+
+  FILE *f = fopen(filename.c_str(), "wb");
+  if (! f)
+    raiseDQMError("DQMSnapshot", "Failed to create file '%s': %s",
+		  filename.c_str(), strerror(errno));
+
+  static const char zeros[8] = { 0 };
+  bool ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1
+	     && fwrite(source_.data(), 1, source_.size(), f) == source_.size()
+	     && fwrite(zeros, hdr.indexOffset - sizeof(hdr) - source_.size(), 1, f) <= 1
+	     && (index.empty()
+		 || fwrite(&index[0], sizeof(IndexEntry), index.size(), f) == index.size())
+	     && fwrite(strings.data(), 1, strings.size(), f) == strings.size()
+	     && fwrite(data_.data(), 1, data_.size(), f) == data_.size());
+  if (fclose(f) != 0 || ! ok)
+    raiseDQMError("DQMSnapshot", "Failed to write file '%s': %s",
+		  filename.c_str(), strerror(errno));
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Map the snapshot file @a filename and validate its header and index.
+DQMSnapshot::Reader::Reader(const std::string &filename)
+  : filename_(filename),
+    base_(0),
+    length_(0),
+    header_(0),
+    index_(0)
+{
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    raiseDQMError("DQMSnapshot", "Failed to open file '%s': %s",
+		  filename.c_str(), strerror(errno));
+
+  struct stat st;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t) V1_HEADER_SIZE)
+    addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+
+  if (addr == MAP_FAILED)
+    raiseDQMError("DQMSnapshot", "Failed to map file '%s'", filename.c_str());
+
+  base_ = (const char *) addr;
+  length_ = st.st_size;
+  header_ = (const FileHeader *) base_;
+  index_ = (const IndexEntry *) (base_ + header_->indexOffset);
+
+  // Version 1 files have no source description.
+  const FileHeader &h = *header_;
+  bool ok = (memcmp(h.magic, MAGIC, sizeof(h.magic)) == 0
+	     && (h.version == 1 || h.version == VERSION)
+	     && h.fileSize == length_
+	     && h.indexOffset % 8 == 0
+	     && h.indexOffset >= (h.version == 1 ? V1_HEADER_SIZE
+				  : sizeof(FileHeader) + h.sourceLength)
+	     && h.nobjects <= (length_ - h.indexOffset) / sizeof(IndexEntry)
+	     && h.stringsOffset == h.indexOffset + h.nobjects * sizeof(IndexEntry)
+	     && h.dataOffset >= h.stringsOffset
+	     && h.dataOffset % 8 == 0
+	     && h.dataOffset <= length_);
+
+  for (uint64_t i = 0; ok && i < h.nobjects; ++i)
+    ok = (index_[i].pathOffset + index_[i].pathLength < h.dataOffset - h.stringsOffset
+	  && index_[i].recordOffset % 8 == 0
+	  && index_[i].recordSize >= sizeof(RecordHeader)
+	  && index_[i].recordOffset + index_[i].recordSize <= length_ - h.dataOffset);
+
+  if (! ok)
+  {
+    munmap((void *) base_, length_);
+    raiseDQMError("DQMSnapshot", "File '%s' is not a valid snapshot",
+		  filename.c_str());
+  }
+}
+
+DQMSnapshot::Reader::~Reader(void)
+{
+  munmap((void *) base_, length_);
+}
+
+/// Get the description of what the snapshot was made from, empty if
+/// none was given when writing it.
+std::string
+DQMSnapshot::Reader::source(void) const
+{
+  if (header_->version == 1)
+    return std::string();
+  return std::string(base_ + sizeof(FileHeader), header_->sourceLength);
+}
+
+/// Get the path name of monitor element @a i.
+std::string
+DQMSnapshot::Reader::path(uint64_t i) const
+{
+  return std::string(base_ + header_->stringsOffset + index_[i].pathOffset,
+		     index_[i].pathLength);
+}
+
+/// Get the tag of monitor element @a i.
+uint32_t
+DQMSnapshot::Reader::tag(uint64_t i) const
+{
+  return ((const RecordHeader *) (base_ + header_->dataOffset
+				  + index_[i].recordOffset))->tag;
+}
+
+/// Get the sections of the record of monitor element @a i.  The data
+/// points directly into the mapped file.
+void
+DQMSnapshot::Reader::sections(uint64_t i, std::vector<Section> &into) const
+{
+  const char *rec = base_ + header_->dataOffset + index_[i].recordOffset;
+  const char *end = rec + index_[i].recordSize;
+  const RecordHeader *hdr = (const RecordHeader *) rec;
+  const char *p = rec + sizeof(RecordHeader);
+
+  into.clear();
+  into.reserve(hdr->nsections);
+  for (uint32_t n = 0; n < hdr->nsections; ++n)
+  {
+    const SectionHeader *sh = (const SectionHeader *) p;
+    if (p + sizeof(SectionHeader) > end
+	|| sh->size > uint64_t(end - p - sizeof(SectionHeader)))
+      raiseDQMError("DQMSnapshot", "Corrupted record for '%s' in file '%s'",
+		    path(i).c_str(), filename_.c_str());
+
+    Section s;
+    s.type = sh->type;
+    s.size = sh->size;
+    s.data = p + sizeof(SectionHeader);
+    into.push_back(s);
+    p = s.data + padded(s.size);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Check whether @a filename starts with the snapshot file magic.
+bool
+DQMSnapshot::isSnapshot(const std::string &filename)
+{
+  char magic[sizeof(MAGIC)];
+  FILE *f = fopen(filename.c_str(), "rb");
+  if (! f)
+    return false;
+
+  bool ok = (fread(magic, sizeof(magic), 1, f) == 1
+	     && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0);
+  fclose(f);
+  return ok;
+}
+
+/** Arrays of a histogram which point into a read-only snapshot
+    mapping rather than to memory of their own.  The mapping is kept
+    for as long as the arrays use it.  See MonitorElementMapping.  */
+struct DQMSnapshotMapping : public MonitorElementMapping
+{
+  std::shared_ptr<DQMSnapshot::Reader>	reader;
+  std::vector<TArrayF *>		floats;
+  std::vector<TArrayD *>		doubles;
+  std::vector<TArrayS *>		shorts;
+
+  DQMSnapshotMapping(const std::shared_ptr<DQMSnapshot::Reader> &mapping)
+    : reader(mapping)
+    {}
+
+  virtual ~DQMSnapshotMapping(void)
+    {
+      detach(floats);
+      detach(doubles);
+      detach(shorts);
+    }
+
+  virtual void copy(void)
+    {
+      copy<Float_t>(floats);
+      copy<Double_t>(doubles);
+      copy<Short_t>(shorts);
+    }
+
+  void adopt(TArrayF *a) { floats.push_back(a); }
+  void adopt(TArrayD *a) { doubles.push_back(a); }
+  void adopt(TArrayS *a) { shorts.push_back(a); }
+
+  template <class A>
+  static void detach(std::vector<A *> &arrays)
+    {
+      for (size_t i = 0; i < arrays.size(); ++i)
+      {
+	arrays[i]->fArray = 0;
+	arrays[i]->fN = 0;
+      }
+      arrays.clear();
+    }
+
+  template <class T, class A>
+  static void copy(std::vector<A *> &arrays)
+    {
+      for (size_t i = 0; i < arrays.size(); ++i)
+      {
+	T *data = new T[arrays[i]->fN];
+	memcpy(data, arrays[i]->fArray, arrays[i]->fN * sizeof(T));
+	arrays[i]->fArray = data;
+      }
+      arrays.clear();
+    }
+};
+
+/// Fill array @a a from @a size bytes of snapshot @a data, pointing
+/// the array into the data if histogram mapping @a m is given.
+template <class T, class A>
+static void
+fillArray(const std::string &name, A *a, const char *data, uint64_t size,
+	  DQMSnapshotMapping *m)
+{
+  if (size != a->fN * sizeof(T))
+    raiseDQMError("DQMSnapshot", "Array size mismatch while reading '%s'",
+		  name.c_str());
+
+  if (m && size && (uintptr_t) data % sizeof(T) == 0)
+  {
+    delete [] a->fArray;
+    a->fArray = (T *) const_cast<char *>(data);
+    m->adopt(a);
+  }
+  else
+    memcpy(a->fArray, data, size);
+}
+
+/// Recreate the histogram @a name of kind @a flags from its record
+/// @a sections.  The caller owns the returned object.  Given both
+/// @a mapping and @a mapped the bin arrays point into the read-only
+/// mapped file instead of being copied, and @a mapped is set to the
+/// mapping of the arrays, or null if none could be mapped.  The caller
+/// owns the mapping too, and must delete it before the histogram, or
+/// have it copy the arrays before the histogram is modified.
+TH1 *
+DQMSnapshot::object(const std::string &name, uint32_t flags,
+		    const std::vector<Section> &sections,
+		    const std::shared_ptr<Reader> &mapping
+		    /* = std::shared_ptr<Reader>() */,
+		    MonitorElementMapping **mapped /* = 0 */)
+{
+  std::string title;
+  std::string option;
+  const AxisHeader *axes[3] = { 0, 0, 0 };
+  std::vector<double> edges[3];
+  ProfileHeader phdr = { 0, 0 };
+
+  // First pass: gather what is needed to construct the histogram.
+  for (size_t i = 0, e = sections.size(); i < e; ++i)
+  {
+    const Section &s = sections[i];
+    if (s.type == SEC_TITLE)
+      title.assign(s.data, s.size);
+    else if (s.type == SEC_AXIS && s.size >= sizeof(AxisHeader))
+    {
+      const AxisHeader *a = (const AxisHeader *) s.data;
+      if (a->axis < 0 || a->axis > 2 || a->nbins <= 0
+	  || (a->nedges && a->nedges != a->nbins + 1)
+	  || s.size < sizeof(AxisHeader) + a->nedges * sizeof(double) + a->titleLength)
+	raiseDQMError("DQMSnapshot", "Invalid axis in '%s'", name.c_str());
+      axes[a->axis] = a;
+    }
+    else if (s.type == SEC_PROFILE && s.size >= sizeof(ProfileHeader))
+    {
+      memcpy(&phdr, s.data, sizeof(phdr));
+      option.assign(s.data + sizeof(phdr), s.size - sizeof(phdr));
+    }
+  }
+
+  // Compute bin edges for all axes if any has variable bins.
+  bool variable = false;
+  for (int i = 0; i < 3; ++i)
+    variable = variable || (axes[i] && axes[i]->nedges);
+  for (int i = 0; variable && i < 3; ++i)
+    if (const AxisHeader *a = axes[i])
+    {
+      if (a->nedges)
+      {
+	const double *p = (const double *) (a + 1);
+	edges[i].assign(p, p + a->nedges);
+      }
+      else
+	for (int bin = 0; bin <= a->nbins; ++bin)
+	  edges[i].push_back(a->xmin + bin * (a->xmax - a->xmin) / a->nbins);
+    }
+
+  int kind = flags & DQMNet::DQM_PROP_TYPE_MASK;
+  int dim = (kind == MonitorElement::DQM_KIND_TH3F ? 3
+	     : (kind == MonitorElement::DQM_KIND_TH2F
+		|| kind == MonitorElement::DQM_KIND_TH2S
+		|| kind == MonitorElement::DQM_KIND_TH2D
+		|| kind == MonitorElement::DQM_KIND_TPROFILE2D) ? 2 : 1);
+  for (int i = 0; i < dim; ++i)
+    if (! axes[i])
+      raiseDQMError("DQMSnapshot", "Missing axis %d for '%s'", i, name.c_str());
+
+  const char *n = name.c_str();
+  const char *t = title.c_str();
+  const char *o = option.c_str();
+  const AxisHeader *x = axes[0];
+  const AxisHeader *y = axes[1];
+  const AxisHeader *z = axes[2];
+  TH1 *h = 0;
+  switch (kind)
+  {
+  case MonitorElement::DQM_KIND_TH1F:
+    h = (variable ? new TH1F(n, t, x->nbins, &edges[0][0])
+	 : new TH1F(n, t, x->nbins, x->xmin, x->xmax));
+    break;
+
+  case MonitorElement::DQM_KIND_TH1S:
+    h = (variable ? new TH1S(n, t, x->nbins, &edges[0][0])
+	 : new TH1S(n, t, x->nbins, x->xmin, x->xmax));
+    break;
+
+  case MonitorElement::DQM_KIND_TH1D:
+    h = (variable ? new TH1D(n, t, x->nbins, &edges[0][0])
+	 : new TH1D(n, t, x->nbins, x->xmin, x->xmax));
+    break;
+
+  case MonitorElement::DQM_KIND_TH2F:
+    h = (variable ? new TH2F(n, t, x->nbins, &edges[0][0], y->nbins, &edges[1][0])
+	 : new TH2F(n, t, x->nbins, x->xmin, x->xmax, y->nbins, y->xmin, y->xmax));
+    break;
+
+  case MonitorElement::DQM_KIND_TH2S:
+    h = (variable ? new TH2S(n, t, x->nbins, &edges[0][0], y->nbins, &edges[1][0])
+	 : new TH2S(n, t, x->nbins, x->xmin, x->xmax, y->nbins, y->xmin, y->xmax));
+    break;
+
+  case MonitorElement::DQM_KIND_TH2D:
+    h = (variable ? new TH2D(n, t, x->nbins, &edges[0][0], y->nbins, &edges[1][0])
+	 : new TH2D(n, t, x->nbins, x->xmin, x->xmax, y->nbins, y->xmin, y->xmax));
+    break;
+
+  case MonitorElement::DQM_KIND_TH3F:
+    h = (variable ? new TH3F(n, t, x->nbins, &edges[0][0], y->nbins, &edges[1][0],
+			     z->nbins, &edges[2][0])
+	 : new TH3F(n, t, x->nbins, x->xmin, x->xmax, y->nbins, y->xmin, y->xmax,
+		    z->nbins, z->xmin, z->xmax));
+    break;
+
+  case MonitorElement::DQM_KIND_TPROFILE:
+    h = (variable ? new TProfile(n, t, x->nbins, &edges[0][0], phdr.low, phdr.high, o)
+	 : new TProfile(n, t, x->nbins, x->xmin, x->xmax, phdr.low, phdr.high, o));
+    break;
+
+  case MonitorElement::DQM_KIND_TPROFILE2D:
+    if (variable)
+    {
+      // There is no variable bin constructor with z limits.
+      TProfile2D *p = new TProfile2D(n, t, x->nbins, &edges[0][0],
+				     y->nbins, &edges[1][0], o);
+      p->*DQMSnapshotProfile2D::zmin() = phdr.low;
+      p->*DQMSnapshotProfile2D::zmax() = phdr.high;
+      h = p;
+    }
+    else
+      h = new TProfile2D(n, t, x->nbins, x->xmin, x->xmax, y->nbins, y->xmin, y->xmax,
+			 phdr.low, phdr.high, o);
+    break;
+
+  default:
+    raiseDQMError("DQMSnapshot", "Cannot read '%s' of unsupported type %d",
+		  n, kind);
+  }
+
+  h->SetDirectory(0);
+  std::auto_ptr<TH1> guard(h);
+
+  // Declared after the histogram guard so that on errors the mapping
+  // is destroyed first, detaching the arrays before they are deleted.
+  std::auto_ptr<DQMSnapshotMapping> mguard;
+  if (mapping && mapped)
+    mguard.reset(new DQMSnapshotMapping(mapping));
+  DQMSnapshotMapping *m = mguard.get();
+
+  // Second pass: fill in the contents.
+  TAxis *haxes[3] = { h->GetXaxis(), h->GetYaxis(), h->GetZaxis() };
+  for (size_t i = 0, e = sections.size(); i < e; ++i)
+  {
+    const Section &s = sections[i];
+    switch (s.type)
+    {
+    case SEC_AXIS:
+      // Short sections were skipped in the first pass, the others
+      // were checked there.
+      if (s.size >= sizeof(AxisHeader))
+      {
+	const AxisHeader *a = (const AxisHeader *) s.data;
+	if (a->titleLength)
+	  haxes[a->axis]->SetTitle(std::string(s.data + sizeof(AxisHeader)
+					       + a->nedges * sizeof(double),
+					       a->titleLength).c_str());
+      }
+      break;
+
+    case SEC_LABELS:
+      if (s.size >= 2 * sizeof(int32_t))
+      {
+	int32_t header[2];
+	const char *p = s.data + sizeof(header);
+	const char *end = s.data + s.size;
+	memcpy(header, s.data, sizeof(header));
+	if (header[0] < 0 || header[0] > 2)
+	  break;
+	for (int32_t l = 0; l < header[1] && p + 8 <= end; ++l)
+	{
+	  int32_t bin;
+	  uint32_t len;
+	  memcpy(&bin, p, sizeof(bin));
+	  memcpy(&len, p + 4, sizeof(len));
+	  p += 8;
+	  if (len > uint32_t(end - p))
+	    break;
+	  haxes[header[0]]->SetBinLabel(bin, std::string(p, len).c_str());
+	  p += len;
+	}
+      }
+      break;
+
+    case SEC_CONTENTS:
+      {
+	if (s.size < sizeof(ArrayHeader))
+	  raiseDQMError("DQMSnapshot", "Invalid contents in '%s'", n);
+	const ArrayHeader *a = (const ArrayHeader *) s.data;
+	const char *data = s.data + sizeof(ArrayHeader);
+	uint64_t size = s.size - sizeof(ArrayHeader);
+	TArrayF *af = dynamic_cast<TArrayF *>(h);
+	TArrayD *ad = dynamic_cast<TArrayD *>(h);
+	TArrayS *as = dynamic_cast<TArrayS *>(h);
+	if (a->type == ARRAY_FLOAT && af)
+	  fillArray<Float_t>(name, af, data, size, m);
+	else if (a->type == ARRAY_DOUBLE && ad)
+	  fillArray<Double_t>(name, ad, data, size, m);
+	else if (a->type == ARRAY_SHORT && as)
+	  fillArray<Short_t>(name, as, data, size, m);
+	else
+	  raiseDQMError("DQMSnapshot", "Array type mismatch while reading '%s'",
+			n);
+      }
+      break;
+
+    case SEC_SUMW2:
+      if (h->GetSumw2N() == 0)
+	h->Sumw2();
+      fillArray<Double_t>(name, h->GetSumw2(), s.data, s.size, m);
+      break;
+
+    case SEC_BINENTRIES:
+      if (TProfile *p = dynamic_cast<TProfile *>(h))
+      {
+	TArrayD &a = p->*DQMSnapshotProfile::binEntries();
+	fillArray<Double_t>(name, &a, s.data, s.size, m);
+      }
+      else if (TProfile2D *p = dynamic_cast<TProfile2D *>(h))
+      {
+	TArrayD &a = p->*DQMSnapshotProfile2D::binEntries();
+	fillArray<Double_t>(name, &a, s.data, s.size, m);
+      }
+      break;
+
+    case SEC_BINSUMW2:
+      {
+	TArrayD *a = 0;
+	if (TProfile *p = dynamic_cast<TProfile *>(h))
+	  a = p->GetBinSumw2();
+	else if (TProfile2D *p = dynamic_cast<TProfile2D *>(h))
+	  a = p->GetBinSumw2();
+	if (a)
+	{
+	  if (a->fN == 0)
+	    a->Set(s.size / sizeof(double));
+	  fillArray<Double_t>(name, a, s.data, s.size, m);
+	}
+      }
+      break;
+    }
+  }
+
+  // Statistics last, filling the arrays does not update them.
+  for (size_t i = 0, e = sections.size(); i < e; ++i)
+    if (sections[i].type == SEC_STATS && sections[i].size >= sizeof(StatsHeader))
+    {
+      StatsHeader shdr;
+      double stats[TH1::kNstat];
+      std::fill(stats, stats + TH1::kNstat, 0.);
+      memcpy(&shdr, sections[i].data, sizeof(shdr));
+      memcpy(stats, sections[i].data + sizeof(shdr),
+	     std::min(sections[i].size - sizeof(shdr),
+		      uint64_t(std::min<uint32_t>(shdr.nstats, TH1::kNstat) * sizeof(double))));
+      h->PutStats(stats);
+      h->SetEntries(shdr.entries);
+      if (shdr.minimum != -1111)
+	h->SetMinimum(shdr.minimum);
+      if (shdr.maximum != -1111)
+	h->SetMaximum(shdr.maximum);
+    }
+
+  if (mapped)
+    *mapped = (m && (m->floats.size() || m->doubles.size() || m->shorts.size())
+	       ? mguard.release() : 0);
+  return guard.release();
+}
@@ -0,0 +1,202 @@
+#ifndef DQMSERVICES_CORE_DQM_SNAPSHOT_H
+# define DQMSERVICES_CORE_DQM_SNAPSHOT_H
+
+# include <string>
+# include <vector>
+# include <memory>
+# include <stdint.h>
+
+class TH1;
+class MonitorElementMapping;
+
+/** Native binary snapshot of monitor elements, an alternative to
+    saving the store into a ROOT file.
+
+    A snapshot file is laid out as follows, all integers in host byte
+    order and every part aligned to 8 bytes so the file can be used
+    directly through a read-only memory mapping:
+
+      FileHeader
+      char source[]          what the snapshot was made from, if given
+      IndexEntry[nobjects]   sorted by full path
+      char strings[]         path names referred to by the index
+      records                one per monitor element
+
+    A record is a RecordHeader followed by @a nsections sections, each
+    a SectionHeader followed by its payload padded to 8 bytes.  Readers
+    skip sections of unknown type, so new sections can be added without
+    changing the format version.  Histogram records hold the bin arrays
+    as they are in memory, so loading is a copy rather than a ROOT
+    streamer pass.  */
+class DQMSnapshot
+{
+public:
+  static const char	MAGIC[8];
+  static const uint32_t	VERSION = 2;
+
+  enum SectionType
+  {
+    SEC_SCALAR		= 1,	//< Scalar as a tag string, see MonitorElement::tagString().
+    SEC_TITLE		= 2,	//< Histogram title.
+    SEC_AXIS		= 3,	//< AxisHeader, bin edges if variable, axis title.
+    SEC_LABELS		= 4,	//< Axis number, count, then (bin, length, text) triplets.
+    SEC_CONTENTS	= 5,	//< ArrayHeader and the bin contents.
+    SEC_SUMW2		= 6,	//< Sum of squared weights per bin.
+    SEC_STATS		= 7,	//< StatsHeader and the histogram statistics.
+    SEC_PROFILE		= 8,	//< ProfileHeader and the error option.
+    SEC_BINENTRIES	= 9,	//< Profile bin entries.
+    SEC_BINSUMW2	= 10,	//< Profile sum of squared weights of the bin entries.
+    SEC_QREPORT		= 11,	//< Quality report, see MonitorElement::qualityTagString().
+    SEC_EFFLABEL	= 12,	//< Efficiency tag string.
+    SEC_TAGLABEL	= 13,	//< Tag label string.
+    SEC_QTEST		= 14,	//< Name of a quality test attached, in checkpoints.
+    SEC_QTESTSPEC	= 15,	//< Quality test name, null, match pattern, in checkpoints.
+    SEC_RUN		= 16	//< Run number of a checkpoint, in decimal.
+  };
+
+  enum ArrayType
+  {
+    ARRAY_FLOAT		= 1,
+    ARRAY_DOUBLE	= 2,
+    ARRAY_SHORT		= 3
+  };
+
+  struct FileHeader
+  {
+    char		magic[8];	//< MAGIC.
+    uint32_t		version;	//< VERSION.
+    uint32_t		headerSize;	//< sizeof(FileHeader).
+    uint64_t		nobjects;	//< Number of index entries.
+    uint64_t		indexOffset;	//< File offset of the index.
+    uint64_t		stringsOffset;	//< File offset of the path names.
+    uint64_t		dataOffset;	//< File offset of the first record.
+    uint64_t		fileSize;	//< Total file size.
+    uint32_t		sourceLength;	//< Source description length, from version 2.
+    uint32_t		reserved;
+  };
+
+  struct IndexEntry
+  {
+    uint64_t		pathOffset;	//< Path offset from stringsOffset.
+    uint32_t		pathLength;	//< Path length, without terminating null.
+    uint32_t		flags;		//< Monitor element flags.
+    uint64_t		recordOffset;	//< Record offset from dataOffset.
+    uint64_t		recordSize;	//< Record size in bytes.
+  };
+
+  struct RecordHeader
+  {
+    uint32_t		flags;		//< Monitor element flags.
+    uint32_t		tag;		//< Monitor element tag.
+    uint32_t		nsections;	//< Number of sections following.
+    uint32_t		reserved;
+  };
+
+  struct SectionHeader
+  {
+    uint32_t		type;		//< SectionType.
+    uint32_t		reserved;
+    uint64_t		size;		//< Payload size without padding.
+  };
+
+  struct AxisHeader
+  {
+    int32_t		axis;		//< 0 = x, 1 = y, 2 = z.
+    int32_t		nbins;		//< Number of bins.
+    int32_t		nedges;		//< Bin edges following, zero if fixed bins.
+    uint32_t		titleLength;	//< Title length following the edges.
+    double		xmin;		//< Lower axis edge.
+    double		xmax;		//< Upper axis edge.
+  };
+
+  struct ArrayHeader
+  {
+    uint32_t		type;		//< ArrayType.
+    uint32_t		reserved;
+    uint64_t		n;		//< Number of elements following.
+  };
+
+  struct StatsHeader
+  {
+    double		entries;	//< Number of entries.
+    double		minimum;	//< Stored minimum, -1111 if unset.
+    double		maximum;	//< Stored maximum, -1111 if unset.
+    uint32_t		nstats;		//< Statistics values following.
+    uint32_t		reserved;
+  };
+
+  struct ProfileHeader
+  {
+    double		low;		//< Lower limit of the profiled value.
+    double		high;		//< Upper limit of the profiled value.
+  };
+
+  struct Section
+  {
+    uint32_t		type;
+    uint64_t		size;
+    const char		*data;
+  };
+
+  /** Accumulates records in memory and writes the snapshot file.  */
+  class Writer
+  {
+  public:
+    void		source(const std::string &source) { source_ = source; }
+    void		begin(const std::string &path, uint32_t flags, uint32_t tag);
+    void		section(uint32_t type, const void *data, uint64_t size);
+    void		section(uint32_t type, const std::string &data);
+    void		object(TH1 *h);
+    void		write(const std::string &filename);
+
+  private:
+    struct Entry
+    {
+      std::string	path;
+      uint32_t		flags;
+      uint64_t		offset;
+    };
+
+    void		pad(void);
+
+    std::vector<Entry>	entries_;
+    std::string		source_;
+    std::string		data_;
+    size_t		sections_;
+  };
+
+  /** Read-only memory mapping of a snapshot file.  The pages are
+      shared with every other process mapping the same file.  */
+  class Reader
+  {
+  public:
+    Reader(const std::string &filename);
+    ~Reader(void);
+
+    uint64_t		size(void) const { return header_->nobjects; }
+    std::string		source(void) const;
+    std::string		path(uint64_t i) const;
+    uint32_t		flags(uint64_t i) const { return index_[i].flags; }
+    uint32_t		tag(uint64_t i) const;
+    void		sections(uint64_t i, std::vector<Section> &into) const;
+
+  private:
+    Reader(const Reader &);
+    Reader &operator=(const Reader &);
+
+    std::string		filename_;
+    const char		*base_;
+    size_t		length_;
+    const FileHeader	*header_;
+    const IndexEntry	*index_;
+  };
+
+  static bool		isSnapshot(const std::string &filename);
+  static TH1 *		object(const std::string &name, uint32_t flags,
+			       const std::vector<Section> &sections,
+			       const std::shared_ptr<Reader> &mapping
+			       = std::shared_ptr<Reader>(),
+			       MonitorElementMapping **mapped = 0);
+};
+
+#endif // DQMSERVICES_CORE_DQM_SNAPSHOT_H
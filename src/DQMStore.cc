@@ -3,6 +3,10 @@
 #include "DQMServices/Core/interface/QReport.h"
 #include "DQMServices/Core/interface/QTest.h"
 #include "DQMServices/Core/src/DQMError.h"
+#include "DQMServices/Core/src/DQMCollate.h"
+#include "DQMServices/Core/src/DQMSnapshot.h"
+#include "DQMServices/Core/src/DQMRootLock.h"
+#include "DQMServices/Core/src/DQMTagString.h"
 #include "classlib/utils/RegexpMatch.h"
 #include "classlib/utils/Regexp.h"
 #include "classlib/utils/StringOps.h"
@@ -11,10 +15,28 @@
 #include "TKey.h"
 #include "TClass.h"
 #include "TSystem.h"
+#include "TThread.h"
+#include "TBufferFile.h"
+#include "RZip.h"
 #include <iterator>
+#include <cfloat>
+#include <inttypes.h>
 #include <cerrno>
 #include <boost/algorithm/string.hpp>
 #include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <pthread.h>
+#include <signal.h>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
 
 /** @var DQMStore::verbose_
     Universal verbose flag for DQM. */
@@ -47,11 +69,12 @@ DQMOldReceiver::runQualityTests.  */
 static std::string s_monitorDirName = "DQMData";
 static std::string s_referenceDirName = "Reference";
 static std::string s_collateDirName = "Collate";
+static std::string s_deltaDirName = "DQMDelta";
+static std::string s_checkpointDirName = "DQMCheckpoint";
+static std::string s_metadataName = "dqm.metadata";
+static std::string s_metadataHeader = "DQMMETA 1\n";
 static std::string s_safe = "/ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-+=_()# ";
 
-static const lat::Regexp s_rxmeval ("^<(.*)>(i|f|s|e|t|qr)=(.*)</\\1>$");
-static const lat::Regexp s_rxmeqr1 ("^st:(\\d+):([-+e.\\d]+):([^:]*):(.*)$");
-static const lat::Regexp s_rxmeqr2 ("^st\\.(\\d+)\\.(.*)$");
 static const lat::Regexp s_rxtrace ("(.*)\\((.*)\\+0x.*\\).*");
 
 //////////////////////////////////////////////////////////////////////
@@ -120,7 +143,7 @@ initQCriterion(std::map<std::string, QCriterion *(*)(const std::string &)> &m)
 
 /////////////////////////////////////////////////////////////
 fastmatch::fastmatch (std::string const& _fastString) :
-  fastString_ (_fastString),  matching_ (UseFull)
+  pattern_ (_fastString), fastString_ (_fastString),  matching_ (UseFull)
 {
   try
   {
@@ -255,6 +278,266 @@ bool fastmatch::match(std::string const& s) const
   }
 }
 
+static pthread_once_t s_rootLockOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t s_rootLock;
+
+static void
+initRootLock(void)
+{
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&s_rootLock, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+/// the process wide mutex behind DQMRootLock, created on first use
+pthread_mutex_t *
+DQMRootLock::mutex(void)
+{
+  pthread_once(&s_rootLockOnce, &initRootLock);
+  return &s_rootLock;
+}
+
+/** Objects selected for saving into one file, grouped by the file
+    directory they are written into.  In snapshots taken for saveAsync()
+    all objects are private copies owned by the job; otherwise only
+    the TObjStrings generated for the job are owned.  Native snapshots
+    and checkpoints are instead fully serialised into @a snapshot.  */
+struct DQMStore::SaveJob
+{
+  struct Object
+  {
+    TObject		*obj;	//< Object to write.
+    bool		owned;	//< Whether the job deletes @a obj.
+    const char		*name;	//< Key name, null for the object name.
+  };
+
+  struct Folder
+  {
+    std::string		dir;	 //< Target directory in the file.
+    std::vector<Object>	objects; //< Objects to write into it.
+  };
+
+  std::string		filename;
+  std::string		fileupdate;
+  std::string		path;
+  bool			base;	//< Whether this saves the whole store, a delta base.
+  unsigned		verbose;
+  int			nme;
+  int			compression; //< ROOT compression settings, 100 * algorithm + level.
+  unsigned		threads; //< Number of threads compressing objects.
+  std::vector<Folder>	folders;
+  std::string		live;	//< Paths of all selected objects, for deltas.
+  std::unique_ptr<DQMSnapshot::Writer> snapshot; //< Native snapshot to write instead, if any.
+
+  SaveJob(void)
+    : base(false),
+      verbose(0),
+      nme(0),
+      compression(1),
+      threads(1)
+    {}
+
+  ~SaveJob(void)
+    {
+      DQMRootLock gate;
+      for (size_t i = 0, e = folders.size(); i < e; ++i)
+	for (size_t j = 0, f = folders[i].objects.size(); j < f; ++j)
+	  if (folders[i].objects[j].owned)
+	    delete folders[i].objects[j].obj;
+    }
+
+  /// start a new folder written into file directory @a dir
+  void folder(const std::string &dir)
+    {
+      folders.push_back(Folder());
+      folders.back().dir = dir;
+    }
+
+  /// add an object to the current folder
+  void add(TObject *obj, bool owned, const char *name = 0)
+    {
+      Object o = { obj, owned, name };
+      folders.back().objects.push_back(o);
+    }
+};
+
+/** Background writer for saveAsync().  Jobs are written one at a time
+    in submission order and numbered in that order from one.  Submitting
+    blocks while the configured number of saves are already queued or
+    being written.  */
+class DQMStore::SaveWriter
+{
+public:
+  SaveWriter(void)
+    : submitted_(0),
+      written_(0),
+      baseFailed_(false),
+      stop_(false)
+    {
+      pthread_mutex_init(&lock_, 0);
+      pthread_cond_init(&cond_, 0);
+      pthread_create(&thread_, 0, &run, this);
+    }
+
+  ~SaveWriter(void)
+    {
+      pthread_mutex_lock(&lock_);
+      stop_ = true;
+      pthread_cond_broadcast(&cond_);
+      pthread_mutex_unlock(&lock_);
+      pthread_join(thread_, 0);
+      pthread_cond_destroy(&cond_);
+      pthread_mutex_destroy(&lock_);
+    }
+
+  /// queue @a job for writing, the writer takes ownership of it;
+  /// returns the number of the save
+  uint64_t submit(SaveJob *job, unsigned maxPending)
+    {
+      pthread_mutex_lock(&lock_);
+      while (submitted_ - written_ >= maxPending)
+	pthread_cond_wait(&cond_, &lock_);
+      queue_.push_back(job);
+      uint64_t save = ++submitted_;
+      pthread_cond_broadcast(&cond_);
+      pthread_mutex_unlock(&lock_);
+      return save;
+    }
+
+  /// wait until the save number @a save, or all saves submitted so far
+  /// if it is zero, have been written; returns the error from writing
+  /// @a save, empty if it succeeded
+  std::string wait(uint64_t save)
+    {
+      std::string error;
+      pthread_mutex_lock(&lock_);
+      uint64_t until = (save ? save : submitted_);
+      while (written_ < until)
+	pthread_cond_wait(&cond_, &lock_);
+      std::map<uint64_t, std::string>::iterator i = errors_.find(save);
+      if (i != errors_.end())
+      {
+	error.swap(i->second);
+	errors_.erase(i);
+      }
+      pthread_mutex_unlock(&lock_);
+      return error;
+    }
+
+  /// whether writing the last save of the whole store failed
+  bool baseFailed(void)
+    {
+      pthread_mutex_lock(&lock_);
+      bool failed = baseFailed_;
+      pthread_mutex_unlock(&lock_);
+      return failed;
+    }
+
+private:
+  static void *run(void *obj)
+    {
+      sigset_t sigs;
+      sigfillset(&sigs);
+      pthread_sigmask(SIG_BLOCK, &sigs, 0);
+      ((SaveWriter *)obj)->write();
+      return 0;
+    }
+
+  void write(void)
+    {
+      pthread_mutex_lock(&lock_);
+      while (true)
+      {
+	while (! stop_ && queue_.empty())
+	  pthread_cond_wait(&cond_, &lock_);
+
+	// Drain the queue before stopping.
+	if (queue_.empty())
+	  break;
+
+	SaveJob *job = queue_.front();
+	queue_.pop_front();
+	pthread_mutex_unlock(&lock_);
+
+	std::string error;
+	try
+	{
+	  writeSave(*job);
+	}
+	catch (std::exception &e)
+	{
+	  error = (*e.what() ? e.what() : "unknown error");
+	}
+	catch (...)
+	{
+	  error = "unknown error";
+	}
+	bool base = job->base;
+	delete job;
+
+	pthread_mutex_lock(&lock_);
+	++written_;
+	if (! error.empty())
+	  errors_[written_] = error;
+	if (base)
+	  baseFailed_ = ! error.empty();
+	pthread_cond_broadcast(&cond_);
+      }
+      pthread_mutex_unlock(&lock_);
+    }
+
+  pthread_mutex_t		lock_;
+  pthread_cond_t		cond_;
+  pthread_t			thread_;
+  std::deque<SaveJob *>		queue_;
+  std::map<uint64_t, std::string> errors_;   //< Errors of saves not waited for.
+  uint64_t			submitted_;
+  uint64_t			written_;
+  bool				baseFailed_;
+  bool				stop_;
+};
+
+// Strip the top directory into which everything is saved from the
+// path <dir> of a directory in a file.
+static void
+stripMonitorDir(std::string &dir)
+{
+  if (dir.compare(0, s_monitorDirName.size(), s_monitorDirName) == 0)
+  {
+    if (dir.size() == s_monitorDirName.size())
+      dir.clear();
+    else if (dir[s_monitorDirName.size()] == '/')
+      dir.erase(0, s_monitorDirName.size()+1);
+  }
+}
+
+// Append <value> to a metadata table as a length-prefixed field.
+static void
+packField(std::string &into, const std::string &value)
+{
+  char buf[32];
+  into.append(buf, sprintf(buf, "%lu:", (unsigned long) value.size()));
+  into += value;
+}
+
+// Read the next length-prefixed field of a metadata table at <p>;
+// return false at the end of the table or if it is malformed.
+static bool
+unpackField(const char *&p, const char *end, std::string &value)
+{
+  char *colon = 0;
+  unsigned long len = strtoul(p, &colon, 10);
+  if (colon == p || colon >= end || *colon != ':'
+      || len > (unsigned long) (end - colon - 1))
+    return false;
+
+  value.assign(colon+1, len);
+  p = colon+1+len;
+  return true;
+}
+
 //////////////////////////////////////////////////////////////////////
 DQMStore::DQMStore(const edm::ParameterSet &pset, edm::ActivityRegistry& ar)
   : verbose_ (1),
@@ -262,6 +545,12 @@ DQMStore::DQMStore(const edm::ParameterSet &pset, edm::ActivityRegistry& ar)
     reset_ (false),
     collateHistograms_ (false),
     readSelectedDirectory_ (""),
+    maxPendingSaves_ (2),
+    loadPrefetchMB_ (256),
+    saveThreads_ (1),
+    metadataTable_ (false),
+    saveWriter_ (0),
+    deltaSequence_ (0),
     pwd_ ("")
 {
   initializeFrom(pset);
@@ -277,6 +566,12 @@ DQMStore::DQMStore(const edm::ParameterSet &pset)
     reset_ (false),
     collateHistograms_ (false),
     readSelectedDirectory_ (""),
+    maxPendingSaves_ (2),
+    loadPrefetchMB_ (256),
+    saveThreads_ (1),
+    metadataTable_ (false),
+    saveWriter_ (0),
+    deltaSequence_ (0),
     pwd_ ("")
 {
   initializeFrom(pset);
@@ -284,6 +579,9 @@ DQMStore::DQMStore(const edm::ParameterSet &pset)
 
 DQMStore::~DQMStore(void)
 {
+  // Finish writing any pending saves first.
+  delete saveWriter_;
+
   for (QCMap::iterator i = qtests_.begin(), e = qtests_.end(); i != e; ++i)
     delete i->second;
 
@@ -306,15 +604,38 @@ DQMStore::initializeFrom(const edm::ParameterSet& pset) {
   if (verbose_ > 0)
     std::cout << "DQMStore: QTest verbosity set to " << verboseQT_ << std::endl;
   
+  maxPendingSaves_ = std::max(pset.getUntrackedParameter<int>("maxPendingSaves", 2), 1);
+  if (verbose_ > 0)
+    std::cout << "DQMStore: at most " << maxPendingSaves_
+	      << " asynchronous saves pending\n";
+
+  loadPrefetchMB_ = std::max(pset.getUntrackedParameter<int>("loadPrefetchMB", 256), 0);
+  if (verbose_ > 0)
+    std::cout << "DQMStore: loadMany() reads up to " << loadPrefetchMB_
+	      << " MB of files ahead\n";
+
+  saveThreads_ = std::max(pset.getUntrackedParameter<int>("saveThreads", 4), 1);
+  if (verbose_ > 0)
+    std::cout << "DQMStore: compressing saved objects on " << saveThreads_
+	      << " threads\n";
+
+  metadataTable_ = pset.getUntrackedParameter<bool>("saveMetadataTable", false);
+  if (metadataTable_)
+    std::cout << "DQMStore: saving metadata as one table per directory\n";
+
   collateHistograms_ = pset.getUntrackedParameter<bool>("collateHistograms", false);
   if (collateHistograms_)
     std::cout << "DQMStore: histogram collation is enabled\n";
 
   std::string ref = pset.getUntrackedParameter<std::string>("referenceFileName", "");
+  std::string refcache = pset.getUntrackedParameter<std::string>("referenceCacheFileName", "");
   if (! ref.empty())
   {
     std::cout << "DQMStore: using reference file '" << ref << "'\n";
-    readFile(ref, true, "", s_referenceDirName, StripRunDirs, false);
+    if (! refcache.empty())
+      readReferenceCache(ref, refcache);
+    else
+      readFile(ref, true, "", s_referenceDirName, StripRunDirs, false);
   }  
 
   initQCriterion<Comp2RefChi2>(qalgos_);
@@ -546,16 +867,40 @@ DQMStore::book(const std::string &dir, const std::string &name,
     me = const_cast<MonitorElement &>(*data_.insert(proto).first)
       .initialise((MonitorElement::Kind)kind, h);
 
-    // Initialise quality test information.
-    QTestSpecs::iterator qi = qtestspecs_.begin();
-    QTestSpecs::iterator qe = qtestspecs_.end();
-    for ( ; qi != qe; ++qi)
-    {
-    	if ( qi->first->match(path) )
-    		me->addQReport(qi->second);
-    }
+    attachBooked(me, dir, name, path);
+
+    // Return the monitor element.
+    return me;
+  }
+}
+
+/// Attach to the newly booked monitor element @a me the quality tests
+/// matching its full @a path, and link it with its reference, or if
+/// it is a reference, with the monitor element it belongs to.
+void
+DQMStore::attachBooked(MonitorElement *me,
+		       const std::string &dir,
+		       const std::string &name,
+		       const std::string &path)
+{
+  // Initialise quality test information.
+  QTestSpecs::iterator qi = qtestspecs_.begin();
+  QTestSpecs::iterator qe = qtestspecs_.end();
+  for ( ; qi != qe; ++qi)
+  {
+    if ( qi->first->match(path) )
+      me->addQReport(qi->second);
+  }
 
-    // Assign reference if we have one.
+  // Link the reference if we have one, or if this is a reference,
+  // the monitor element it belongs to.
+  if (isSubdirectory(s_referenceDirName, dir))
+  {
+    if (MonitorElement *master = findMaster(dir, name))
+      master->linkReference(me);
+  }
+  else
+  {
     std::string refdir;
     refdir.reserve(s_referenceDirName.size() + dir.size() + 2);
     refdir += s_referenceDirName;
@@ -563,16 +908,30 @@ DQMStore::book(const std::string &dir, const std::string &name,
     refdir += dir;
 
     if (MonitorElement *refme = findObject(refdir, name))
-    {
-      me->data_.flags |= DQMNet::DQM_PROP_HAS_REFERENCE;
-      me->reference_ = refme->object_;
-    }
-
-    // Return the monitor element.
-    return me;
+      me->linkReference(refme);
   }
 }
 
+/// Book a placeholder for the monitor element @a name of @a kind in
+/// @a dir whose object will be read from @a source on first access.
+MonitorElement *
+DQMStore::bookLazy(const std::string &dir,
+		   const std::string &name,
+		   int kind,
+		   MonitorElementSource *source)
+{
+  std::string path;
+  mergePath(path, dir, name);
+
+  assert(dirs_.count(dir));
+  MonitorElement proto(&*dirs_.find(dir), name);
+  MonitorElement *me = const_cast<MonitorElement &>(*data_.insert(proto).first)
+    .initialise((MonitorElement::Kind)kind);
+  me->source_ = source;
+  attachBooked(me, dir, name, path);
+  return me;
+}
+
 MonitorElement *
 DQMStore::book(const std::string &dir,
                const std::string &name,
@@ -1258,101 +1617,42 @@ DQMStore::bookProfile2D(const std::string &name, TProfile2D *source)
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
-bool
-DQMStore::checkBinningMatches(MonitorElement *me, TH1 *h)
-{
-  if (me->getTH1()->GetNbinsX() != h->GetNbinsX()
-      || me->getTH1()->GetNbinsY() != h->GetNbinsY()
-      || me->getTH1()->GetNbinsZ() != h->GetNbinsZ()
-      || me->getTH1()->GetXaxis()->GetXmin() != h->GetXaxis()->GetXmin()
-      || me->getTH1()->GetYaxis()->GetXmin() != h->GetYaxis()->GetXmin()
-      || me->getTH1()->GetZaxis()->GetXmin() != h->GetZaxis()->GetXmin()
-      || me->getTH1()->GetXaxis()->GetXmax() != h->GetXaxis()->GetXmax()
-      || me->getTH1()->GetYaxis()->GetXmax() != h->GetYaxis()->GetXmax()
-      || me->getTH1()->GetZaxis()->GetXmax() != h->GetZaxis()->GetXmax())
-  {
-    //  edm::LogWarning ("DQMStore")
-    std::cout << "*** DQMStore: WARNING:"
-              << "checkBinningMatches: different binning - cannot add object '"
-              << h->GetName() << "' of type "
-              << h->IsA()->GetName() << " to existing ME: '"
-              << me->getFullname() << "'\n";
-    return false;
-  }
-  return true;	   
-}
-
 void
 DQMStore::collate1D(MonitorElement *me, TH1F *h)
-{ 
-  if (checkBinningMatches(me,h)) 
-    me->getTH1F()->Add(h); 
-}
+{ DQMCollate::add(me, h); }
 
 void
 DQMStore::collate1S(MonitorElement *me, TH1S *h)
-{  
-  if (checkBinningMatches(me,h)) 
-    me->getTH1S()->Add(h); 
-}
+{ DQMCollate::add(me, h); }
 
 void
 DQMStore::collate1DD(MonitorElement *me, TH1D *h)
-{  
-  if (checkBinningMatches(me,h)) 
-    me->getTH1D()->Add(h); 
-}
+{ DQMCollate::add(me, h); }
 
 void
 DQMStore::collate2D(MonitorElement *me, TH2F *h)
-{  
-  if (checkBinningMatches(me,h)) 
-    me->getTH2F()->Add(h); 
-}
+{ DQMCollate::add(me, h); }
 
 void
 DQMStore::collate2S(MonitorElement *me, TH2S *h)
-{  
-  if (checkBinningMatches(me,h)) 
-    me->getTH2S()->Add(h); 
-}
+{ DQMCollate::add(me, h); }
 
 void
 DQMStore::collate2DD(MonitorElement *me, TH2D *h)
-{  
-  if (checkBinningMatches(me,h)) 
-    me->getTH2D()->Add(h); 
-}
+{ DQMCollate::add(me, h); }
 
 void
 DQMStore::collate3D(MonitorElement *me, TH3F *h)
-{  
-  if (checkBinningMatches(me,h)) 
-    me->getTH3F()->Add(h); 
-}
+{ DQMCollate::add(me, h); }
 
 void
 DQMStore::collateProfile(MonitorElement *me, TProfile *h)
-{
-  if (checkBinningMatches(me,h)) 
-  {
-    TProfile *meh = me->getTProfile();
-    me->addProfiles(h, meh, meh, 1, 1);
-  }
-}
+{ DQMCollate::add(me, h); }
 
 void
 DQMStore::collateProfile2D(MonitorElement *me, TProfile2D *h)
-{
-  if (checkBinningMatches(me,h)) 
-  {
-    TProfile2D *meh = me->getTProfile2D();
-    me->addProfiles(h, meh, meh, 1, 1);
-  }
-}
+{ DQMCollate::add(me, h); }
 
-//////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 /// tag ME as <myTag> (myTag > 0)
 void
@@ -1618,6 +1918,18 @@ DQMStore::findObject(const std::string &dir, const std::string &name) const
 	  : const_cast<MonitorElement *>(&*mepos));
 }
 
+/// get the monitor element which the reference monitor element <name>
+/// in reference directory <refdir> belongs to, or null if none
+MonitorElement *
+DQMStore::findMaster(const std::string &refdir, const std::string &name) const
+{
+  if (refdir.size() <= s_referenceDirName.size())
+    return findObject("", name);
+
+  std::string mdir(refdir, s_referenceDirName.size()+1, std::string::npos);
+  return findObject(mdir, name);
+}
+
 /** get tags for various maps, return vector with strings of the form
     <dir pathname>:<obj1>/<tag1>/<tag2>,<obj2>/<tag1>/<tag3>, etc. */
 void
@@ -1771,9 +2083,12 @@ DQMStore::forceReset(void)
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 /// extract object (TH1F, TH2F, ...) from <to>; return success flag
-/// flag fromRemoteNode indicating if ME arrived from different node
+/// flag fromRemoteNode indicating if ME arrived from different node;
+/// with <adopt> a histogram for a new monitor element is taken over
+/// instead of cloned, the caller keeps it only if the monitor element
+/// already existed
 bool
-DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
+DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite, bool adopt /* = false */)
 {
   // NB: Profile histograms inherit from TH*D, checking order matters.
   MonitorElement *refcheck = 0;
@@ -1781,7 +2096,7 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
   {
     MonitorElement *me = findObject(dir, h->GetName());
     if (! me)
-      me = bookProfile(dir, h->GetName(), (TProfile *) h->Clone());
+      me = bookProfile(dir, h->GetName(), adopt ? h : (TProfile *) h->Clone());
     else if (overwrite)
       me->copyFrom(h);
     else if (isCollateME(me) || collateHistograms_)
@@ -1792,7 +2107,7 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
   {
     MonitorElement *me = findObject(dir, h->GetName());
     if (! me)
-      me = bookProfile2D(dir, h->GetName(), (TProfile2D *) h->Clone());
+      me = bookProfile2D(dir, h->GetName(), adopt ? h : (TProfile2D *) h->Clone());
     else if (overwrite)
       me->copyFrom(h);
     else if (isCollateME(me) || collateHistograms_)
@@ -1803,7 +2118,7 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
   {
     MonitorElement *me = findObject(dir, h->GetName());
     if (! me)
-      me = book1D(dir, h->GetName(), (TH1F *) h->Clone());
+      me = book1D(dir, h->GetName(), adopt ? h : (TH1F *) h->Clone());
     else if (overwrite)
       me->copyFrom(h);
     else if (isCollateME(me) || collateHistograms_)
@@ -1814,7 +2129,7 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
   {
     MonitorElement *me = findObject(dir, h->GetName());
     if (! me)
-      me = book1S(dir, h->GetName(), (TH1S *) h->Clone());
+      me = book1S(dir, h->GetName(), adopt ? h : (TH1S *) h->Clone());
     else if (overwrite)
       me->copyFrom(h);
     else if (isCollateME(me) || collateHistograms_)
@@ -1825,7 +2140,7 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
   {
     MonitorElement *me = findObject(dir, h->GetName());
     if (! me)
-      me = book1DD(dir, h->GetName(), (TH1D *) h->Clone());
+      me = book1DD(dir, h->GetName(), adopt ? h : (TH1D *) h->Clone());
     else if (overwrite)
       me->copyFrom(h);
     else if (isCollateME(me) || collateHistograms_)
@@ -1836,7 +2151,7 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
   {
     MonitorElement *me = findObject(dir, h->GetName());
     if (! me)
-      me = book2D(dir, h->GetName(), (TH2F *) h->Clone());
+      me = book2D(dir, h->GetName(), adopt ? h : (TH2F *) h->Clone());
     else if (overwrite)
       me->copyFrom(h);
     else if (isCollateME(me) || collateHistograms_)
@@ -1847,7 +2162,7 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
   {
     MonitorElement *me = findObject(dir, h->GetName());
     if (! me)
-      me = book2S(dir, h->GetName(), (TH2S *) h->Clone());
+      me = book2S(dir, h->GetName(), adopt ? h : (TH2S *) h->Clone());
     else if (overwrite)
       me->copyFrom(h);
     else if (isCollateME(me) || collateHistograms_)
@@ -1858,7 +2173,7 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
   {
     MonitorElement *me = findObject(dir, h->GetName());
     if (! me)
-      me = book2DD(dir, h->GetName(), (TH2D *) h->Clone());
+      me = book2DD(dir, h->GetName(), adopt ? h : (TH2D *) h->Clone());
     else if (overwrite)
       me->copyFrom(h);
     else if (isCollateME(me) || collateHistograms_)
@@ -1869,7 +2184,7 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
   {
     MonitorElement *me = findObject(dir, h->GetName());
     if (! me)
-      me = book3D(dir, h->GetName(), (TH3F *) h->Clone());
+      me = book3D(dir, h->GetName(), adopt ? h : (TH3F *) h->Clone());
     else if (overwrite)
       me->copyFrom(h);
     else if (isCollateME(me) || collateHistograms_)
@@ -1878,8 +2193,8 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
   }
   else if (dynamic_cast<TObjString *>(obj))
   {
-    lat::RegexpMatch m;
-    if (! s_rxmeval.match(obj->GetName(), 0, 0, &m))
+    DQMTagString ts;
+    if (! ts.parse(obj->GetName(), strlen(obj->GetName())))
     {
       if (strstr(obj->GetName(), "CMSSW"))
       {
@@ -1902,132 +2217,8 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
       }
     }
 
-    std::string label = m.matchString(obj->GetName(), 1);
-    std::string kind = m.matchString(obj->GetName(), 2);
-    std::string value = m.matchString(obj->GetName(), 3);
-
-    if (kind == "i")
-    {
-      MonitorElement *me = findObject(dir, label);
-      if (! me || overwrite)
-      {
-	if (! me) me = bookInt(dir, label);
-	me->Fill(atoll(value.c_str()));
-      }
-    }
-    else if (kind == "f")
-    {
-      MonitorElement *me = findObject(dir, label);
-      if (! me || overwrite)
-      {
-	if (! me) me = bookFloat(dir, label);
-	me->Fill(atof(value.c_str()));
-      }
-    }
-    else if (kind == "s")
-    {
-      MonitorElement *me = findObject(dir, label);
-      if (! me)
-	me = bookString(dir, label, value);
-      else if (overwrite)
-	me->Fill(value);
-    }
-    else if (kind == "e")
-    {
-      MonitorElement *me = findObject(dir, label);
-      if (! me)
-      {
-	std::cout << "*** DQMStore: WARNING: no monitor element '"
-		  << label << "' in directory '"
-		  << dir << "' to be marked as efficiency plot.\n";
-	return false;
-      }
-      me->setEfficiencyFlag();
-    }
-    else if (kind == "t")
-    {
-      MonitorElement *me = findObject(dir, label);
-      if (! me)
-      {
-	std::cout << "*** DQMStore: WARNING: no monitor element '"
-		  << label << "' in directory '"
-		  << dir << "' for a tag\n";
-	return false;
-      }
-      errno = 0;
-      char *endp = 0;
-      unsigned long val = strtoul(value.c_str(), &endp, 10);
-      if ((val == 0 && errno) || *endp || val > ~uint32_t(0))
-      {
-	std::cout << "*** DQMStore: WARNING: cannot restore tag '"
-		  << value << "' for monitor element '"
-		  << label << "' in directory '"
-		  << dir << "' - invalid value\n";
-	return false;
-      }
-      tag(me, val);
-    }
-    else if (kind == "qr")
-    {
-      // Handle qreports, but skip them while reading in references.
-      if (! isSubdirectory(s_referenceDirName, dir))
-      {
-        size_t dot = label.find('.');
-        if (dot == std::string::npos)
-        {
-	  std::cout << "*** DQMStore: WARNING: quality report label in '" << label
-		    << "' is missing a '.' and cannot be extracted\n";
-	  return false;
-        }
-
-        std::string mename (label, 0, dot);
-        std::string qrname (label, dot+1, std::string::npos);
-
-        m.reset();
-        DQMNet::QValue qv;
-	if (s_rxmeqr1.match(value, 0, 0, &m))
-	{
-	  qv.code = atoi(m.matchString(value, 1).c_str());
-	  qv.qtresult = strtod(m.matchString(value, 2).c_str(), 0);
-	  qv.message = m.matchString(value, 4);
-	  qv.qtname = qrname;
-	  qv.algorithm = m.matchString(value, 3);
-	}
-	else if (s_rxmeqr2.match(value, 0, 0, &m))
-	{
-	  qv.code = atoi(m.matchString(value, 1).c_str());
-	  qv.qtresult = 0; // unavailable in old format
-	  qv.message = m.matchString(value, 2);
-	  qv.qtname = qrname;
-          // qv.algorithm unavailable in old format
-	}
-	else
-        {
-	  std::cout << "*** DQMStore: WARNING: quality test value '"
-		    << value << "' is incorrectly formatted\n";
-	  return false;
-        }
-
-        MonitorElement *me = findObject(dir, mename);
-        if (! me)
-        {
-	  std::cout << "*** DQMStore: WARNING: no monitor element '"
-		    << mename << "' in directory '"
-		    << dir << "' for quality test '"
-		    << label << "'\n";
-	  return false;
-        }
-
-        me->addQReport(qv, /* FIXME: getQTest(qv.qtname)? */ 0);
-      }
-    }
-    else
-    {
-      std::cout << "*** DQMStore: WARNING: cannot extract object '"
-		<< obj->GetName() << "' of type '"
-		<< obj->IsA()->GetName() << "'\n";
+    if (! extractValue(dir, ts, overwrite))
       return false;
-    }
   }
   else if (TNamed *n = dynamic_cast<TNamed *>(obj))
   {
@@ -2049,71 +2240,202 @@ DQMStore::extract(TObject *obj, const std::string &dir, bool overwrite)
   }
 
   // If we just read in a reference monitor element, and there is a
-  // monitor element with the same name, link the two together. The
-  // other direction is handled by the initialise() method.
+  // monitor element with the same name, link the two together again
+  // so the quality tests see the new reference contents.
   if (refcheck && isSubdirectory(s_referenceDirName, dir))
+    if (MonitorElement *master = findMaster(dir, obj->GetName()))
+      master->linkReference(refcheck);
+
+  return true;
+}
+
+/// restore the value of the tagged string <ts> for its monitor element
+/// in directory <dir>, as read from a file or a metadata table; kinds
+/// are "i", "f" and "s" for scalars, "e" for the efficiency flag, "t"
+/// for tags and "qr" for quality reports.  The value is parsed in place,
+/// strings are made only of the parts which are kept.
+bool
+DQMStore::extractValue(const std::string &dir,
+		       const DQMTagString &ts,
+		       bool overwrite)
+{
+  std::string label(ts.label, ts.labelLen);
+  if (ts.isKind("i"))
+  {
+    // The value is followed by the closing label or the end of string,
+    // either stops the conversion.
+    MonitorElement *me = findObject(dir, label);
+    if (! me || overwrite)
+    {
+      if (! me) me = bookInt(dir, label);
+      me->Fill(strtoll(ts.value, 0, 10));
+    }
+  }
+  else if (ts.isKind("f"))
+  {
+    MonitorElement *me = findObject(dir, label);
+    if (! me || overwrite)
+    {
+      if (! me) me = bookFloat(dir, label);
+      me->Fill(strtod(ts.value, 0));
+    }
+  }
+  else if (ts.isKind("s"))
+  {
+    MonitorElement *me = findObject(dir, label);
+    if (! me)
+      me = bookString(dir, label, std::string(ts.value, ts.valueLen));
+    else if (overwrite)
+    {
+      std::string s(ts.value, ts.valueLen);
+      me->Fill(s);
+    }
+  }
+  else if (ts.isKind("e"))
+  {
+    MonitorElement *me = findObject(dir, label);
+    if (! me)
+    {
+      std::cout << "*** DQMStore: WARNING: no monitor element '"
+		<< label << "' in directory '"
+		<< dir << "' to be marked as efficiency plot.\n";
+      return false;
+    }
+    me->setEfficiencyFlag();
+  }
+  else if (ts.isKind("t"))
+  {
+    MonitorElement *me = findObject(dir, label);
+    if (! me)
+    {
+      std::cout << "*** DQMStore: WARNING: no monitor element '"
+		<< label << "' in directory '"
+		<< dir << "' for a tag\n";
+      return false;
+    }
+    errno = 0;
+    char *endp = 0;
+    unsigned long val = strtoul(ts.value, &endp, 10);
+    if ((val == 0 && errno) || endp != ts.value + ts.valueLen || val > ~uint32_t(0))
+    {
+      std::cout << "*** DQMStore: WARNING: cannot restore tag '"
+		<< std::string(ts.value, ts.valueLen)
+		<< "' for monitor element '"
+		<< label << "' in directory '"
+		<< dir << "' - invalid value\n";
+      return false;
+    }
+    tag(me, val);
+  }
+  else if (ts.isKind("qr"))
   {
-    std::string mdir(dir, s_referenceDirName.size()+1, std::string::npos);
-    if (MonitorElement *master = findObject(mdir, obj->GetName()))
+    // Handle qreports, but skip them while reading in references.
+    if (! isSubdirectory(s_referenceDirName, dir))
     {
-      master->data_.flags |= DQMNet::DQM_PROP_HAS_REFERENCE;
-      master->reference_ = refcheck->object_;
+      size_t dot = label.find('.');
+      if (dot == std::string::npos)
+      {
+	std::cout << "*** DQMStore: WARNING: quality report label in '" << label
+		  << "' is missing a '.' and cannot be extracted\n";
+	return false;
+      }
+
+      std::string mename (label, 0, dot);
+
+      DQMQualityString qs;
+      if (! qs.parse(ts.value, ts.valueLen))
+      {
+	std::cout << "*** DQMStore: WARNING: quality test value '"
+		  << std::string(ts.value, ts.valueLen)
+		  << "' is incorrectly formatted\n";
+	return false;
+      }
+
+      MonitorElement *me = findObject(dir, mename);
+      if (! me)
+      {
+	std::cout << "*** DQMStore: WARNING: no monitor element '"
+		  << mename << "' in directory '"
+		  << dir << "' for quality test '"
+		  << label << "'\n";
+	return false;
+      }
+
+      DQMNet::QValue qv;
+      qv.code = qs.code;
+      qv.qtresult = qs.qtresult; // zero in old format
+      qv.message.assign(qs.message, qs.messageLen);
+      qv.qtname.assign(label, dot+1, std::string::npos);
+      if (qs.algorithm) // unavailable in old format
+	qv.algorithm.assign(qs.algorithm, qs.algorithmLen);
+
+      me->addQReport(qv, /* FIXME: getQTest(qv.qtname)? */ 0);
     }
   }
+  else
+  {
+    std::cout << "*** DQMStore: WARNING: cannot extract value '"
+	      << label << "' of kind '" << std::string(ts.kind, ts.kindLen)
+	      << "'\n";
+    return false;
+  }
 
   return true;
 }
 
 /// Use this for saving monitoring objects in ROOT files with dir structure;
-/// cd into directory (create first if it doesn't exist);
-/// returns success flag
-bool
-DQMStore::cdInto(const std::string &path) const
+/// return the directory <path> under <top>, creating it if it doesn't exist.
+/// Directories already resolved are looked up in <cache>, so each is
+/// walked and created only once per file.  Works on the directory
+/// handles only, gDirectory is not touched.
+TDirectory *
+DQMStore::cdInto(TDirectory *top, const std::string &path, DirCache &cache)
 {
   assert(! path.empty());
 
-  // Find the first path component.
-  size_t start = 0;
-  size_t end = path.find('/', start);
+  // Ignore any trailing '/'.
+  size_t end = path.find_last_not_of('/');
   if (end == std::string::npos)
-    end = path.size();
+    return top;
+  if (end+1 < path.size())
+    return cdInto(top, path.substr(0, end+1), cache);
 
-  while (true)
-  {
-    // Check if this subdirectory component exists.  If yes, make sure
-    // it is actually a subdirectory.  Otherwise create or cd into it.
-    std::string part(path, start, end-start);
-    TObject *o = gDirectory->Get(part.c_str());
-    if (o && ! dynamic_cast<TDirectory *>(o))
-      raiseDQMError("DQMStore", "Attempt to create directory '%s' in a file"
-		    " fails because the part '%s' already exists and is not"
-		    " directory", path.c_str(), part.c_str());
-    else if (! o)
-      gDirectory->mkdir(part.c_str());
-
-    if (! gDirectory->cd(part.c_str()))
-      raiseDQMError("DQMStore", "Attempt to create directory '%s' in a file"
-		    " fails because could not cd into subdirectory '%s'",
-		    path.c_str(), part.c_str());
-
-    // Stop if we reached the end, ignoring any trailing '/'.
-    if (end+1 >= path.size())
-      break;
+  DirCache::iterator pos = cache.find(path);
+  if (pos != cache.end())
+    return pos->second;
 
-    // Find the next path component.
-    start = end+1;
-    end = path.find('/', start);
-    if (end == std::string::npos)
-      end = path.size();
-  }
+  // Resolve the parent, then this component.
+  size_t slash = path.rfind('/');
+  TDirectory *dir = top;
+  if (slash != std::string::npos)
+    dir = cdInto(top, path.substr(0, slash), cache);
 
-  return true;
+  // Check if this subdirectory component exists.  If yes, make sure
+  // it is actually a subdirectory.  Otherwise create or cd into it.
+  std::string part(path, slash == std::string::npos ? 0 : slash+1);
+  TObject *o = dir->Get(part.c_str());
+  if (o && ! dynamic_cast<TDirectory *>(o))
+    raiseDQMError("DQMStore", "Attempt to create directory '%s' in a file"
+		  " fails because the part '%s' already exists and is not"
+		  " directory", path.c_str(), part.c_str());
+  else if (! o)
+    dir->mkdir(part.c_str());
+
+  if (! (dir = dir->GetDirectory(part.c_str())))
+    raiseDQMError("DQMStore", "Attempt to create directory '%s' in a file"
+		  " fails because could not cd into subdirectory '%s'",
+		  path.c_str(), part.c_str());
+
+  cache[path] = dir;
+  return dir;
 }
 
 /// save directory with monitoring objects into root file <filename>;
 /// include quality test results with status >= minimum_status 
 /// (defined in Core/interface/QTestStatus.h);
-/// if directory="", save full monitoring structure
+/// if directory="", save full monitoring structure;
+/// <compression> is the ROOT compression setting, 100 * algorithm +
+/// level, objects are compressed on "saveThreads" threads
 void
 DQMStore::save(const std::string &filename,
 	       const std::string &path /* = "" */,
@@ -2121,34 +2443,442 @@ DQMStore::save(const std::string &filename,
 	       const std::string &rewrite /* = "" */,
 	       SaveReferenceTag ref /* = SaveWithReference */,
 	       int minStatus /* = dqm::qstatus::STATUS_OK */,
-	       const std::string &fileupdate /* = RECREATE */)
+	       const std::string &fileupdate /* = RECREATE */,
+	       int compression /* = 1 */)
 {
-  std::set<std::string>::iterator di, de;
-  MEMap::iterator mi, me = data_.end();
-  DQMNet::QReports::const_iterator qi, qe;
-  int nme=0;
+  SaveJob job;
+  job.filename = filename;
+  job.fileupdate = fileupdate;
+  job.path = path;
+  job.verbose = verbose_;
+  job.compression = compression;
+  job.threads = saveThreads_;
+  collectSave(job, path, pattern, rewrite, ref, minStatus, false, false);
+  writeSave(job);
+  if (path.empty() && pattern.empty())
+  {
+    deltaBase_ = filename;
+    deltaSequence_ = 0;
+    pendingDeltaBase_.clear();
+    deltaKnown_.clear();
+    listPaths(deltaKnown_);
+  }
+}
 
-  // TFile flushes to disk with fsync() on every TDirectory written to the
-  // file.  This makes DQM file saving painfully slow, and ironically makes
-  // it _more_ likely the file saving gets interrupted and corrupts the file.
-  // The utility class below simply ignores the flush synchronisation.
-  class TFileNoSync : public TFile
+/// add the full paths of all monitor elements in the store to <paths>
+void
+DQMStore::listPaths(std::set<std::string> &paths) const
+{
+  MEMap::const_iterator mi = data_.begin();
+  MEMap::const_iterator me = data_.end();
+  for ( ; mi != me; ++mi)
+    paths.insert(paths.end(), mi->getFullname());
+}
+
+/// save into root file <filename> only the monitor elements which
+/// changed since the last save of the whole store, with save() or
+/// saveDelta(); the file also holds a manifest in the "DQMDelta"
+/// directory naming the last full save as the base file, the position
+/// of this delta in the chain, and the paths of the monitor elements
+/// which were in the base or an earlier delta of the chain but are no
+/// longer in the store, so they can be dropped on merging (see
+/// openDelta()).
+void
+DQMStore::saveDelta(const std::string &filename,
+		    SaveReferenceTag ref /* = SaveWithReference */,
+		    int minStatus /* = dqm::qstatus::STATUS_OK */)
+{
+  // A whole store saved with saveAsync() becomes the base once it has
+  // been written; if writing it failed, there is no base to refer to.
+  if (! pendingDeltaBase_.empty())
   {
-  public:
-    TFileNoSync(const char *file, const char *opt) : TFile(file, opt) {}
-    virtual Int_t SysSync(Int_t) { return 0; }
-  };
+    saveWriter_->wait(0);
+    if (saveWriter_->baseFailed())
+      deltaBase_.clear();
+    else
+      deltaBase_ = pendingDeltaBase_;
+    deltaSequence_ = 0;
+    pendingDeltaBase_.clear();
+    deltaKnown_.swap(pendingDeltaKnown_);
+    pendingDeltaKnown_.clear();
+  }
+
+  if (deltaBase_.empty())
+    raiseDQMError("DQMStore", "Cannot save delta file '%s' without a"
+		  " previous save of the whole store", filename.c_str());
+
+  SaveJob job;
+  job.filename = filename;
+  job.fileupdate = "RECREATE";
+  job.verbose = verbose_;
+  job.threads = saveThreads_;
+  collectSave(job, "", "", "", ref, minStatus, false, true);
+
+  std::ostringstream seq;
+  seq << ++deltaSequence_;
+  job.folder(s_deltaDirName);
+  job.add(new TObjString(deltaBase_.c_str()), true, "base");
+  job.add(new TObjString(seq.str().c_str()), true, "sequence");
+
+  // Everything the chain so far may have put into a merged store and
+  // which no longer exists is removed from it.
+  std::string removed;
+  std::set<std::string> live;
+  const char *p = job.live.c_str();
+  while (const char *nl = strchr(p, '\n'))
+  {
+    live.insert(live.end(), std::string(p, nl - p));
+    p = nl+1;
+  }
+  std::set<std::string>::iterator ki, ke;
+  for (ki = deltaKnown_.begin(), ke = deltaKnown_.end(); ki != ke; ++ki)
+    if (! live.count(*ki))
+    {
+      removed += *ki;
+      removed += '\n';
+    }
+  job.add(new TObjString(removed.c_str()), true, "removed");
+  writeSave(job);
+  deltaKnown_.insert(live.begin(), live.end());
+}
+
+/// save the monitor elements under <path> into the native snapshot
+/// file <filename> (see DQMSnapshot), selecting references and quality
+/// reports as save() does.  Snapshots are read back with open() and
+/// load(), which recognise the format automatically.
+void
+DQMStore::saveSnapshot(const std::string &filename,
+		       const std::string &path /* = "" */,
+		       SaveReferenceTag ref /* = SaveWithReference */,
+		       int minStatus /* = dqm::qstatus::STATUS_OK */)
+{
+  SaveJob job;
+  job.filename = filename;
+  job.path = path;
+  collectSnapshot(job, path, ref, minStatus, false);
+  writeSave(job);
 
-  // open output file, on 1st save recreate, later update
   if (verbose_)
-    std::cout << "\n DQMStore: Opening TFile '" << filename 
-              << "' with option '" << fileupdate <<"'\n";
+    std::cout << "DQMStore::saveSnapshot: successfully wrote " << job.nme
+	      << " objects from path '" << path
+	      << "' into snapshot file '" << filename << "'\n";
+}
+
+/// save the complete state of the store into the checkpoint file
+/// <filename>, to resume from with restore() after a restart.  Besides
+/// what saveSnapshot() saves, a checkpoint holds the soft reset
+/// baselines, the accumulate, reset and lumi flags, which quality
+/// tests are attached to which monitor elements, and the quality test
+/// specifications given to useQTest() and useQTestByMatch().  A non-zero
+/// <run> is recorded so restore() can refuse the checkpoint in another
+/// run.  The file is written under a temporary name and renamed into
+/// place.
+void
+DQMStore::checkpoint(const std::string &filename,
+		     unsigned int run /* = 0 */)
+{
+  SaveJob job;
+  job.filename = filename;
+  collectSnapshot(job, "", SaveWithReference, dqm::qstatus::STATUS_OK, true, run);
+  writeSave(job);
 
-  TFileNoSync f(filename.c_str(), fileupdate.c_str()); // open file
-  if(f.IsZombie())
-    raiseDQMError("DQMStore", "Failed to create/update file '%s'", filename.c_str());
-  f.cd();
-  
+  if (verbose_)
+    std::cout << "DQMStore::checkpoint: successfully wrote " << job.nme
+	      << " objects into checkpoint file '" << filename << "'\n";
+}
+
+/// same as checkpoint(), but write the file on the background thread
+/// used by saveAsync().  The state is serialised before returning, so
+/// the store may be changed right away.  Returns the number of the
+/// save to pass to waitForSave().
+uint64_t
+DQMStore::checkpointAsync(const std::string &filename,
+			  unsigned int run /* = 0 */)
+{
+  SaveJob *job = new SaveJob;
+  job->filename = filename;
+  job->verbose = verbose_;
+  try
+  {
+    collectSnapshot(*job, "", SaveWithReference, dqm::qstatus::STATUS_OK, true, run);
+  }
+  catch (...)
+  {
+    delete job;
+    throw;
+  }
+
+  if (! saveWriter_)
+  {
+    TThread::Initialize();
+    saveWriter_ = new SaveWriter;
+  }
+
+  return saveWriter_->submit(job, maxPendingSaves_);
+}
+
+/// serialise the monitor elements under <path> into the native snapshot
+/// of <job>, selecting references with <ref> and <minStatus> as save()
+/// does; with <checkpoint> also add the state restore() reads back,
+/// including the number of the <run> if it is non-zero
+void
+DQMStore::collectSnapshot(SaveJob &job,
+			  const std::string &path,
+			  SaveReferenceTag ref,
+			  int minStatus,
+			  bool checkpoint,
+			  unsigned int run /* = 0 */)
+{
+  std::string refpath;
+  refpath.reserve(s_referenceDirName.size() + path.size() + 2);
+  refpath += s_referenceDirName;
+  if (! path.empty())
+  {
+    refpath += '/';
+    refpath += path;
+  }
+
+  job.snapshot.reset(new DQMSnapshot::Writer);
+  DQMSnapshot::Writer &w = *job.snapshot;
+  std::vector<const MonitorElement *> baselines;
+  MEMap::iterator mi = data_.begin();
+  MEMap::iterator me = data_.end();
+  DQMNet::QReports::const_iterator qi, qe;
+  for ( ; mi != me; ++mi)
+  {
+    const std::string &dir = *mi->data_.dirname;
+    if (! path.empty()
+	&& ! isSubdirectory(path, dir)
+	&& ! isSubdirectory(refpath, dir))
+      continue;
+
+    if (! isSaveSelected(*mi, refpath, ref, minStatus))
+      continue;
+
+    if (verbose_ > 1)
+      std::cout << "DQMStore::saveSnapshot: saving monitor element '"
+		<< mi->data_.objname << "'\n";
+
+    w.begin(mi->getFullname(), mi->data_.flags, mi->data_.tag);
+    switch (mi->kind())
+    {
+    case MonitorElement::DQM_KIND_INT:
+    case MonitorElement::DQM_KIND_REAL:
+    case MonitorElement::DQM_KIND_STRING:
+      w.section(DQMSnapshot::SEC_SCALAR, mi->tagString());
+      break;
+
+    default:
+      mi->loadObject();
+      w.object(mi->object_);
+      break;
+    }
+
+    if (! isSubdirectory(s_referenceDirName, dir))
+    {
+      qi = mi->data_.qreports.begin();
+      qe = mi->data_.qreports.end();
+      for ( ; qi != qe; ++qi)
+	w.section(DQMSnapshot::SEC_QREPORT, mi->qualityTagString(*qi));
+    }
+
+    if (mi->data_.flags & DQMNet::DQM_PROP_EFFICIENCY_PLOT)
+      w.section(DQMSnapshot::SEC_EFFLABEL, mi->effLabelString());
+
+    if (mi->data_.flags & DQMNet::DQM_PROP_TAGGED)
+      w.section(DQMSnapshot::SEC_TAGLABEL, mi->tagLabelString());
+
+    if (checkpoint)
+    {
+      for (size_t i = 0, e = mi->qreports_.size(); i < e; ++i)
+	if (mi->qreports_[i].qcriterion_)
+	  w.section(DQMSnapshot::SEC_QTEST, mi->qreports_[i].qcriterion_->getName());
+
+      if (mi->refvalue_)
+	baselines.push_back(&*mi);
+    }
+
+    ++job.nme;
+  }
+
+  if (! checkpoint)
+    return;
+
+  // Soft reset baselines are records of their own under the checkpoint
+  // directory, which open() and load() never read.
+  std::string basepath;
+  for (size_t i = 0, e = baselines.size(); i < e; ++i)
+  {
+    basepath.clear();
+    basepath += s_checkpointDirName;
+    basepath += "/SoftReset/";
+    basepath += baselines[i]->getFullname();
+    w.begin(basepath, baselines[i]->data_.flags & DQMNet::DQM_PROP_TYPE_MASK, 0);
+    w.object(baselines[i]->refvalue_);
+  }
+
+  std::string spec;
+  w.begin(s_checkpointDirName + "/State", 0, 0);
+  if (run)
+  {
+    char runstr[16];
+    sprintf(runstr, "%u", run);
+    w.section(DQMSnapshot::SEC_RUN, runstr);
+  }
+  for (QTestSpecs::iterator i = qtestspecs_.begin(), e = qtestspecs_.end(); i != e; ++i)
+  {
+    spec.clear();
+    spec += i->second->getName();
+    spec += '\0';
+    spec += i->first->pattern();
+    w.section(DQMSnapshot::SEC_QTESTSPEC, spec);
+  }
+}
+
+/// same as save(), but return as soon as a private copy of the selected
+/// monitor elements has been taken; the file is written on a background
+/// thread.  Returns the number of the save, waitForSave() waits until
+/// it has been written and raises any error from writing it.  At most
+/// "maxPendingSaves" saves are queued, further calls wait for a slot.
+/// A save of the whole store becomes the base of later saveDelta()
+/// calls once it has been written successfully.
+uint64_t
+DQMStore::saveAsync(const std::string &filename,
+		    const std::string &path /* = "" */,
+		    const std::string &pattern /* = "" */,
+		    const std::string &rewrite /* = "" */,
+		    SaveReferenceTag ref /* = SaveWithReference */,
+		    int minStatus /* = dqm::qstatus::STATUS_OK */,
+		    const std::string &fileupdate /* = RECREATE */,
+		    int compression /* = 1 */)
+{
+  SaveJob *job = new SaveJob;
+  job->filename = filename;
+  job->fileupdate = fileupdate;
+  job->path = path;
+  job->verbose = verbose_;
+  job->compression = compression;
+  job->threads = saveThreads_;
+  try
+  {
+    collectSave(*job, path, pattern, rewrite, ref, minStatus, true, false);
+  }
+  catch (...)
+  {
+    delete job;
+    throw;
+  }
+
+  if (path.empty() && pattern.empty())
+  {
+    job->base = true;
+    pendingDeltaBase_ = filename;
+    pendingDeltaKnown_.clear();
+    listPaths(pendingDeltaKnown_);
+  }
+
+  if (! saveWriter_)
+  {
+    TThread::Initialize();
+    saveWriter_ = new SaveWriter;
+  }
+
+  return saveWriter_->submit(job, maxPendingSaves_);
+}
+
+/// wait until the save number <save> returned by saveAsync() or
+/// checkpointAsync() has been written; raise an error if writing it
+/// failed.  The error of a save is reported only once.
+void
+DQMStore::waitForSave(uint64_t save)
+{
+  if (! saveWriter_ || ! save)
+    return;
+
+  std::string error = saveWriter_->wait(save);
+  if (! error.empty())
+    raiseDQMError("DQMStore", "Failed to write save %" PRIu64 ": %s",
+		  save, error.c_str());
+}
+
+/// wait until all saves started with saveAsync() have been written
+void
+DQMStore::waitForSaves(void)
+{
+  if (saveWriter_)
+    saveWriter_->wait(0);
+}
+
+/// check whether monitor element <me> is selected for saving with the
+/// reference option <ref>; <refpath> is the reference directory of the
+/// saved sub-tree.  References are selected in three distinct cases:
+/// 1) Skip all references entirely on saving.
+/// 2) Blanket saving of all references.
+/// 3) Save only references for monitor elements with qtests, with an
+///    optional cut on the minimum quality test result.
+/// The latter two are affected by "path" sub-tree selection, i.e.
+/// references are saved only in the selected tree part.
+bool
+DQMStore::isSaveSelected(const MonitorElement &me,
+			 const std::string &refpath,
+			 SaveReferenceTag ref,
+			 int minStatus) const
+{
+  if (! isSubdirectory(refpath, *me.data_.dirname))
+    return true;
+
+  if (ref == SaveWithoutReference)
+    // Skip the reference entirely.
+    return false;
+  else if (ref == SaveWithReference)
+    // Save all references regardless of qtests.
+    return true;
+  else if (ref == SaveWithReferenceForQTest)
+  {
+    // Save only references for monitor elements with qtests
+    // with an optional cut on minimum quality test result.
+    int status = -1;
+    for (size_t m = 0, n = me.masters_.size(); m != n; ++m)
+    {
+      const MonitorElement *master = me.masters_[m];
+      for (size_t i = 0, e = master->data_.qreports.size(); i != e; ++i)
+	status = std::max(status, master->data_.qreports[i].code);
+    }
+
+    if (me.masters_.empty() || status < minStatus)
+    {
+      if (verbose_ > 1)
+	std::cout << "DQMStore::save: skipping monitor element '"
+		  << me.data_.objname << "' while saving, status is "
+		  << status << ", required minimum status is "
+		  << minStatus << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// select the monitor elements to save into <job>; with <snapshot>
+/// the objects are copied so the job no longer refers to the store;
+/// with <changedOnly> only monitor elements modified since the last
+/// save of the whole store are written, but all are listed in the
+/// job's live paths
+void
+DQMStore::collectSave(SaveJob &job,
+		      const std::string &path,
+		      const std::string &pattern,
+		      const std::string &rewrite,
+		      SaveReferenceTag ref,
+		      int minStatus,
+		      bool snapshot,
+		      bool changedOnly)
+{
+  bool whole = path.empty() && pattern.empty();
+
+  std::set<std::string>::iterator di, de;
+  MEMap::iterator mi, me = data_.end();
+  DQMNet::QReports::const_iterator qi, qe;
   // Construct a regular expression from the pattern string.
   std::auto_ptr<lat::Regexp> rxpat;
   if (! pattern.empty())
@@ -2177,136 +2907,426 @@ DQMStore::save(const std::string &filename,
     // Loop over monitor elements in this directory.
     MonitorElement proto(&*di, std::string());
     mi = data_.lower_bound(proto);
+    bool started = false;
+    std::string metadata;
     for ( ; mi != me && isSubdirectory(*di, *mi->data_.dirname); ++mi)
     {
       // Skip if it isn't a direct child.
       if (*di != *mi->data_.dirname)
 	continue;
 
-      // Handle reference histograms, with three distinct cases:
-      // 1) Skip all references entirely on saving.
-      // 2) Blanket saving of all references.
-      // 3) Save only references for monitor elements with qtests.
-      // The latter two are affected by "path" sub-tree selection,
-      // i.e. references are saved only in the selected tree part.
-      if (isSubdirectory(refpath, *mi->data_.dirname))
+      // List everything considered for delta saves.
+      if (changedOnly)
       {
-	if (ref == SaveWithoutReference)
-	  // Skip the reference entirely.
-	  continue;
-        else if (ref == SaveWithReference)
-	  // Save all references regardless of qtests.
-	  ;
-	else if (ref == SaveWithReferenceForQTest)
-        {
-	  // Save only references for monitor elements with qtests
-	  // with an optional cut on minimum quality test result.
-	  int status = -1;
-	  std::string mname(mi->getFullname(), s_referenceDirName.size()+1, std::string::npos);
-	  MonitorElement *master = get(mname);
-	  if (master)
-	    for (size_t i = 0, e = master->data_.qreports.size(); i != e; ++i)
-	      status = std::max(status, master->data_.qreports[i].code);
-
-	  if (! master || status < minStatus)
-	  {
-	    if (verbose_ > 1)
-	      std::cout << "DQMStore::save: skipping monitor element '"
-		        << mi->data_.objname << "' while saving, status is "
-			<< status << ", required minimum status is "
-			<< minStatus << std::endl;
-	    continue;
-	  }
-        }
+	job.live += mi->getFullname();
+	job.live += '\n';
       }
 
+      // Handle reference histograms.
+      if (! isSaveSelected(*mi, refpath, ref, minStatus))
+	continue;
+
+      // Record the monitor element for delta saves, and skip it if
+      // only changes are saved and it has not changed.
+      MonitorElement &saved = const_cast<MonitorElement &>(*mi);
+      bool changed = (saved.savedVersion_ != saved.version_);
+      if (whole)
+	saved.savedVersion_ = saved.version_;
+
+      if (changedOnly && ! changed)
+	continue;
+
       if (verbose_ > 1)
 	std::cout << "DQMStore::save: saving monitor element '"
 		  << mi->data_.objname << "'\n";
-      nme++; // count saved histograms
-
-      // Create the directory.
-      gDirectory->cd("/");
-      if (di->empty())
-	cdInto(s_monitorDirName);
-      else if (rxpat.get())
-	cdInto(s_monitorDirName + '/' + lat::StringOps::replace(*di, *rxpat, rewrite));
-      else
-	cdInto(s_monitorDirName + '/' + *di);
+      job.nme++; // count saved histograms
+
+      // Determine the target directory once for the whole folder.
+      if (! started)
+      {
+	if (di->empty())
+	  job.folder(s_monitorDirName);
+	else if (rxpat.get())
+	  job.folder(s_monitorDirName + '/' + lat::StringOps::replace(*di, *rxpat, rewrite));
+	else
+	  job.folder(s_monitorDirName + '/' + *di);
+	started = true;
+      }
+
+      // Save the object, and with a metadata table, everything else
+      // about it in the table.
+      if (metadataTable_)
+	packMetadata(metadata, *mi, ! isSubdirectory(s_referenceDirName, *mi->data_.dirname));
 
-      // Save the object.
       switch (mi->kind())
       {
       case MonitorElement::DQM_KIND_INT:
       case MonitorElement::DQM_KIND_REAL:
       case MonitorElement::DQM_KIND_STRING:
-	TObjString(mi->tagString().c_str()).Write();
+	if (! metadataTable_)
+	  job.add(new TObjString(mi->tagString().c_str()), true);
 	break;
 
       default:
-        mi->object_->Write();
+	mi->loadObject();
+	if (snapshot)
+	{
+	  DQMRootLock gate;
+	  TH1 *copy = static_cast<TH1 *>(mi->object_->Clone());
+	  copy->SetDirectory(0);
+	  job.add(copy, true);
+	}
+	else
+	  job.add(mi->object_, false);
 	break;
       }
 
+      if (metadataTable_)
+	continue;
+
       // Save quality reports if this is not in reference section.
       if (! isSubdirectory(s_referenceDirName, *mi->data_.dirname))
       {
 	qi = mi->data_.qreports.begin();
 	qe = mi->data_.qreports.end();
 	for ( ; qi != qe; ++qi)
-	  TObjString(mi->qualityTagString(*qi).c_str()).Write();
+	  job.add(new TObjString(mi->qualityTagString(*qi).c_str()), true);
       }
 
       // Save efficiency tag, if any
       if (mi->data_.flags & DQMNet::DQM_PROP_EFFICIENCY_PLOT)
-	TObjString(mi->effLabelString().c_str()).Write();
+	job.add(new TObjString(mi->effLabelString().c_str()), true);
 
       // Save tag if any
       if (mi->data_.flags & DQMNet::DQM_PROP_TAGGED)
-	TObjString(mi->tagLabelString().c_str()).Write();
+	job.add(new TObjString(mi->tagLabelString().c_str()), true);
     }
+
+    if (! metadata.empty())
+      job.add(new TObjString((s_metadataHeader + metadata).c_str()), true,
+	      s_metadataName.c_str());
   }
+}
 
-  f.Close();
+/// append the scalar value, flags, tag and, if <qreports>, quality
+/// reports of monitor element <me> to the metadata table <into>; each
+/// monitor element is a sequence of length-prefixed fields: name,
+/// kind ("i", "f", "s" or "h" for histograms), flags ("e" efficiency
+/// plot, "t" tagged), tag, value, number of quality reports and for
+/// each report its name, status, result, algorithm and message
+void
+DQMStore::packMetadata(std::string &into, const MonitorElement &me, bool qreports)
+{
+  std::string value;
+  std::string flags;
+  const char *kind = "h";
+  switch (me.kind())
+  {
+  case MonitorElement::DQM_KIND_INT:    kind = "i"; me.packScalarData(value, ""); break;
+  case MonitorElement::DQM_KIND_REAL:   kind = "f"; me.packScalarData(value, ""); break;
+  case MonitorElement::DQM_KIND_STRING: kind = "s"; me.packScalarData(value, ""); break;
+  default: break;
+  }
 
-  // Maybe make some noise.
-  if (verbose_)
-    std::cout << "DQMStore::save: successfully wrote " << nme 
-              << " objects from path '" << path  
-	      << "' into DQM file '" << filename << "'\n";
+  if (me.data_.flags & DQMNet::DQM_PROP_EFFICIENCY_PLOT)
+    flags += 'e';
+  if (me.data_.flags & DQMNet::DQM_PROP_TAGGED)
+    flags += 't';
+
+  char buf[64];
+  sprintf(buf, "%" PRIu32, me.data_.tag);
+  packField(into, me.data_.objname);
+  packField(into, kind);
+  packField(into, flags);
+  packField(into, buf);
+  packField(into, value);
+
+  size_t nqr = qreports ? me.data_.qreports.size() : 0;
+  sprintf(buf, "%lu", (unsigned long) nqr);
+  packField(into, buf);
+  for (size_t i = 0; i < nqr; ++i)
+  {
+    const DQMNet::QValue &qv = me.data_.qreports[i];
+    packField(into, qv.qtname);
+    sprintf(buf, "%d", qv.code);
+    packField(into, buf);
+    sprintf(buf, "%.*g", DBL_DIG+2, qv.qtresult);
+    packField(into, buf);
+    packField(into, qv.algorithm);
+    packField(into, qv.message);
+  }
 }
 
-/// read ROOT objects from file <file> in directory <onlypath>;
-/// return total # of ROOT objects read
-unsigned int
-DQMStore::readDirectory(TFile *file,
-			bool overwrite,
-			const std::string &onlypath,
-			const std::string &prepend,
-			const std::string &curdir,
-			OpenRunDirs stripdirs)
+/// TKey for an object streamed and compressed outside the key, see
+/// writeSave().  The key header and payload are the same TKey itself
+/// would write.
+class DQMStoreKey : public TKey
 {
-  unsigned int ntot = 0;
-  unsigned int count = 0;
+public:
+  DQMStoreKey(const TObject *obj, const char *name, TDirectory *dir)
+    : TKey(dir)
+    {
+      SetName(name);
+      SetTitle(obj->GetTitle());
+      Build(dir, obj->ClassName(), -1);
+      fDatime.Set();
+      fKeylen = Sizeof();
+    }
 
-  if (! file->cd(curdir.c_str()))
-    raiseDQMError("DQMStore", "Failed to process directory '%s' while"
-		  " reading file '%s'", curdir.c_str(), file->GetName());
+  /// append the key to its directory, allocate it in the file and write
+  /// @a nbytes of @a data holding an object streamed into @a objlen bytes
+  Int_t write(const char *data, Int_t nbytes, Int_t objlen)
+    {
+      fObjlen = objlen;
+      fCycle = fMotherDir->AppendKey(this);
+      // Create() allocates the buffer, with room for the header of a
+      // free gap the key may be placed in; fill it rather than replace.
+      Create(nbytes);
+      char *header = fBuffer;
+      FillBuffer(header);
+      memcpy(fBuffer + fKeylen, data, nbytes);
+      return WriteFile(0);
+    }
+};
 
-  // Figure out current directory name, but strip out the top
-  // directory into which we dump everything.
-  std::string dirpart = curdir;
-  if (dirpart.compare(0, s_monitorDirName.size(), s_monitorDirName) == 0)
+/// An object of a save job on its way into the file.
+struct DQMStoreRecord
+{
+  TObject			*obj;	 //< Object to write.
+  const char			*name;	 //< Key name, null for the object name.
+  TDirectory			*dir;	 //< Target directory.
+  std::unique_ptr<DQMStoreKey>	key;	 //< Key, owned until written.
+  std::unique_ptr<TBufferFile>	buffer;	 //< Key header space and the streamed object.
+  std::vector<char>		zipped;	 //< Compressed object, empty if stored as is.
+};
+
+// Maximum compression block size, as in TKey.
+static const int s_maxZipBuffer = 0xffffff;
+
+// Streamed bytes collected before compressing and writing a batch.
+static const size_t s_saveBatchBytes = 64*1024*1024;
+
+/// stream the object of @a r into a buffer laid out as TKey does it,
+/// with space for the key header in front
+static void
+streamRecord(DQMStoreRecord &r, TFile *file)
+{
+  r.key.reset(new DQMStoreKey(r.obj, r.name ? r.name : r.obj->GetName(), r.dir));
+  Int_t keylen = r.key->GetKeylen();
+  r.buffer.reset(new TBufferFile(TBuffer::kWrite, TBuffer::kInitialSize + keylen));
+  r.buffer->SetParent(file);
+  r.buffer->SetBufferOffset(keylen);
+  r.buffer->MapObject(r.obj);
+  r.obj->Streamer(*r.buffer);
+}
+
+/// compress the streamed object of @a r in the same blocks as TKey;
+/// objects which do not compress are left as they are
+static void
+compressRecord(DQMStoreRecord &r, int level, int algorithm)
+{
+  Int_t keylen = r.key->GetKeylen();
+  Int_t objlen = r.buffer->Length() - keylen;
+  if (level <= 0 || objlen <= 256)
+    return;
+
+  char *src = r.buffer->Buffer() + keylen;
+  int nbuffers = 1 + (objlen - 1) / s_maxZipBuffer;
+  r.zipped.resize(std::max(512, objlen + 9*nbuffers + 28));
+  int total = 0;
+  for (int i = 0, done = 0; i < nbuffers; ++i, done += s_maxZipBuffer)
   {
-    if (dirpart.size() == s_monitorDirName.size())
-      dirpart.clear();
-    else if (dirpart[s_monitorDirName.size()] == '/')
-      dirpart.erase(0, s_monitorDirName.size()+1);
+    int bufmax = (i == nbuffers-1 ? objlen - done : s_maxZipBuffer);
+    int nout = 0;
+    R__zipMultipleAlgorithm(level, &bufmax, src + done, &bufmax,
+			    &r.zipped[total], &nout, algorithm);
+    if (nout == 0 || nout >= objlen)
+    {
+      r.zipped.clear();
+      return;
+    }
+    total += nout;
   }
+  r.zipped.resize(total);
+}
 
-  // See if we are going to skip this directory.
-  bool skip = (! onlypath.empty() && ! isSubdirectory(onlypath, dirpart));
-  
+/// compression worker, takes records from @a batch until none is left
+static void
+compressRecords(std::vector<DQMStoreRecord> *batch, std::atomic<size_t> *next,
+		int level, int algorithm)
+{
+  for (size_t i; (i = (*next)++) < batch->size(); )
+    compressRecord((*batch)[i], level, algorithm);
+}
+
+/// compress @a batch on @a nthreads threads and write it into @a file
+/// in order
+static void
+flushRecords(TFile &file, std::vector<DQMStoreRecord> &batch, int compression,
+	     unsigned nthreads)
+{
+  int level = compression % 100;
+  int algorithm = compression / 100;
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < nthreads && t < batch.size(); ++t)
+  {
+    try
+    {
+      workers.push_back(std::thread(compressRecords, &batch, &next, level, algorithm));
+    }
+    catch (std::system_error &)
+    {
+      break;
+    }
+  }
+  compressRecords(&batch, &next, level, algorithm);
+  for (size_t t = 0, e = workers.size(); t < e; ++t)
+    workers[t].join();
+
+  DQMRootLock gate;
+  for (size_t i = 0, e = batch.size(); i < e; ++i)
+  {
+    DQMStoreRecord &r = batch[i];
+    Int_t keylen = r.key->GetKeylen();
+    Int_t objlen = r.buffer->Length() - keylen;
+
+    // The key header was sized for a small file, let TKey redo it if
+    // the file has grown too large for it in the meantime.
+    if (file.GetEND() > TFile::kStartBigFile && r.key->GetVersion() < 1000)
+    {
+      r.dir->WriteTObject(r.obj, r.name);
+      continue;
+    }
+
+    file.SumBuffer(objlen);
+    DQMStoreKey *key = r.key.release();
+    if (r.zipped.empty())
+      key->write(r.buffer->Buffer() + keylen, objlen, objlen);
+    else
+      key->write(&r.zipped[0], r.zipped.size(), objlen);
+  }
+
+  batch.clear();
+}
+
+/// write the objects selected by collectSave() into the job's file;
+/// objects are streamed on the calling thread, compressed on the job's
+/// threads a batch at a time and written in order by the calling thread.
+/// The ROOT calls are made under DQMRootLock, which is released while
+/// a batch compresses so other threads may use ROOT meanwhile.
+void
+DQMStore::writeSave(SaveJob &job)
+{
+  // TFile flushes to disk with fsync() on every TDirectory written to the
+  // file.  This makes DQM file saving painfully slow, and ironically makes
+  // it _more_ likely the file saving gets interrupted and corrupts the file.
+  // The utility class below simply ignores the flush synchronisation.
+  class TFileNoSync : public TFile
+  {
+  public:
+    TFileNoSync(const char *file, const char *opt) : TFile(file, opt) {}
+    virtual Int_t SysSync(Int_t) { return 0; }
+  };
+
+  // Native snapshots are written under a temporary name and renamed
+  // into place, so a crash never leaves a partial file behind.  The
+  // name is unique per write, a checkpoint may be written on the main
+  // thread while an asynchronous one to the same file is in progress.
+  if (job.snapshot)
+  {
+    static std::atomic<unsigned> s_tmpSequence(0);
+    char suffix[48];
+    sprintf(suffix, ".%d.%u.tmp", (int) getpid(), s_tmpSequence++);
+    std::string tmp = job.filename + suffix;
+    job.snapshot->write(tmp);
+    if (rename(tmp.c_str(), job.filename.c_str()) != 0)
+    {
+      int err = errno;
+      unlink(tmp.c_str());
+      raiseDQMError("DQMStore", "Failed to rename '%s' to '%s': %s",
+		    tmp.c_str(), job.filename.c_str(), strerror(err));
+    }
+    return;
+  }
+
+  // open output file, on 1st save recreate, later update
+  if (job.verbose)
+    std::cout << "\n DQMStore: Opening TFile '" << job.filename 
+              << "' with option '" << job.fileupdate <<"'\n";
+
+  std::unique_ptr<TFileNoSync> f;
+  std::vector<DQMStoreRecord> batch;
+  try
+  {
+    {
+      DQMRootLock gate;
+      f.reset(new TFileNoSync(job.filename.c_str(), job.fileupdate.c_str())); // open file
+      if (f->IsZombie())
+	raiseDQMError("DQMStore", "Failed to create/update file '%s'", job.filename.c_str());
+      f->SetCompressionSettings(job.compression);
+    }
+
+    // Write folder by folder, resolving each target directory once.
+    DirCache dirs;
+    size_t batchBytes = 0;
+    for (size_t i = 0, e = job.folders.size(); i < e; ++i)
+    {
+      const SaveJob::Folder &folder = job.folders[i];
+      TDirectory *dir;
+      {
+	DQMRootLock gate;
+	dir = cdInto(f.get(), folder.dir, dirs);
+      }
+      for (size_t j = 0, n = folder.objects.size(); j < n; ++j)
+      {
+	batch.push_back(DQMStoreRecord());
+	DQMStoreRecord &r = batch.back();
+	r.obj = folder.objects[j].obj;
+	r.name = folder.objects[j].name;
+	r.dir = dir;
+	{
+	  DQMRootLock gate;
+	  streamRecord(r, f.get());
+	}
+
+	batchBytes += r.buffer->Length();
+	if (batchBytes >= s_saveBatchBytes)
+	{
+	  flushRecords(*f, batch, job.compression, job.threads);
+	  batchBytes = 0;
+	}
+      }
+    }
+    flushRecords(*f, batch, job.compression, job.threads);
+
+    DQMRootLock gate;
+    f->Close();
+    f.reset();
+  }
+  catch (...)
+  {
+    DQMRootLock gate;
+    batch.clear();
+    f.reset();
+    throw;
+  }
+
+  // Maybe make some noise.
+  if (job.verbose)
+    std::cout << "DQMStore::save: successfully wrote " << job.nme 
+              << " objects from path '" << job.path  
+	      << "' into DQM file '" << job.filename << "'\n";
+}
+
+/// map directory <dirpart> read from a file to the directory in the
+/// store, stripping run directories and adding <prepend> as requested;
+/// return false if the directory should not be read at all
+bool
+DQMStore::readDirectoryName(std::string &dirpart,
+			    const std::string &prepend,
+			    OpenRunDirs stripdirs) const
+{
   if (prepend == s_collateDirName || 
       prepend == s_referenceDirName || 
       stripdirs == StripRunDirs )
@@ -2337,7 +3357,7 @@ DQMStore::readDirectory(TFile *file,
     if (slash == std::string::npos   // skip if Reference is toplevel folder, i.e. no slash
 	&& slash+1+s_referenceDirName.size() == dirpart.size()
 	&& dirpart.compare(slash+1, s_referenceDirName.size(), s_referenceDirName) == 0)
-      return 0;
+      return false;
 
     slash = dirpart.find('/');    
     // Skip reading of EventInfo subdirectory.
@@ -2346,7 +3366,7 @@ DQMStore::readDirectory(TFile *file,
 	&& dirpart.compare( slash+1 , 9 , "EventInfo") == 0) {
       if (verbose_)
 	std::cout << "DQMStore::readDirectory: skipping '" << dirpart << "'\n";
-      return 0;
+      return false;
     }
 
     // Add prefix.
@@ -2363,44 +3383,162 @@ DQMStore::readDirectory(TFile *file,
       dirpart = prepend + '/' + dirpart;
   }
 
+  return true;
+}
+
+/** Source of the object of a monitor element booked by openLazy(),
+    read from the key in the file when first needed.  The source keeps
+    the file open until all placeholders of the file are gone.  */
+class DQMStoreLazySource : public MonitorElementSource
+{
+public:
+  DQMStoreLazySource(const std::shared_ptr<TFile> &file, TKey *key)
+    : file_(file),
+      key_(key)
+    {}
+
+  virtual ~DQMStoreLazySource(void)
+    {
+      DQMRootLock gate;
+      file_.reset();
+    }
+
+  virtual TH1 *load(void)
+    {
+      DQMRootLock gate;
+      TObject *obj = key_->ReadObj();
+      TH1 *h = dynamic_cast<TH1 *>(obj);
+      if (! h)
+	delete obj;
+      return h;
+    }
+
+private:
+  std::shared_ptr<TFile> file_;	//< The file, kept open while needed.
+  TKey			*key_;	//< Key of the object in the file.
+};
+
+/// read ROOT objects from file <file> in directory <onlypath>;
+/// if <lazy> holds the file, book new histograms as placeholders
+/// instead of reading them, see openLazy();
+/// return total # of ROOT objects read
+unsigned int
+DQMStore::readDirectory(TFile *file,
+			bool overwrite,
+			const std::string &onlypath,
+			const std::string &prepend,
+			const std::string &curdir,
+			OpenRunDirs stripdirs,
+			const std::shared_ptr<TFile> &lazy
+			/* = std::shared_ptr<TFile>() */)
+{
+  unsigned int ntot = 0;
+  unsigned int count = 0;
+
+  TDirectory *tdir = file->GetDirectory(curdir.c_str());
+  if (! tdir)
+    raiseDQMError("DQMStore", "Failed to process directory '%s' while"
+		  " reading file '%s'", curdir.c_str(), file->GetName());
+
+  // Figure out current directory name, but strip out the top
+  // directory into which we dump everything.
+  std::string dirpart = curdir;
+  stripMonitorDir(dirpart);
+
+  // See if we are going to skip this directory.
+  bool skip = (! onlypath.empty() && ! isSubdirectory(onlypath, dirpart));
+  if (! readDirectoryName(dirpart, prepend, stripdirs))
+    return 0;
+
   // Loop over the contents of this directory in the file.
   // Post-pone string object handling to happen after other
   // objects have been read in so we are guaranteed to have
   // histograms by the time we read in quality tests and tags.
   TKey *key;
-  TIter next (gDirectory->GetListOfKeys());
+  TIter next (tdir->GetListOfKeys());
   std::list<TObject *> delayed;
+  std::list<TObject *> metadata;
   while ((key = (TKey *) next()))
   {
-    std::auto_ptr<TObject> obj(key->ReadObj());
-    if (dynamic_cast<TDirectory *>(obj.get()))
+    // Decide on the key alone, objects are read only if used.
+    TClass *cl = TClass::GetClass(key->GetClassName());
+    if (curdir.empty() && s_deltaDirName == key->GetName())
+      // Skip the manifest of delta files, see openDelta().
+      ;
+    else if (cl && cl->InheritsFrom(TDirectory::Class()))
     {
       std::string subdir;
-      subdir.reserve(curdir.size() + strlen(obj->GetName()) + 2);
+      subdir.reserve(curdir.size() + strlen(key->GetName()) + 2);
       subdir += curdir;
       if (! curdir.empty())
 	subdir += '/';
-      subdir += obj->GetName();
+      subdir += key->GetName();
+
+      // Descend only into the selected part of the tree and the
+      // directories leading to it, and not into directories which
+      // would be skipped anyway.
+      std::string subpart = subdir;
+      stripMonitorDir(subpart);
+      if (! onlypath.empty()
+	  && ! isSubdirectory(onlypath, subpart)
+	  && ! isSubdirectory(subpart, onlypath))
+	continue;
 
-      ntot += readDirectory(file, overwrite, onlypath, prepend, subdir, stripdirs);
+      std::string mapped = subpart;
+      if (! readDirectoryName(mapped, prepend, stripdirs))
+	continue;
+
+      ntot += readDirectory(file, overwrite, onlypath, prepend, subdir, stripdirs, lazy);
     }
     else if (skip)
       ;
-    else if (dynamic_cast<TObjString *>(obj.get()))
-    {
-      delayed.push_back(obj.release());
-    }
-    else
+    else if (! cl
+	     || ! (cl->InheritsFrom(TH1::Class())
+		   || cl->InheritsFrom(TObjString::Class())
+		   || cl == TNamed::Class()))
+      // Only histograms, strings and the plain TNamed values of old
+      // DQM data can be extracted; do not read anything else.
+      std::cout << "*** DQMStore: WARNING: cannot extract object '"
+		<< key->GetName() << "' of type '"
+		<< key->GetClassName() << "'\n";
+    else if (lazy
+	     && MonitorElement::kindFromClass(key->GetClassName()) != MonitorElement::DQM_KIND_INVALID
+	     && ! findObject(dirpart, key->GetName()))
     {
+      // Leave the object in the file, see openLazy().
       if (verbose_ > 2)
-	std::cout << "DQMStore: reading object '" << obj->GetName()
-		  << "' of type '" << obj->IsA()->GetName()
+	std::cout << "DQMStore: deferring object '" << key->GetName()
+		  << "' of type '" << key->GetClassName()
 		  << "' from '" << file->GetName()
 		  << "' into '" << dirpart << "'\n";
 
       makeDirectory(dirpart);
-      if (extract(obj.get(), dirpart, overwrite))
-	++count;
+      bookLazy(dirpart, key->GetName(), MonitorElement::kindFromClass(key->GetClassName()),
+	       new DQMStoreLazySource(lazy, key));
+      ++count;
+    }
+    else
+    {
+      std::auto_ptr<TObject> obj(key->ReadObj());
+      if (! obj.get())
+	continue;
+      else if (s_metadataName == key->GetName()
+	       && dynamic_cast<TObjString *>(obj.get()))
+	metadata.push_back(obj.release());
+      else if (dynamic_cast<TObjString *>(obj.get()))
+	delayed.push_back(obj.release());
+      else
+      {
+	if (verbose_ > 2)
+	  std::cout << "DQMStore: reading object '" << obj->GetName()
+		    << "' of type '" << obj->IsA()->GetName()
+		    << "' from '" << file->GetName()
+		    << "' into '" << dirpart << "'\n";
+
+	makeDirectory(dirpart);
+	if (extract(obj.get(), dirpart, overwrite))
+	  ++count;
+      }
     }
   }
 
@@ -2416,15 +3554,339 @@ DQMStore::readDirectory(TFile *file,
     if (extract(delayed.front(), dirpart, overwrite))
       ++count;
 
-    delete delayed.front();
-    delayed.pop_front();
+    delete delayed.front();
+    delayed.pop_front();
+  }
+
+  while (! metadata.empty())
+  {
+    makeDirectory(dirpart);
+    count += readMetadata(metadata.front()->GetName(), dirpart, overwrite);
+    delete metadata.front();
+    metadata.pop_front();
+  }
+
+  if (verbose_ > 1)
+    std::cout << "DQMStore: read " << count << '/' << ntot
+	      << " objects from directory '" << dirpart << "'\n";
+
+  return ntot + count;
+}
+
+/// read the native snapshot file <filename>, with the same options as
+/// readDirectory(); if <map> is true, new histograms use the bin arrays
+/// in the read-only mapped file directly until first handed out or
+/// modified, see MonitorElementMapping; return the number of monitor
+/// elements read
+unsigned int
+DQMStore::readSnapshot(const std::string &filename,
+		       bool overwrite,
+		       const std::string &onlypath,
+		       const std::string &prepend,
+		       OpenRunDirs stripdirs,
+		       bool map /* = false */)
+{
+  std::shared_ptr<DQMSnapshot::Reader> reader(new DQMSnapshot::Reader(filename));
+  std::shared_ptr<DQMSnapshot::Reader> mapping;
+  const DQMSnapshot::Reader &r = *reader;
+  if (map)
+    mapping = reader;
+  std::vector<DQMSnapshot::Section> sections;
+  std::string dir, name, dirpart, lastdir;
+  bool skipdir = false;
+  unsigned int count = 0;
+
+  for (uint64_t i = 0, e = r.size(); i < e; ++i)
+  {
+    std::string path = r.path(i);
+    size_t slash = path.rfind('/');
+    dir.assign(path, 0, slash == std::string::npos ? 0 : slash);
+    name.assign(path, slash == std::string::npos ? 0 : slash+1, std::string::npos);
+
+    // Map the directory once for consecutive monitor elements, the
+    // index is sorted.  A directory is skipped if any of its parents
+    // would be skipped reading a ROOT file.
+    if (i == 0 || dir != lastdir)
+    {
+      lastdir = dir;
+      skipdir = ((! onlypath.empty() && ! isSubdirectory(onlypath, dir))
+		 || isSubdirectory(s_checkpointDirName, dir));
+      for (size_t pos = 0; ! skipdir; ++pos)
+      {
+	pos = dir.find('/', pos);
+	std::string parent(dir, 0, pos);
+	skipdir = ! readDirectoryName(parent, prepend, stripdirs);
+	if (pos == std::string::npos)
+	{
+	  dirpart = parent;
+	  break;
+	}
+      }
+    }
+
+    if (skipdir)
+      continue;
+
+    if (verbose_ > 2)
+      std::cout << "DQMStore: reading object '" << name
+		<< "' from '" << filename
+		<< "' into '" << dirpart << "'\n";
+
+    makeDirectory(dirpart);
+    r.sections(i, sections);
+    uint32_t flags = r.flags(i);
+    bool ok = false;
+    switch (flags & DQMNet::DQM_PROP_TYPE_MASK)
+    {
+    case MonitorElement::DQM_KIND_INT:
+    case MonitorElement::DQM_KIND_REAL:
+    case MonitorElement::DQM_KIND_STRING:
+      for (size_t s = 0, n = sections.size(); s < n; ++s)
+	if (sections[s].type == DQMSnapshot::SEC_SCALAR)
+	{
+	  TObjString obj(std::string(sections[s].data, sections[s].size).c_str());
+	  ok = extract(&obj, dirpart, overwrite);
+	}
+      break;
+
+    default:
+      {
+	// The mapping guard is destroyed first, detaching the arrays
+	// of a histogram which was not taken over.
+	MonitorElementMapping *mapped = 0;
+	std::auto_ptr<TH1> h(DQMSnapshot::object(name, flags, sections, mapping, &mapped));
+	std::auto_ptr<MonitorElementMapping> mguard(mapped);
+	bool existed = (findObject(dirpart, name) != 0);
+	ok = extract(h.get(), dirpart, overwrite, true);
+	if (ok && ! existed)
+	{
+	  h.release();
+	  findObject(dirpart, name)->mapping_ = mguard.release();
+	}
+      }
+      break;
+    }
+
+    if (! ok)
+      continue;
+
+    ++count;
+    for (size_t s = 0, n = sections.size(); s < n; ++s)
+      if (sections[s].type == DQMSnapshot::SEC_QREPORT
+	  || sections[s].type == DQMSnapshot::SEC_EFFLABEL
+	  || sections[s].type == DQMSnapshot::SEC_TAGLABEL)
+      {
+	TObjString obj(std::string(sections[s].data, sections[s].size).c_str());
+	extract(&obj, dirpart, overwrite);
+      }
+  }
+
+  return count;
+}
+
+/// read the references from <ref> through the snapshot cache <cache>:
+/// if the cache was built from <ref> as it is now, by path, size and
+/// modification time, map it so the reference histograms use the bin
+/// arrays in the file pages, which all processes mapping the same cache
+/// share; otherwise read <ref> as usual and write the cache for the
+/// processes which come after
+void
+DQMStore::readReferenceCache(const std::string &ref, const std::string &cache)
+{
+  struct stat refst;
+  if (stat(ref.c_str(), &refst) != 0)
+    return;
+
+  std::ostringstream source;
+  source << ref << '\n' << (unsigned long long) refst.st_size
+	 << '\n' << (long long) refst.st_mtime;
+
+  if (DQMSnapshot::isSnapshot(cache))
+  {
+    try
+    {
+      if (DQMSnapshot::Reader(cache).source() == source.str())
+      {
+	unsigned n = readSnapshot(cache, true, "", "", KeepRunDirs, true);
+	if (verbose_)
+	  std::cout << "DQMStore: mapped " << n << " reference objects from cache '"
+		    << cache << "'\n";
+	return;
+      }
+
+      if (verbose_)
+	std::cout << "DQMStore: reference cache '" << cache
+		  << "' was not built from '" << ref << "' as it is now\n";
+    }
+    catch (std::exception &e)
+    {
+      std::cout << "*** DQMStore: WARNING: cannot use reference cache '"
+		<< cache << "', reading the reference file instead: "
+		<< e.what() << "\n";
+    }
+  }
+
+  if (! readFile(ref, true, "", s_referenceDirName, StripRunDirs, false))
+    return;
+
+  try
+  {
+    SaveJob job;
+    job.filename = cache;
+    job.path = s_referenceDirName;
+    collectSnapshot(job, s_referenceDirName, SaveWithReference, dqm::qstatus::STATUS_OK, false);
+    job.snapshot->source(source.str());
+    writeSave(job);
+  }
+  catch (std::exception &e)
+  {
+    std::cout << "*** DQMStore: WARNING: cannot write reference cache '"
+	      << cache << "': " << e.what() << "\n";
+  }
+}
+
+/// describe the metadata table value <value> of kind <kind> for
+/// monitor element <label> as a tagged string for extractValue()
+static DQMTagString
+tagValue(const std::string &label, const char *kind, const std::string &value)
+{
+  DQMTagString ts;
+  ts.label = label.data();
+  ts.labelLen = label.size();
+  ts.kind = kind;
+  ts.kindLen = strlen(kind);
+  ts.value = value.c_str();
+  ts.valueLen = value.size();
+  return ts;
+}
+
+/// restore the monitor element metadata in table <table> written by
+/// packMetadata() into directory <dir>; return the number of scalar
+/// monitor elements read
+unsigned int
+DQMStore::readMetadata(const char *table, const std::string &dir, bool overwrite)
+{
+  if (strncmp(table, s_metadataHeader.c_str(), s_metadataHeader.size()) != 0)
+  {
+    std::cout << "*** DQMStore: WARNING: unknown metadata table format in"
+	      << " directory '" << dir << "'\n";
+    return 0;
+  }
+
+  unsigned int count = 0;
+  const char *p = table + s_metadataHeader.size();
+  const char *end = p + strlen(p);
+  std::string name, kind, flags, tagval, value, nqr;
+  std::string qtname, code, result;
+  while (p < end)
+  {
+    if (! unpackField(p, end, name)
+	|| ! unpackField(p, end, kind)
+	|| ! unpackField(p, end, flags)
+	|| ! unpackField(p, end, tagval)
+	|| ! unpackField(p, end, value)
+	|| ! unpackField(p, end, nqr))
+      break;
+
+    if (kind != "h" && extractValue(dir, tagValue(name, kind.c_str(), value), overwrite))
+      ++count;
+    if (flags.find('e') != std::string::npos)
+      extractValue(dir, tagValue(name, "e", std::string()), overwrite);
+    if (flags.find('t') != std::string::npos)
+      extractValue(dir, tagValue(name, "t", tagval), overwrite);
+
+    MonitorElement *me = findObject(dir, name);
+    DQMNet::QValue qv;
+    for (unsigned long i = 0, n = strtoul(nqr.c_str(), 0, 10); i < n; ++i)
+    {
+      if (! unpackField(p, end, qv.qtname)
+	  || ! unpackField(p, end, code)
+	  || ! unpackField(p, end, result)
+	  || ! unpackField(p, end, qv.algorithm)
+	  || ! unpackField(p, end, qv.message))
+      {
+	p = end + 1;
+	break;
+      }
+
+      qv.code = atoi(code.c_str());
+      qv.qtresult = strtod(result.c_str(), 0);
+      if (isSubdirectory(s_referenceDirName, dir))
+	continue;
+      else if (me)
+	me->addQReport(qv, /* FIXME: getQTest(qv.qtname)? */ 0);
+      else
+	std::cout << "*** DQMStore: WARNING: no monitor element '"
+		  << name << "' in directory '"
+		  << dir << "' for quality test '"
+		  << qv.qtname << "'\n";
+    }
+  }
+
+  if (p != end)
+    std::cout << "*** DQMStore: WARNING: metadata table in directory '"
+	      << dir << "' is truncated or corrupted\n";
+
+  return count;
+}
+
+/// merge the contents of store <from> into this one the same way as
+/// reading a file saved from <from> with open() would, overwriting
+/// identical monitor elements if <overwrite> is true; stores read
+/// from separate files can so be combined in the order of the files
+void
+DQMStore::merge(const DQMStore &from, bool overwrite /* = false */)
+{
+  MEMap::const_iterator mi = from.data_.begin();
+  MEMap::const_iterator me = from.data_.end();
+  DQMNet::QReports::const_iterator qi, qe;
+  for ( ; mi != me; ++mi)
+  {
+    const std::string &dir = *mi->data_.dirname;
+    makeDirectory(dir);
+    switch (mi->kind())
+    {
+    case MonitorElement::DQM_KIND_INT:
+    case MonitorElement::DQM_KIND_REAL:
+    case MonitorElement::DQM_KIND_STRING:
+      {
+	TObjString value(mi->tagString().c_str());
+	extract(&value, dir, overwrite);
+      }
+      break;
+
+    default:
+      mi->loadObject();
+      extract(mi->object_, dir, overwrite);
+      break;
+    }
+
+    if (! isSubdirectory(s_referenceDirName, dir))
+    {
+      qi = mi->data_.qreports.begin();
+      qe = mi->data_.qreports.end();
+      for ( ; qi != qe; ++qi)
+      {
+	TObjString value(mi->qualityTagString(*qi).c_str());
+	extract(&value, dir, overwrite);
+      }
+    }
+
+    if (mi->data_.flags & DQMNet::DQM_PROP_EFFICIENCY_PLOT)
+    {
+      TObjString value(mi->effLabelString().c_str());
+      extract(&value, dir, overwrite);
+    }
+
+    if (mi->data_.flags & DQMNet::DQM_PROP_TAGGED)
+    {
+      TObjString value(mi->tagLabelString().c_str());
+      extract(&value, dir, overwrite);
+    }
   }
 
-  if (verbose_ > 1)
-    std::cout << "DQMStore: read " << count << '/' << ntot
-	      << " objects from directory '" << dirpart << "'\n";
-
-  return ntot + count;
+  for (MEMap::iterator i = data_.begin(), e = data_.end(); i != e; ++i)
+    const_cast<MonitorElement &>(*i).updateQReportStats();
 }
 
 /// public open/read root file <filename>, and copy MonitorElements;
@@ -2444,6 +3906,211 @@ DQMStore::open(const std::string &filename,
   return readFile(filename,overwrite,onlypath,prepend,stripdirs,fileMustExist);
 }
 
+/// public open root file <filename> without reading the histograms:
+/// book placeholder monitor elements for them and read each object
+/// from the file the first time it is used.  Scalars, quality reports
+/// and tags are read right away, so listing and tag queries need no
+/// reads.  The file stays open until the last placeholder has been
+/// read or deleted.  Monitor elements which already exist are read
+/// as with open(); snapshot files are read as with open().
+bool
+DQMStore::openLazy(const std::string &filename,
+		   const std::string &onlypath /* ="" */,
+		   const std::string &prepend /* ="" */,
+		   OpenRunDirs stripdirs /* =KeepRunDirs */)
+{
+  if (DQMSnapshot::isSnapshot(filename))
+    return readFile(filename, false, onlypath, prepend, stripdirs);
+
+  if (verbose_)
+    std::cout << "DQMStore::openLazy: opening file '" << filename << "'\n";
+
+  DQMRootLock gate;
+  std::shared_ptr<TFile> f(TFile::Open(filename.c_str()));
+  if (! f || f->IsZombie())
+    raiseDQMError("DQMStore", "Failed to open file '%s'", filename.c_str());
+
+  unsigned n = readDirectory(f.get(), false, onlypath, prepend, "", stripdirs, f);
+
+  MEMap::iterator mi = data_.begin();
+  MEMap::iterator me = data_.end();
+  for ( ; mi != me; ++mi)
+    const_cast<MonitorElement &>(*mi).updateQReportStats();
+
+  if (verbose_)
+    std::cout << "DQMStore::openLazy: found " << n
+	      << " objects in file '" << filename << "'\n";
+  return true;
+}
+
+/// restore the state of the store saved with checkpoint() into
+/// <filename>.  Monitor elements in the checkpoint replace existing
+/// ones exactly, whatever their accumulate and soft reset settings,
+/// and get back their flags and soft reset baselines.  Quality tests
+/// are attached again by name, so those in the checkpoint must have
+/// been created with createQTest() first; the others are reported and
+/// skipped.  If <run> is non-zero, a checkpoint recorded in another run
+/// is not restored.  Returns the number of monitor elements restored.
+unsigned int
+DQMStore::restore(const std::string &filename,
+		  unsigned int run /* = 0 */)
+{
+  static const uint32_t STATE_FLAGS = (DQMNet::DQM_PROP_ACCUMULATE
+				       | DQMNet::DQM_PROP_RESET
+				       | DQMNet::DQM_PROP_LUMI);
+
+  if (! DQMSnapshot::isSnapshot(filename))
+    raiseDQMError("DQMStore", "File '%s' is not a checkpoint", filename.c_str());
+
+  if (verbose_)
+    std::cout << "DQMStore::restore: restoring from checkpoint '"
+	      << filename << "'\n";
+
+  DQMSnapshot::Reader r(filename);
+  std::vector<DQMSnapshot::Section> sections;
+  std::string path, dir, name;
+  std::set<std::string> missing;
+  std::string baseprefix = s_checkpointDirName + "/SoftReset/";
+  std::string stateprefix = s_checkpointDirName + "/";
+  std::string statepath = s_checkpointDirName + "/State";
+
+  // A checkpoint of another run does not apply.
+  for (uint64_t i = 0, e = r.size(); run && i < e; ++i)
+  {
+    if (r.path(i) != statepath)
+      continue;
+
+    r.sections(i, sections);
+    for (size_t s = 0, n = sections.size(); s < n; ++s)
+    {
+      if (sections[s].type != DQMSnapshot::SEC_RUN)
+	continue;
+
+      unsigned int crun = atoi(std::string(sections[s].data, sections[s].size).c_str());
+      if (crun && crun != run)
+      {
+	std::cout << "DQMStore: not restoring checkpoint '" << filename
+		  << "' of run " << crun << " into run " << run << "\n";
+	return 0;
+      }
+    }
+  }
+
+  // Drop the accumulate flag and soft reset baseline of the monitor
+  // elements about to be overwritten, so they are replaced exactly.
+  for (uint64_t i = 0, e = r.size(); i < e; ++i)
+  {
+    path = r.path(i);
+    if (path.compare(0, stateprefix.size(), stateprefix) == 0)
+      continue;
+
+    size_t slash = path.rfind('/');
+    dir.assign(path, 0, slash == std::string::npos ? 0 : slash);
+    name.assign(path, slash == std::string::npos ? 0 : slash+1, std::string::npos);
+    if (MonitorElement *me = findObject(dir, name))
+    {
+      me->data_.flags &= ~DQMNet::DQM_PROP_ACCUMULATE;
+      delete me->refvalue_;
+      me->refvalue_ = 0;
+    }
+  }
+
+  unsigned int count = readSnapshot(filename, true, "", "", KeepRunDirs);
+
+  // Now apply the state readSnapshot() does not know about.
+  for (uint64_t i = 0, e = r.size(); i < e; ++i)
+  {
+    path = r.path(i);
+    r.sections(i, sections);
+
+    bool baseline = (path.compare(0, baseprefix.size(), baseprefix) == 0);
+    if (baseline)
+      path.erase(0, baseprefix.size());
+    else if (path.compare(0, stateprefix.size(), stateprefix) == 0)
+    {
+      for (size_t s = 0, n = sections.size(); s < n; ++s)
+      {
+	if (sections[s].type != DQMSnapshot::SEC_QTESTSPEC)
+	  continue;
+
+	std::string spec(sections[s].data, sections[s].size);
+	size_t nul = spec.find('\0');
+	if (nul == std::string::npos)
+	  continue;
+
+	std::string qtname(spec, 0, nul);
+	std::string pattern(spec, nul+1);
+	QCriterion *qc = getQCriterion(qtname);
+	if (! qc)
+	{
+	  missing.insert(qtname);
+	  continue;
+	}
+
+	QTestSpecs::iterator qi = qtestspecs_.begin();
+	QTestSpecs::iterator qe = qtestspecs_.end();
+	for ( ; qi != qe; ++qi)
+	  if (qi->second == qc && qi->first->pattern() == pattern)
+	    break;
+	if (qi == qe)
+	  qtestspecs_.push_back(QTestSpec(new fastmatch(pattern), qc));
+      }
+      continue;
+    }
+
+    size_t slash = path.rfind('/');
+    dir.assign(path, 0, slash == std::string::npos ? 0 : slash);
+    name.assign(path, slash == std::string::npos ? 0 : slash+1, std::string::npos);
+    MonitorElement *me = findObject(dir, name);
+    if (! me)
+      continue;
+
+    if (baseline)
+    {
+      delete me->refvalue_;
+      me->refvalue_ = DQMSnapshot::object(name + "_ref", r.flags(i), sections);
+      continue;
+    }
+
+    me->data_.flags = (me->data_.flags & ~STATE_FLAGS) | (r.flags(i) & STATE_FLAGS);
+    for (size_t s = 0, n = sections.size(); s < n; ++s)
+    {
+      if (sections[s].type != DQMSnapshot::SEC_QTEST)
+	continue;
+
+      std::string qtname(sections[s].data, sections[s].size);
+      QCriterion *qc = getQCriterion(qtname);
+      if (! qc)
+      {
+	missing.insert(qtname);
+	continue;
+      }
+
+      // Keep the restored result, only attach the test.
+      QReport *qr;
+      DQMNet::QValue *qv;
+      me->getQReport(false, qtname, qr, qv);
+      if (qr)
+	qr->qcriterion_ = qc;
+      else
+	me->addQReport(qc);
+    }
+    me->updateQReportStats();
+  }
+
+  std::set<std::string>::iterator mi = missing.begin();
+  std::set<std::string>::iterator me = missing.end();
+  for ( ; mi != me; ++mi)
+    std::cout << "*** DQMStore: WARNING: quality test '" << *mi
+	      << "' in checkpoint '" << filename
+	      << "' does not exist, not attaching it\n";
+
+  if (verbose_)
+    std::cout << "DQMStore::restore: restored " << count
+	      << " objects from checkpoint '" << filename << "'\n";
+  return count;
+}
+
 /// public load root file <filename>, and copy MonitorElements;
 /// overwrite identical MonitorElements (default: true);
 /// set DQMStore.collateHistograms to true to sum several files
@@ -2468,6 +4135,350 @@ DQMStore::load(const std::string &filename,
      
 }
 
+// Files read ahead of loadMany() by its reader thread.  Each file is
+// read into a staging store of its own, so opening the file, reading
+// and decompressing its keys and streaming the objects happen on the
+// reader thread, while the calling thread merges the files already
+// read in order.  Staged files are bounded by their size on disk.
+struct DQMStoreLoadInput
+{
+  std::string			name;	//< File name.
+  std::unique_ptr<DQMStore>	store;	//< Contents, null if reading failed.
+  std::exception_ptr		error;	//< Exception if reading failed.
+  size_t			bytes;	//< Memory of the contents counted against the budget.
+  bool				found;	//< Whether the file was there.
+  bool				done;	//< Whether reading has finished.
+};
+
+struct DQMStoreLoadQueue
+{
+  std::vector<DQMStoreLoadInput> inputs;
+  size_t			next;	//< Next input to read.
+  size_t			merged;	//< Inputs merged so far.
+  size_t			staged;	//< Bytes read but not merged yet.
+  size_t			budget;	//< Bytes staged ahead of the merge to stop reading at.
+  DQMStore::OpenRunDirs		stripdirs;
+  bool				mustexist;
+  bool				stop;
+  std::mutex			lock;
+  std::condition_variable	cond;
+};
+
+/// memory held by the histogram arrays of the monitor elements in
+/// @a store, the compressed file size says little about it
+static size_t
+stagedBytes(const DQMStore &store)
+{
+  size_t bytes = 0;
+  std::vector<MonitorElement *> all = store.getAllContents("");
+  for (size_t i = 0, e = all.size(); i < e; ++i)
+  {
+    TH1 *h = dynamic_cast<TH1 *>(all[i]->getRootObject());
+    if (! h)
+      continue;
+
+    size_t cells = h->GetNcells();
+    switch (all[i]->kind())
+    {
+    case MonitorElement::DQM_KIND_TH1S:
+    case MonitorElement::DQM_KIND_TH2S:
+      bytes += cells * sizeof(Short_t);
+      break;
+
+    case MonitorElement::DQM_KIND_TH1F:
+    case MonitorElement::DQM_KIND_TH2F:
+    case MonitorElement::DQM_KIND_TH3F:
+      bytes += cells * sizeof(Float_t);
+      break;
+
+    case MonitorElement::DQM_KIND_TPROFILE:
+    case MonitorElement::DQM_KIND_TPROFILE2D:
+      // Contents, bin entries and their sum of squared weights.
+      bytes += 3 * cells * sizeof(Double_t);
+      break;
+
+    default:
+      bytes += cells * sizeof(Double_t);
+      break;
+    }
+    bytes += h->GetSumw2N() * sizeof(Double_t);
+  }
+  return bytes;
+}
+
+/// reader thread of loadMany(), reads the inputs in order into stores
+/// of their own until more than the budget is staged ahead of the
+/// merge; DQMStore::readFile() serialises its ROOT calls with the
+/// merge on the main thread
+static void
+loadInputs(DQMStoreLoadQueue *q)
+{
+  edm::ParameterSet emptyps;
+  std::unique_lock<std::mutex> gate(q->lock);
+  while (true)
+  {
+    // Always allow one file to be staged, however large.
+    while (! q->stop && q->next < q->inputs.size()
+	   && q->staged > 0 && q->staged >= q->budget)
+      q->cond.wait(gate);
+    if (q->stop || q->next >= q->inputs.size())
+      break;
+
+    DQMStoreLoadInput &in = q->inputs[q->next++];
+    gate.unlock();
+
+    std::unique_ptr<DQMStore> store;
+    std::exception_ptr error;
+    size_t bytes = 0;
+    bool found = false;
+    try
+    {
+      store.reset(new DQMStore(emptyps));
+      found = store->open(in.name, false, "", "", q->stripdirs, q->mustexist);
+      bytes = stagedBytes(*store);
+    }
+    catch (...)
+    {
+      DQMRootLock root;
+      store.reset();
+      error = std::current_exception();
+    }
+
+    gate.lock();
+    in.store.swap(store);
+    in.error = error;
+    in.bytes = bytes;
+    in.found = found;
+    in.done = true;
+    q->staged += bytes;
+    q->cond.notify_all();
+  }
+}
+
+/// public load root files <files> in order as load() would one after
+/// another, reading the next files on a separate thread while the
+/// current one is merged in.  Reading ahead stops once the histograms
+/// of the files read but not merged yet take DQMStore.loadPrefetchMB
+/// megabytes of memory; one file is always read ahead, however large.
+/// Returns false if <fileMustExist> is false and a file did not exist
+bool
+DQMStore::loadMany(const std::vector<std::string> &files,
+		   OpenRunDirs stripdirs /* =StripRunDirs */,
+		   bool fileMustExist /* =true */)
+{
+  bool overwrite = ! collateHistograms_;
+  bool allread = true;
+  if (files.empty())
+    return true;
+
+  DQMStoreLoadQueue q;
+  q.next = 0;
+  q.merged = 0;
+  q.staged = 0;
+  q.budget = size_t(loadPrefetchMB_) << 20;
+  q.stripdirs = stripdirs;
+  q.mustexist = fileMustExist;
+  q.stop = false;
+  q.inputs.resize(files.size());
+  for (size_t i = 0; i < q.inputs.size(); ++i)
+  {
+    q.inputs[i].name = files[i];
+    q.inputs[i].bytes = 0;
+    q.inputs[i].found = false;
+    q.inputs[i].done = false;
+  }
+
+  if (verbose_)
+    std::cout << "DQMStore::loadMany: reading " << files.size()
+	      << " files in " << (overwrite ? "overwrite" : "collate")
+	      << " mode\n";
+
+  TThread::Initialize();
+  std::thread reader(loadInputs, &q);
+
+  try
+  {
+    for (size_t i = 0; i < q.inputs.size(); ++i)
+    {
+      DQMStoreLoadInput &in = q.inputs[i];
+      std::unique_ptr<DQMStore> store;
+      {
+	std::unique_lock<std::mutex> gate(q.lock);
+	while (! in.done)
+	  q.cond.wait(gate);
+	store.swap(in.store);
+      }
+
+      if (in.error)
+	std::rethrow_exception(in.error);
+
+      if (! in.found)
+      {
+	if (verbose_)
+	  std::cout << "DQMStore::loadMany: file '" << in.name
+		    << "' does not exist, continuing\n";
+	allread = false;
+      }
+      else
+      {
+	if (verbose_)
+	  std::cout << "DQMStore::loadMany: merging file '" << in.name << "'\n";
+	DQMRootLock root;
+	merge(*store, overwrite);
+      }
+
+      // Release the staged file before letting the reader go on.
+      {
+	DQMRootLock root;
+	store.reset();
+      }
+      std::lock_guard<std::mutex> gate(q.lock);
+      q.staged -= in.bytes;
+      q.merged++;
+      q.cond.notify_all();
+    }
+  }
+  catch (...)
+  {
+    {
+      std::lock_guard<std::mutex> gate(q.lock);
+      q.stop = true;
+      q.cond.notify_all();
+    }
+    reader.join();
+    throw;
+  }
+
+  reader.join();
+  return allread;
+}
+
+/// apply delta file <filename> written by saveDelta() on top of the
+/// current contents: monitor elements in the file overwrite existing
+/// ones, and monitor elements of the base or an earlier delta which
+/// were no longer in the store when the delta was saved are removed;
+/// monitor elements read from other files are kept.  Returns false
+/// without reading anything if the file is not a delta file.  If given,
+/// <base> and <sequence> are set to the base file name and the position
+/// of the delta in its chain.
+bool
+DQMStore::openDelta(const std::string &filename,
+		    std::string *base /* = 0 */,
+		    unsigned *sequence /* = 0 */)
+{
+  DQMRootLock gate;
+  std::auto_ptr<TFile> f(TFile::Open(filename.c_str()));
+  if (! f.get() || f->IsZombie())
+    raiseDQMError("DQMStore", "Failed to open file '%s'", filename.c_str());
+
+  return readDelta(f.get(), filename, base, sequence);
+}
+
+/// public open root file <filename> as open() does, or, if it is a
+/// delta file written by saveDelta(), apply it as openDelta() does if
+/// <applyDelta> and otherwise leave it unread; the file is opened only
+/// once either way.  Delta files are recognised only if <onlypath> is
+/// empty, otherwise they are read as plain files.  Returns true if the
+/// file was a delta file.
+bool
+DQMStore::openFileOrDelta(const std::string &filename,
+			  const std::string &onlypath,
+			  bool applyDelta,
+			  std::string *base /* = 0 */,
+			  unsigned *sequence /* = 0 */)
+{
+  if (DQMSnapshot::isSnapshot(filename))
+  {
+    readFile(filename, false, onlypath, "", KeepRunDirs);
+    return false;
+  }
+
+  if (verbose_)
+    std::cout << "DQMStore::openFileOrDelta: reading from file '" << filename << "'\n";
+
+  DQMRootLock gate;
+  std::auto_ptr<TFile> f(TFile::Open(filename.c_str()));
+  if (! f.get() || f->IsZombie())
+    raiseDQMError("DQMStore", "Failed to open file '%s'", filename.c_str());
+
+  if (onlypath.empty() && f->GetDirectory(s_deltaDirName.c_str()))
+  {
+    if (applyDelta)
+      readDelta(f.get(), filename, base, sequence);
+    return true;
+  }
+
+  readTFile(f.get(), filename, false, onlypath, "", KeepRunDirs);
+  return false;
+}
+
+/// private apply the delta file <filename> opened as <f>, see
+/// openDelta(); returns false if the file has no delta manifest
+bool
+DQMStore::readDelta(TFile *f,
+		    const std::string &filename,
+		    std::string *base,
+		    unsigned *sequence)
+{
+  // Read the manifest.
+  TDirectory *manifest = f->GetDirectory(s_deltaDirName.c_str());
+  if (! manifest)
+    return false;
+
+  std::auto_ptr<TObject> obase(manifest->Get("base"));
+  std::auto_ptr<TObject> oseq(manifest->Get("sequence"));
+  std::auto_ptr<TObject> oremoved(manifest->Get("removed"));
+  TObjString *sbase = dynamic_cast<TObjString *>(obase.get());
+  TObjString *sseq = dynamic_cast<TObjString *>(oseq.get());
+  TObjString *sremoved = dynamic_cast<TObjString *>(oremoved.get());
+  if (! sbase || ! sseq || ! sremoved)
+    raiseDQMError("DQMStore", "Delta file '%s' has an incomplete manifest",
+		  filename.c_str());
+
+  if (base)
+    *base = sbase->GetName();
+  if (sequence)
+    *sequence = atoi(sseq->GetName());
+
+  if (verbose_)
+    std::cout << "DQMStore::openDelta: applying delta " << sseq->GetName()
+	      << " of base '" << sbase->GetName() << "' from file '"
+	      << filename << "'\n";
+
+  // Read the changed monitor elements.
+  unsigned n = readDirectory(f, true, "", "", "", KeepRunDirs);
+
+  // Remove the monitor elements of the chain which no longer existed,
+  // leaving alone anything the store got from other files.
+  unsigned nremoved = 0;
+  std::string dir, name;
+  const char *p = sremoved->GetName();
+  while (const char *nl = strchr(p, '\n'))
+  {
+    splitPath(dir, name, std::string(p, nl - p));
+    MonitorElement proto(&dir, name);
+    MEMap::iterator mi = data_.find(proto);
+    if (mi != data_.end())
+    {
+      data_.erase(mi);
+      ++nremoved;
+    }
+    p = nl+1;
+  }
+  f->Close();
+
+  MEMap::iterator mi = data_.begin();
+  MEMap::iterator me = data_.end();
+  for ( ; mi != me; ++mi)
+    const_cast<MonitorElement &>(*mi).updateQReportStats();
+
+  if (verbose_)
+    std::cout << "DQMStore::openDelta: read " << n << " objects and removed "
+	      << nremoved << " monitor elements\n";
+
+  return true;
+}
+
 /// private readFile <filename>, and copy MonitorElements;
 /// if flag=true, overwrite identical MonitorElements (default: false);
 /// if onlypath != "", read only selected directory
@@ -2485,6 +4496,23 @@ DQMStore::readFile(const std::string &filename,
   if (verbose_)
     std::cout << "DQMStore::readFile: reading from file '" << filename << "'\n";
 
+  // Native snapshots are recognised by their header.
+  if (DQMSnapshot::isSnapshot(filename))
+  {
+    unsigned n = readSnapshot(filename, overwrite, onlypath, prepend, stripdirs);
+
+    MEMap::iterator mi = data_.begin();
+    MEMap::iterator me = data_.end();
+    for ( ; mi != me; ++mi)
+      const_cast<MonitorElement &>(*mi).updateQReportStats();
+
+    if (verbose_)
+      std::cout << "DQMStore::open: successfully read " << n
+		<< " objects from snapshot file '" << filename << "'\n";
+    return true;
+  }
+
+  DQMRootLock gate;
   std::auto_ptr<TFile> f;
 
   try 
@@ -2505,7 +4533,21 @@ DQMStore::readFile(const std::string &filename,
     }
   }
 
-  unsigned n = readDirectory(f.get(), overwrite, onlypath, prepend, "", stripdirs);
+  readTFile(f.get(), filename, overwrite, onlypath, prepend, stripdirs);
+  return true;
+}
+
+/// private read the root file <filename> opened as <f> and close it,
+/// see readFile()
+unsigned
+DQMStore::readTFile(TFile *f,
+		    const std::string &filename,
+		    bool overwrite,
+		    const std::string &onlypath,
+		    const std::string &prepend,
+		    OpenRunDirs stripdirs)
+{
+  unsigned n = readDirectory(f, overwrite, onlypath, prepend, "", stripdirs);
   f->Close();
 
   MEMap::iterator mi = data_.begin();
@@ -2523,7 +4565,7 @@ DQMStore::readFile(const std::string &filename,
       std::cout << " into directory '" << prepend << "'";
     std::cout << std::endl;
   }
-  return true;
+  return n;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -2701,6 +4743,87 @@ DQMStore::runQTests(void)
   reset_ = false;
 }
 
+/// get names of all the quality test algorithms known to createQTest
+void
+DQMStore::getAllQTestAlgorithms(std::vector<std::string> &into) const
+{
+  into.clear();
+  into.reserve(qalgos_.size());
+  QAMap::const_iterator i = qalgos_.begin();
+  QAMap::const_iterator e = qalgos_.end();
+  for ( ; i != e; ++i)
+    into.push_back(i->first);
+}
+
+/// print execution statistics of all quality tests, see QCriterion::getStats()
+void
+DQMStore::showQTestStats(void) const
+{
+  std::cout << " ------------------------------------------------------------\n"
+	    << "                 Quality test statistics:                    \n"
+	    << " ------------------------------------------------------------\n";
+
+  QCMap::const_iterator i = qtests_.begin();
+  QCMap::const_iterator e = qtests_.end();
+  for ( ; i != e; ++i)
+  {
+    const QCriterionStats &s = i->second->getStats();
+    std::cout << i->first << " (" << i->second->algoName() << "): "
+	      << s.calls << " runs, "
+	      << s.bins << " bins, "
+	      << s.totalTime * 1e-6 << " ms total, "
+	      << s.maxTime * 1e-6 << " ms max";
+    if (! s.worstME.empty())
+      std::cout << " on " << s.worstME;
+    std::cout << "\n";
+  }
+
+  std::cout << " ------------------------------------------------------------\n";
+}
+
+/// book or update monitor elements <dir>/<qtname>/{calls, bins,
+/// totalTimeMs, maxTimeMs, worstME} holding the execution statistics
+/// of each quality test
+void
+DQMStore::publishQTestStats(const std::string &dir)
+{
+  std::string clean;
+  const std::string *cleaned = 0;
+  cleanTrailingSlashes(dir, clean, cleaned);
+
+  QCMap::const_iterator i = qtests_.begin();
+  QCMap::const_iterator e = qtests_.end();
+  std::string path;
+  for ( ; i != e; ++i)
+  {
+    const QCriterionStats &s = i->second->getStats();
+    path.clear();
+    mergePath(path, *cleaned, i->first);
+    makeDirectory(path);
+
+    bookInt(path, "calls")->Fill(int64_t(s.calls));
+    bookInt(path, "bins")->Fill(int64_t(s.bins));
+    bookFloat(path, "totalTimeMs")->Fill(s.totalTime * 1e-6);
+    bookFloat(path, "maxTimeMs")->Fill(s.maxTime * 1e-6);
+
+    std::string worst = s.worstME;
+    if (MonitorElement *me = findObject(path, "worstME"))
+      me->Fill(worst);
+    else
+      bookString(path, "worstME", worst);
+  }
+}
+
+/// reset execution statistics of all quality tests
+void
+DQMStore::resetQTestStats(void)
+{
+  QCMap::iterator i = qtests_.begin();
+  QCMap::iterator e = qtests_.end();
+  for ( ; i != e; ++i)
+    i->second->resetStats();
+}
+
 /// get "global" folder <path> status (one of:STATUS_OK, WARNING, ERROR, OTHER);
 /// returns most sever error, where ERROR > WARNING > OTHER > STATUS_OK;
 /// see Core/interface/QTestStatus.h for details on "OTHER" 
@@ -0,0 +1,139 @@
+#ifndef DQMSERVICES_CORE_DQM_TAG_STRING_H
+# define DQMSERVICES_CORE_DQM_TAG_STRING_H
+
+# include <cstddef>
+# include <cstdlib>
+# include <cstring>
+
+/** Parser for the tagged strings "<label>kind=value</label>" which
+    MonitorElement::tagString(), qualityTagString(), tagLabelString()
+    and effLabelString() produce, and which files store as TObjString
+    names.  The kind is one of "i", "f", "s", "e", "t" or "qr".
+
+    Parsing is a single pass over the string without allocation: the
+    parts are returned as ranges into the input.  The closing label is
+    taken to start at the last "</", so labels cannot contain "</",
+    which monitor element and quality test names never do.  */
+struct DQMTagString
+{
+  const char	*label;		//< Label, the monitor element name.
+  size_t	labelLen;	//< Label length.
+  const char	*kind;		//< Value kind.
+  size_t	kindLen;	//< Value kind length.
+  const char	*value;		//< Value, not null terminated.
+  size_t	valueLen;	//< Value length.
+
+  /// Parse the @a len characters at @a s, returns false if they are
+  /// not a tagged string.
+  bool parse(const char *s, size_t len)
+    {
+      if (len < 7 || s[0] != '<' || s[len-1] != '>')
+	return false;
+
+      // Find the closing label from the end.
+      const char *end = s + len - 1;
+      const char *close = end;
+      while (--close > s && ! (close[0] == '<' && close[1] == '/'))
+	;
+      if (close <= s)
+	return false;
+
+      label = s + 1;
+      labelLen = end - (close + 2);
+      if (label + labelLen + 1 > close
+	  || label[labelLen] != '>'
+	  || memcmp(label, close + 2, labelLen) != 0)
+	return false;
+
+      kind = label + labelLen + 1;
+      const char *eq = kind;
+      while (eq < close && *eq != '=')
+	++eq;
+      if (eq == close)
+	return false;
+
+      kindLen = eq - kind;
+      if (! (kindLen == 1 && strchr("ifset", *kind))
+	  && ! (kindLen == 2 && kind[0] == 'q' && kind[1] == 'r'))
+	return false;
+
+      value = eq + 1;
+      valueLen = close - value;
+      return true;
+    }
+
+  /// Check whether the kind is @a k.
+  bool isKind(const char *k) const
+    { return strlen(k) == kindLen && memcmp(k, kind, kindLen) == 0; }
+};
+
+/** Parser for quality report values in the tagged strings, either
+    "st:code:result:algorithm:message" as written by qualityTagString()
+    or the old "st.code.message".  The old format has no result and no
+    algorithm; @a algorithm is then null.  */
+struct DQMQualityString
+{
+  int		code;		//< Status code.
+  double	qtresult;	//< Test result, zero in the old format.
+  const char	*algorithm;	//< Algorithm name, null in the old format.
+  size_t	algorithmLen;	//< Algorithm name length.
+  const char	*message;	//< Message, not null terminated.
+  size_t	messageLen;	//< Message length.
+
+  /// Parse the @a len characters at @a s, returns false if they are
+  /// not a quality report value.
+  bool parse(const char *s, size_t len)
+    {
+      const char *end = s + len;
+      if (len < 4 || s[0] != 's' || s[1] != 't' || (s[2] != ':' && s[2] != '.'))
+	return false;
+
+      char sep = s[2];
+      const char *p = s + 3;
+      if (! digits(p, end) || p == end || *p != sep)
+	return false;
+      code = atoi(s + 3);
+      ++p;
+
+      if (sep == '.')
+      {
+	qtresult = 0;
+	algorithm = 0;
+	algorithmLen = 0;
+	message = p;
+	messageLen = end - p;
+	return true;
+      }
+
+      const char *result = p;
+      while (p < end && (*p == '-' || *p == '+' || *p == 'e' || *p == '.'
+			 || (*p >= '0' && *p <= '9')))
+	++p;
+      if (p == result || p == end || *p != ':')
+	return false;
+      qtresult = strtod(result, 0);
+      ++p;
+
+      algorithm = p;
+      while (p < end && *p != ':')
+	++p;
+      if (p == end)
+	return false;
+      algorithmLen = p - algorithm;
+
+      message = p + 1;
+      messageLen = end - message;
+      return true;
+    }
+
+private:
+  static bool digits(const char *&p, const char *end)
+    {
+      const char *start = p;
+      while (p < end && *p >= '0' && *p <= '9')
+	++p;
+      return p != start;
+    }
+};
+
+#endif // DQMSERVICES_CORE_DQM_TAG_STRING_H
@@ -3,9 +3,12 @@
 #include "DQMServices/Core/interface/MonitorElement.h"
 #include "DQMServices/Core/interface/QTest.h"
 #include "DQMServices/Core/src/DQMError.h"
+#include "DQMServices/Core/src/DQMCollate.h"
+#include "classlib/utils/Time.h"
 #include "TClass.h"
 #include "TMath.h"
 #include "TList.h"
+#include <algorithm>
 #include <iostream>
 #include <cassert>
 #include <cfloat>
@@ -143,10 +146,41 @@ MonitorElement::initialise(Kind kind, const std::string &value)
   return this;
 }
 
+/// Get the type of monitor element holding a histogram of ROOT class
+/// @a classname, or DQM_KIND_INVALID if it is not a histogram class a
+/// monitor element can hold.
+MonitorElement::Kind
+MonitorElement::kindFromClass(const char *classname)
+{
+  static const struct { const char *name; Kind kind; } kinds[] = {
+    { "TH1F",		DQM_KIND_TH1F },
+    { "TH1S",		DQM_KIND_TH1S },
+    { "TH1D",		DQM_KIND_TH1D },
+    { "TH2F",		DQM_KIND_TH2F },
+    { "TH2S",		DQM_KIND_TH2S },
+    { "TH2D",		DQM_KIND_TH2D },
+    { "TH3F",		DQM_KIND_TH3F },
+    { "TProfile",	DQM_KIND_TPROFILE },
+    { "TProfile2D",	DQM_KIND_TPROFILE2D }
+  };
+
+  for (size_t i = 0; i < sizeof(kinds)/sizeof(kinds[0]); ++i)
+    if (! strcmp(classname, kinds[i].name))
+      return kinds[i].kind;
+
+  return DQM_KIND_INVALID;
+}
+
 MonitorElement::MonitorElement(void)
   : object_(0),
     reference_(0),
-    refvalue_(0)
+    refvalue_(0),
+    refcache_(0),
+    refme_(0),
+    source_(0),
+    mapping_(0),
+    version_(0),
+    savedVersion_(~0ULL)
 {
   data_.version = 0;
   data_.dirname = 0;
@@ -159,7 +193,13 @@ MonitorElement::MonitorElement(void)
 MonitorElement::MonitorElement(const std::string *path, const std::string &name)
   : object_(0),
     reference_(0),
-    refvalue_(0)
+    refvalue_(0),
+    refcache_(0),
+    refme_(0),
+    source_(0),
+    mapping_(0),
+    version_(0),
+    savedVersion_(~0ULL)
 {
   data_.version = 0;
   data_.dirname = path;
@@ -176,13 +216,35 @@ MonitorElement::MonitorElement(const MonitorElement &x)
     object_(x.object_),
     reference_(x.reference_),
     refvalue_(x.refvalue_),
-    qreports_(x.qreports_)
-{
+    qreports_(x.qreports_),
+    refcache_(0),
+    refme_(0),
+    source_(0),
+    mapping_(0),
+    version_(x.version_),
+    savedVersion_(x.savedVersion_)
+{
+  // A copy never shares the source, read the object before cloning it.
+  if (x.source_)
+  {
+    x.loadObject();
+    object_ = x.object_;
+  }
+
   if (object_)
     object_ = static_cast<TH1 *>(object_->Clone());
 
   if (refvalue_)
     refvalue_ = static_cast<TH1 *>(refvalue_->Clone());
+
+  // Follow the same reference monitor element, so the reference object
+  // is dropped from the copy too if the reference goes away.  No one
+  // uses the copy as a reference.
+  if (x.refme_)
+  {
+    refme_ = x.refme_;
+    refme_->masters_.push_back(this);
+  }
 }
 
 MonitorElement &
@@ -190,8 +252,16 @@ MonitorElement::operator=(const MonitorElement &x)
 {
   if (this != &x)
   {
+    x.loadObject();
+    unlinkReference();
+    unlinkMasters();
+    delete mapping_;
+    mapping_ = 0;
     delete object_;
     delete refvalue_;
+    delete refcache_;
+    delete source_;
+    source_ = 0;
 
     data_ = x.data_;
     scalar_ = x.scalar_;
@@ -199,12 +269,21 @@ MonitorElement::operator=(const MonitorElement &x)
     reference_ = x.reference_;
     refvalue_ = x.refvalue_;
     qreports_ = x.qreports_;
+    refcache_ = 0;
+    version_ = x.version_;
+    savedVersion_ = x.savedVersion_;
 
     if (object_)
       object_ = static_cast<TH1 *>(object_->Clone());
 
     if (refvalue_)
       refvalue_ = static_cast<TH1 *>(refvalue_->Clone());
+
+    if (x.refme_)
+    {
+      refme_ = x.refme_;
+      refme_->masters_.push_back(this);
+    }
   }
 
   return *this;
@@ -212,8 +291,15 @@ MonitorElement::operator=(const MonitorElement &x)
 
 MonitorElement::~MonitorElement(void)
 {
+  // Drop the reference links in both directions.
+  unlinkReference();
+  unlinkMasters();
+
+  delete mapping_;
   delete object_;
   delete refvalue_;
+  delete refcache_;
+  delete source_;
 }
 
 /// "Fill" ME methods for string
@@ -617,8 +703,23 @@ MonitorElement::runQTests(void)
 {
   assert(qreports_.size() == data_.qreports.size());
 
-  // Rerun quality tests where the ME or the quality algorithm was modified.
-  bool dirty = wasUpdated();
+  // Rerun quality tests where the ME or the quality algorithm was
+  // modified since the test last ran.  The content version tracks
+  // changes made through this class, the number of entries catches
+  // changes made directly to the ROOT objects.  Tests with a minimum
+  // interval are left pending until the interval has passed.  Objects
+  // of lazily opened files are read only if some test may run.
+  for (size_t i = 0, e = qreports_.size(); i < e; ++i)
+    if (qreports_[i].qcriterion_)
+    {
+      loadObject();
+      accessRefObject();
+      break;
+    }
+
+  double entries = (object_ ? object_->GetEntries() : 0);
+  double refentries = (reference_ ? reference_->GetEntries() : 0);
+  uint64_t version = version_;
   for (size_t i = 0, e = data_.qreports.size(); i < e; ++i)
   {
     DQMNet::QValue &qv = data_.qreports[i];
@@ -626,17 +727,45 @@ MonitorElement::runQTests(void)
     QCriterion *qc = qr.qcriterion_;
     qr.qvalue_ = &qv;
 
-    // if (qc && (dirty || qc->wasModified()))  // removed for new QTest (abm-090503)
-    if (qc && dirty)
-    {
-      assert(qc->getName() == qv.qtname);
-      std::string oldMessage = qv.message;
-      int oldStatus = qv.code;
+    if (! qc
+	|| (qr.version_ == version
+	    && qr.paramVersion_ == qc->paramVersion_
+	    && qr.entries_ == entries
+	    && qr.refEntries_ == refentries))
+      continue;
 
-      qc->runTest(this, qr, qv);
+    uint64_t start = lat::Time::current().ns();
+    if (qc->minInterval_ && qr.runTime_ && start - qr.runTime_ < qc->minInterval_)
+      continue;
 
-      if (oldStatus != qv.code || oldMessage != qv.message)
-	update();
+    assert(qc->getName() == qv.qtname);
+    std::string oldMessage = qv.message;
+    int oldStatus = qv.code;
+
+    // The tests read the histograms through the public accessors,
+    // which count as a change; a test only reading its input must
+    // not invalidate its own or the other tests' results.
+    uint64_t before = version_;
+    qc->runTest(this, qr, qv);
+    qc->recordRun(this, lat::Time::current().ns() - start);
+    version_ = before;
+
+    qr.version_ = version;
+    qr.paramVersion_ = qc->paramVersion_;
+    qr.entries_ = entries;
+    qr.refEntries_ = refentries;
+    qr.runTime_ = start;
+
+    // Flag the change for the clients and bump the version so that
+    // it is saved again, but keep the results of the other tests on
+    // this monitor element valid, their inputs did not change.
+    if (oldStatus != qv.code || oldMessage != qv.message)
+    {
+      update();
+      for (size_t j = 0; j < e; ++j)
+	if (qreports_[j].version_ == version)
+	  qreports_[j].version_ = version_;
+      version = version_;
     }
   }
 
@@ -659,9 +788,71 @@ MonitorElement::accessRootObject(const char *func, int reqdim) const
 		  " element '%s' because it is not a root object",
 		  func, data_.objname.c_str());
 
+  loadObject();
+  unmapObject();
   return checkRootObject(data_.objname, object_, func, reqdim);
 }
 
+/// Get the reference object, reading it first if the linked reference
+/// monitor element was opened lazily.
+TH1 *
+MonitorElement::accessRefObject(void) const
+{
+  if (refme_ && refme_->source_)
+    refme_->loadObject();
+  return reference_;
+}
+
+/// Read the ROOT object of a monitor element opened with
+/// DQMStore::openLazy(), if not done already.  Monitor elements linked
+/// to this one as reference pick up the object as well.
+void
+MonitorElement::loadObject(void) const
+{
+  if (! source_)
+    return;
+
+  MonitorElement *self = const_cast<MonitorElement *>(this);
+  TH1 *obj = source_->load();
+  if (! obj)
+    raiseDQMError("MonitorElement", "failed to read the object of monitor"
+		  " element '%s' from its file", data_.objname.c_str());
+
+  delete self->source_;
+  self->source_ = 0;
+  obj->SetDirectory(0);
+  self->initialise(kind(), obj);
+  for (size_t i = 0, e = masters_.size(); i < e; ++i)
+    masters_[i]->reference_ = object_;
+}
+
+/// Give the ROOT object arrays memory of their own if they point into
+/// memory shared with other processes, before the object is handed out
+/// or modified.  ROOT deletes and reallocates arrays on many changes,
+/// for example on rebinning, which must not touch the shared memory.
+void
+MonitorElement::unmapObject(void) const
+{
+  if (! mapping_)
+    return;
+
+  MonitorElement *self = const_cast<MonitorElement *>(this);
+  self->mapping_->copy();
+  delete self->mapping_;
+  self->mapping_ = 0;
+}
+
+/// Get the reference object for the caller to use freely, copying it
+/// out of shared memory first if need be.
+TH1 *
+MonitorElement::unmapRefObject(void) const
+{
+  accessRefObject();
+  if (refme_)
+    refme_->unmapObject();
+  return reference_;
+}
+
 /*** getter methods (wrapper around ROOT methods) ****/
 // 
 /// get mean value of histogram along x, y or z axis (axis=1, 2, 3 respectively)
@@ -976,6 +1167,71 @@ MonitorElement::getAxis(const char *func, int axis) const
   return a;
 }
 
+/// Link @a ref as the reference object of this monitor element.  Any
+/// reference quantities the quality tests cached for the previous
+/// reference object are discarded.
+void
+MonitorElement::setReference(TH1 *ref)
+{
+  data_.flags |= DQMNet::DQM_PROP_HAS_REFERENCE;
+  reference_ = ref;
+  delete refcache_;
+  refcache_ = 0;
+  ++version_;
+}
+
+/// Link the reference monitor element @a ref to this one, replacing
+/// any previous link, and use its object as the reference object.
+/// The reference quantities cached by the quality tests are kept on
+/// @a ref.  The link is found by path, so each reference serves only
+/// the monitor element of the same name and its copies.  Identical
+/// references under different names are neither shared nor merged:
+/// finding them would mean digesting the contents of every reference
+/// read, and reference files rarely repeat a histogram.
+void
+MonitorElement::linkReference(MonitorElement *ref)
+{
+  if (refme_ != ref)
+  {
+    unlinkReference();
+    refme_ = ref;
+    ref->masters_.push_back(this);
+  }
+  setReference(ref->object_);
+}
+
+/// Drop the link to the reference monitor element, if any.  The
+/// reference object itself is left in place.
+void
+MonitorElement::unlinkReference(void)
+{
+  if (refme_)
+  {
+    std::vector<MonitorElement *> &m = refme_->masters_;
+    m.erase(std::remove(m.begin(), m.end(), this), m.end());
+    refme_ = 0;
+  }
+}
+
+/// Drop the links of the monitor elements using this one as reference,
+/// along with their reference object, before this one goes away or
+/// takes on the contents of another.
+void
+MonitorElement::unlinkMasters(void)
+{
+  for (size_t i = 0, e = masters_.size(); i < e; ++i)
+  {
+    MonitorElement *master = masters_[i];
+    master->refme_ = 0;
+    master->reference_ = 0;
+    master->data_.flags &= ~DQMNet::DQM_PROP_HAS_REFERENCE;
+    delete master->refcache_;
+    master->refcache_ = 0;
+    ++master->version_;
+  }
+  masters_.clear();
+}
+
 // ------------ Operations for MEs that are normally never reset ---------
 
 /// reset contents (does not erase contents permanently)
@@ -984,6 +1240,8 @@ void
 MonitorElement::softReset(void)
 {
   update();
+  loadObject();
+  unmapObject();
 
   // Create the reference object the first time this is called.
   // On subsequent calls accumulate the current value to the
@@ -1185,6 +1443,8 @@ MonitorElement::disableSoftReset(void)
 {
   if (refvalue_)
   {
+    ++version_;
+    unmapObject();
     if (kind() == DQM_KIND_TH1F
 	|| kind() == DQM_KIND_TH1S
 	|| kind() == DQM_KIND_TH1D
@@ -1351,9 +1611,17 @@ void
 MonitorElement::copyFrom(TH1 *from)
 {
   TH1 *orig = accessRootObject(__PRETTY_FUNCTION__, 1);
+  ++version_;
   if (orig->GetTitle() != from->GetTitle())
     orig->SetTitle(from->GetTitle());
 
+  // Histograms with the same binning are copied as plain arrays.
+  if (DQMCollate::copy(this, orig, from, refvalue_, !isAccumulateEnabled()))
+  {
+    copyFunctions(from, orig);
+    return;
+  }
+
   if (!isAccumulateEnabled())
     orig->Reset();
 
@@ -1472,6 +1740,8 @@ TObject *
 MonitorElement::getRootObject(void) const
 {
   const_cast<MonitorElement *>(this)->update();
+  loadObject();
+  unmapObject();
   return object_;
 }
 
@@ -1559,14 +1829,14 @@ TObject *
 MonitorElement::getRefRootObject(void) const
 {
   const_cast<MonitorElement *>(this)->update();
-  return reference_;
+  return unmapRefObject();
 }
 
 TH1 *
 MonitorElement::getRefTH1(void) const
 {
   const_cast<MonitorElement *>(this)->update();
-  return checkRootObject(data_.objname, reference_, __PRETTY_FUNCTION__, 0);
+  return checkRootObject(data_.objname, unmapRefObject(), __PRETTY_FUNCTION__, 0);
 }
 
 TH1F *
@@ -1575,7 +1845,7 @@ MonitorElement::getRefTH1F(void) const
   assert(kind() == DQM_KIND_TH1F);
   const_cast<MonitorElement *>(this)->update();
   return static_cast<TH1F *>
-    (checkRootObject(data_.objname, reference_, __PRETTY_FUNCTION__, 1));
+    (checkRootObject(data_.objname, unmapRefObject(), __PRETTY_FUNCTION__, 1));
 }
 
 TH1S *
@@ -1584,7 +1854,7 @@ MonitorElement::getRefTH1S(void) const
   assert(kind() == DQM_KIND_TH1S);
   const_cast<MonitorElement *>(this)->update();
   return static_cast<TH1S *>
-    (checkRootObject(data_.objname, reference_, __PRETTY_FUNCTION__, 1));
+    (checkRootObject(data_.objname, unmapRefObject(), __PRETTY_FUNCTION__, 1));
 }
 
 TH1D *
@@ -1593,7 +1863,7 @@ MonitorElement::getRefTH1D(void) const
   assert(kind() == DQM_KIND_TH1D);
   const_cast<MonitorElement *>(this)->update();
   return static_cast<TH1D *>
-    (checkRootObject(data_.objname, reference_, __PRETTY_FUNCTION__, 1));
+    (checkRootObject(data_.objname, unmapRefObject(), __PRETTY_FUNCTION__, 1));
 }
 
 TH2F *
@@ -1602,7 +1872,7 @@ MonitorElement::getRefTH2F(void) const
   assert(kind() == DQM_KIND_TH2F);
   const_cast<MonitorElement *>(this)->update();
   return static_cast<TH2F *>
-    (checkRootObject(data_.objname, reference_, __PRETTY_FUNCTION__, 2));
+    (checkRootObject(data_.objname, unmapRefObject(), __PRETTY_FUNCTION__, 2));
 }
 
 TH2S *
@@ -1611,7 +1881,7 @@ MonitorElement::getRefTH2S(void) const
   assert(kind() == DQM_KIND_TH2S);
   const_cast<MonitorElement *>(this)->update();
   return static_cast<TH2S *>
-    (checkRootObject(data_.objname, reference_, __PRETTY_FUNCTION__, 2));
+    (checkRootObject(data_.objname, unmapRefObject(), __PRETTY_FUNCTION__, 2));
 }
 
 TH2D *
@@ -1620,7 +1890,7 @@ MonitorElement::getRefTH2D(void) const
   assert(kind() == DQM_KIND_TH2D);
   const_cast<MonitorElement *>(this)->update();
   return static_cast<TH2D *>
-    (checkRootObject(data_.objname, reference_, __PRETTY_FUNCTION__, 2));
+    (checkRootObject(data_.objname, unmapRefObject(), __PRETTY_FUNCTION__, 2));
 }
 
 TH3F *
@@ -1629,7 +1899,7 @@ MonitorElement::getRefTH3F(void) const
   assert(kind() == DQM_KIND_TH3F);
   const_cast<MonitorElement *>(this)->update();
   return static_cast<TH3F *>
-    (checkRootObject(data_.objname, reference_, __PRETTY_FUNCTION__, 3));
+    (checkRootObject(data_.objname, unmapRefObject(), __PRETTY_FUNCTION__, 3));
 }
 
 TProfile *
@@ -1638,7 +1908,7 @@ MonitorElement::getRefTProfile(void) const
   assert(kind() == DQM_KIND_TPROFILE);
   const_cast<MonitorElement *>(this)->update();
   return static_cast<TProfile *>
-    (checkRootObject(data_.objname, reference_, __PRETTY_FUNCTION__, 1));
+    (checkRootObject(data_.objname, unmapRefObject(), __PRETTY_FUNCTION__, 1));
 }
 
 TProfile2D *
@@ -1647,5 +1917,5 @@ MonitorElement::getRefTProfile2D(void) const
   assert(kind() == DQM_KIND_TPROFILE2D);
   const_cast<MonitorElement *>(this)->update();
   return static_cast<TProfile2D *>
-    (checkRootObject(data_.objname, reference_, __PRETTY_FUNCTION__, 2));
+    (checkRootObject(data_.objname, unmapRefObject(), __PRETTY_FUNCTION__, 2));
 }
@@ -22,6 +22,8 @@ QCriterion::init(void)
   status_ = dqm::qstatus::DID_NOT_RUN;
   message_ = "NO_MESSAGE";
   verbose_ = 0; // 0 = silent, 1 = algorithmic failures, 2 = info
+  paramVersion_ = 1;
+  minInterval_ = 0;
 }
 
 float QCriterion::runTest(const MonitorElement * /* me */)
@@ -29,6 +31,119 @@ float QCriterion::runTest(const MonitorElement * /* me */)
   raiseDQMError("QCriterion", "virtual runTest method called" );
   return 0.;
 }
+
+void
+QCriterion::recordRun(const MonitorElement *me, uint64_t ns)
+{
+  ++stats_.calls;
+  stats_.totalTime += ns;
+  if (me->kind() >= MonitorElement::DQM_KIND_TH1F)
+    stats_.bins += me->getTH1()->GetNcells();
+  else
+    ++stats_.bins;
+
+  if (ns > stats_.maxTime || stats_.calls == 1)
+  {
+    stats_.maxTime = ns;
+    stats_.worstME = me->getFullname();
+  }
+}
+
+// return the reference quantities cached on the reference monitor
+// element linked to the monitor element, or on the monitor element
+// itself, (re)building them if they do not describe the current
+// reference
+QReferenceCache *
+QCriterion::referenceCache(const MonitorElement *me, const TH1 *ref)
+{
+  int dim = ref->GetDimension();
+  int ncells = ref->GetNbinsX() + 2;
+  if (dim > 1) ncells *= ref->GetNbinsY() + 2;
+  if (dim > 2) ncells *= ref->GetNbinsZ() + 2;
+
+  const MonitorElement *owner = (me->refme_ && me->refme_->object_ == ref ? me->refme_ : me);
+  QReferenceCache *&cache = const_cast<MonitorElement *>(owner)->refcache_;
+  if (cache
+      && cache->ref == ref
+      && cache->ncells == ncells
+      && cache->entries == ref->GetEntries())
+    return cache;
+
+  if (! cache)
+    cache = new QReferenceCache;
+
+  cache->ref = ref;
+  cache->entries = ref->GetEntries();
+  cache->ncells = ncells;
+  cache->content.resize(ncells);
+  for (int bin = 0; bin < ncells; ++bin)
+    cache->content[bin] = ref->GetBinContent(bin);
+  cache->error2.clear();
+  cache->first = cache->last = -1;
+  cache->sum = 0;
+  cache->kolmogorov = false;
+  cache->kssum = cache->ksw2 = cache->kstsum = 0;
+  cache->cumulative.clear();
+  return cache;
+}
+
+// sum of reference contents over bins [from, to]
+double QReferenceCache::rangeSum(int from, int to)
+{
+  if (from != first || to != last)
+  {
+    sum = 0;
+    for (int bin = from; bin <= to; ++bin)
+      sum += content[bin];
+    first = from;
+    last = to;
+  }
+  return sum;
+}
+
+// squared reference errors by global bin number
+void QReferenceCache::prepareErrors(void)
+{
+  if (! error2.empty())
+    return;
+
+  error2.resize(ncells);
+  for (int bin = 0; bin < ncells; ++bin)
+  {
+    double err = ref->GetBinError(bin);
+    error2[bin] = err*err;
+  }
+}
+
+// sums and normalised cumulative distribution for 1D references
+void QReferenceCache::prepareKolmogorov(void)
+{
+  if (kolmogorov)
+    return;
+
+  prepareErrors();
+  int nbins = ncells - 2;
+  kssum = ksw2 = 0;
+  for (int bin = 1; bin <= nbins; ++bin)
+  {
+    kssum += content[bin];
+    ksw2 += error2[bin];
+  }
+
+  kstsum = kssum;
+  kstsum += content[0];
+  kstsum += content[nbins+1];
+
+  double scale = 1/kstsum, rsum = 0;
+  cumulative.resize(ncells);
+  for (int bin = 0; bin <= nbins+1; ++bin)
+  {
+    rsum += scale*content[bin];
+    cumulative[bin] = rsum;
+  }
+
+  kolmogorov = true;
+}
 //===================================================//
 //================ QUALITY TESTS ====================//
 //==================================================//
@@ -43,7 +158,7 @@ float Comp2RefEqualH::runTest(const MonitorElement*me)
 
   if (!me) 
     return -1;
-  if (!me->getRootObject() || !me->getRefRootObject()) 
+  if (!me->getRootObject() || !reference(me)) 
     return -1;
   TH1* h=0; //initialize histogram pointer
   TH1* ref_=0;
@@ -58,27 +173,27 @@ float Comp2RefEqualH::runTest(const MonitorElement*me)
   if (me->kind()==MonitorElement::DQM_KIND_TH1F)
   { 
     nbins = me->getTH1F()->GetXaxis()->GetNbins(); 
-    nbinsref = me->getRefTH1F()->GetXaxis()->GetNbins();
+    nbinsref = static_cast<TH1F *>(reference(me))->GetXaxis()->GetNbins();
     h  = me->getTH1F(); // access Test histo
-    ref_ = me->getRefTH1F(); //access Ref hiso 
+    ref_ = static_cast<TH1F *>(reference(me)); //access Ref hiso 
     if (nbins != nbinsref) return -1;
   } 
   //-- TH1S
   else if (me->kind()==MonitorElement::DQM_KIND_TH1S)
   { 
     nbins = me->getTH1S()->GetXaxis()->GetNbins(); 
-    nbinsref = me->getRefTH1S()->GetXaxis()->GetNbins();
+    nbinsref = static_cast<TH1S *>(reference(me))->GetXaxis()->GetNbins();
     h  = me->getTH1S(); // access Test histo
-    ref_ = me->getRefTH1S(); //access Ref hiso 
+    ref_ = static_cast<TH1S *>(reference(me)); //access Ref hiso 
     if (nbins != nbinsref) return -1;
   } 
   //-- TH1D
   else if (me->kind()==MonitorElement::DQM_KIND_TH1D)
   { 
     nbins = me->getTH1D()->GetXaxis()->GetNbins(); 
-    nbinsref = me->getRefTH1D()->GetXaxis()->GetNbins();
+    nbinsref = static_cast<TH1D *>(reference(me))->GetXaxis()->GetNbins();
     h  = me->getTH1D(); // access Test histo
-    ref_ = me->getRefTH1D(); //access Ref hiso 
+    ref_ = static_cast<TH1D *>(reference(me)); //access Ref hiso 
     if (nbins != nbinsref) return -1;
   } 
   //-- TH2
@@ -86,10 +201,10 @@ float Comp2RefEqualH::runTest(const MonitorElement*me)
   { 
     nbins = me->getTH2F()->GetXaxis()->GetNbins() *
             me->getTH2F()->GetYaxis()->GetNbins();
-    nbinsref = me->getRefTH2F()->GetXaxis()->GetNbins() *
-               me->getRefTH2F()->GetYaxis()->GetNbins();
+    nbinsref = static_cast<TH2F *>(reference(me))->GetXaxis()->GetNbins() *
+               static_cast<TH2F *>(reference(me))->GetYaxis()->GetNbins();
     h = me->getTH2F(); // access Test histo
-    ref_ = me->getRefTH2F(); //access Ref hiso 
+    ref_ = static_cast<TH2F *>(reference(me)); //access Ref hiso 
     if (nbins != nbinsref) return -1;
   } 
 
@@ -98,10 +213,10 @@ float Comp2RefEqualH::runTest(const MonitorElement*me)
   { 
     nbins = me->getTH2S()->GetXaxis()->GetNbins() *
             me->getTH2S()->GetYaxis()->GetNbins();
-    nbinsref = me->getRefTH2S()->GetXaxis()->GetNbins() *
-               me->getRefTH2S()->GetYaxis()->GetNbins();
+    nbinsref = static_cast<TH2S *>(reference(me))->GetXaxis()->GetNbins() *
+               static_cast<TH2S *>(reference(me))->GetYaxis()->GetNbins();
     h = me->getTH2S(); // access Test histo
-    ref_ = me->getRefTH2S(); //access Ref hiso 
+    ref_ = static_cast<TH2S *>(reference(me)); //access Ref hiso 
     if (nbins != nbinsref) return -1;
   } 
 
@@ -110,10 +225,10 @@ float Comp2RefEqualH::runTest(const MonitorElement*me)
   { 
     nbins = me->getTH2D()->GetXaxis()->GetNbins() *
             me->getTH2D()->GetYaxis()->GetNbins();
-    nbinsref = me->getRefTH2D()->GetXaxis()->GetNbins() *
-               me->getRefTH2D()->GetYaxis()->GetNbins();
+    nbinsref = static_cast<TH2D *>(reference(me))->GetXaxis()->GetNbins() *
+               static_cast<TH2D *>(reference(me))->GetYaxis()->GetNbins();
     h = me->getTH2D(); // access Test histo
-    ref_ = me->getRefTH2D(); //access Ref hiso 
+    ref_ = static_cast<TH2D *>(reference(me)); //access Ref hiso 
     if (nbins != nbinsref) return -1;
   } 
 
@@ -123,11 +238,11 @@ float Comp2RefEqualH::runTest(const MonitorElement*me)
     nbins = me->getTH3F()->GetXaxis()->GetNbins() *
             me->getTH3F()->GetYaxis()->GetNbins() *
             me->getTH3F()->GetZaxis()->GetNbins();
-    nbinsref = me->getRefTH3F()->GetXaxis()->GetNbins() *
-               me->getRefTH3F()->GetYaxis()->GetNbins() *
-               me->getRefTH3F()->GetZaxis()->GetNbins();
+    nbinsref = static_cast<TH3F *>(reference(me))->GetXaxis()->GetNbins() *
+               static_cast<TH3F *>(reference(me))->GetYaxis()->GetNbins() *
+               static_cast<TH3F *>(reference(me))->GetZaxis()->GetNbins();
     h = me->getTH3F(); // access Test histo
-    ref_ = me->getRefTH3F(); //access Ref hiso 
+    ref_ = static_cast<TH3F *>(reference(me)); //access Ref hiso 
     if (nbins != nbinsref) return -1;
   } 
 
@@ -140,17 +255,18 @@ float Comp2RefEqualH::runTest(const MonitorElement*me)
   } 
 
   //--  QUALITY TEST itself 
+  const QReferenceCache *ref = referenceCache(me, ref_);
   int first = 0; // 1 //(use underflow bin)
   int last  = nbins+1; //(use overflow bin)
   bool failure = false;
+  badChannels_.reshape(nbins);
   for (int bin=first;bin<=last;bin++) 
   {
     double contents = h->GetBinContent(bin);
-    if (contents != ref_->GetBinContent(bin)) 
+    if (contents != ref->content[bin]) 
     {
       failure = true;
-      DQMChannel chan(bin, 0, 0, contents, h->GetBinError(bin));
-      badChannels_.push_back(chan);
+      badChannels_.add(bin, 0, 0, contents, h->GetBinError(bin));
     }
   }
   if (failure) return 0;
@@ -164,7 +280,7 @@ float Comp2RefChi2::runTest(const MonitorElement *me)
 {
   if (!me) 
     return -1;
-  if (!me->getRootObject() || !me->getRefRootObject()) 
+  if (!me->getRootObject() || !reference(me)) 
     return -1;
   TH1* h=0;
   TH1* ref_=0;
@@ -176,25 +292,25 @@ float Comp2RefChi2::runTest(const MonitorElement *me)
   if (me->kind()==MonitorElement::DQM_KIND_TH1F)
   { 
     h = me->getTH1F(); // access Test histo
-    ref_ = me->getRefTH1F(); //access Ref histo
+    ref_ = static_cast<TH1F *>(reference(me)); //access Ref histo
   } 
   //-- TH1S
   else if (me->kind()==MonitorElement::DQM_KIND_TH1S)
   { 
     h = me->getTH1S(); // access Test histo
-    ref_ = me->getRefTH1S(); //access Ref histo
+    ref_ = static_cast<TH1S *>(reference(me)); //access Ref histo
   } 
   //-- TH1D
   else if (me->kind()==MonitorElement::DQM_KIND_TH1D)
   { 
     h = me->getTH1D(); // access Test histo
-    ref_ = me->getRefTH1D(); //access Ref histo
+    ref_ = static_cast<TH1D *>(reference(me)); //access Ref histo
   } 
   //-- TProfile
   else if (me->kind()==MonitorElement::DQM_KIND_TPROFILE)
   {
     h = me->getTProfile(); // access Test histo
-    ref_ = me->getRefTProfile(); //access Ref histo
+    ref_ = static_cast<TProfile *>(reference(me)); //access Ref histo
   } 
   else
   { 
@@ -232,12 +348,10 @@ float Comp2RefChi2::runTest(const MonitorElement *me)
   ndof = i_end-i_start+1-constraint;
 
   //Compute the normalisation factor
-  double sum1=0, sum2=0;
+  QReferenceCache *ref = referenceCache(me, ref_);
+  double sum1=0, sum2=ref->rangeSum(i_start, i_end);
   for (i=i_start; i<=i_end; i++)
-  {
     sum1 += h->GetBinContent(i);
-    sum2 += ref_->GetBinContent(i);
-  }
 
   //check that the histograms are not empty
   if (sum1 == 0)
@@ -257,11 +371,12 @@ float Comp2RefChi2::runTest(const MonitorElement *me)
     return -1;
   }
 
+  ref->prepareErrors();
   double bin1, bin2, err1, err2, temp;
   for (i=i_start; i<=i_end; i++)
   {
     bin1 = h->GetBinContent(i)/sum1;
-    bin2 = ref_->GetBinContent(i)/sum2;
+    bin2 = ref->content[i]/sum2;
     if (bin1 ==0 && bin2==0)
     {
       --ndof; //no data means one less degree of freedom
@@ -269,7 +384,7 @@ float Comp2RefChi2::runTest(const MonitorElement *me)
     else 
     {
       temp  = bin1-bin2;
-      err1=h->GetBinError(i); err2=ref_->GetBinError(i);
+      err1=h->GetBinError(i); err2=ref->error2[i];
       if (err1 == 0 && err2 == 0)
       {
 	if (verbose_>0) 
@@ -277,7 +392,7 @@ float Comp2RefChi2::runTest(const MonitorElement *me)
 	            << " bins with non-zero content and zero error, exiting\n";
 	return -1;
       }
-      err1*=err1      ; err2*=err2;
+      err1*=err1      ;
       err1/=sum1*sum1 ; err2/=sum2*sum2;
       chi2 +=temp*temp/(err1+err2);
     }
@@ -296,7 +411,7 @@ float Comp2RefKolmogorov::runTest(const MonitorElement *me)
    
   if (!me) 
     return -1;
-  if (!me->getRootObject() || !me->getRefRootObject()) 
+  if (!me->getRootObject() || !reference(me)) 
     return -1;
   TH1* h=0;
   TH1* ref_=0;
@@ -308,25 +423,25 @@ float Comp2RefKolmogorov::runTest(const MonitorElement *me)
   if (me->kind()==MonitorElement::DQM_KIND_TH1F)
   { 
     h = me->getTH1F(); // access Test histo
-    ref_ = me->getRefTH1F(); //access Ref histo
+    ref_ = static_cast<TH1F *>(reference(me)); //access Ref histo
   } 
   //-- TH1S
   else if (me->kind()==MonitorElement::DQM_KIND_TH1S)
   { 
     h = me->getTH1S(); // access Test histo
-    ref_ = me->getRefTH1S(); //access Ref histo
+    ref_ = static_cast<TH1S *>(reference(me)); //access Ref histo
   } 
   //-- TH1D
   else if (me->kind()==MonitorElement::DQM_KIND_TH1D)
   { 
     h = me->getTH1D(); // access Test histo
-    ref_ = me->getRefTH1D(); //access Ref histo
+    ref_ = static_cast<TH1D *>(reference(me)); //access Ref histo
   } 
   //-- TProfile
   else if (me->kind()==MonitorElement::DQM_KIND_TPROFILE)
   {
     h = me->getTProfile(); // access Test histo
-    ref_ = me->getRefTProfile(); //access Ref histo
+    ref_ = static_cast<TProfile *>(reference(me)); //access Ref histo
   }
   else
   { 
@@ -359,18 +474,17 @@ float Comp2RefKolmogorov::runTest(const MonitorElement *me)
   }
 
   //--  QUALITY TEST itself 
+  QReferenceCache *ref = referenceCache(me, ref_);
+  ref->prepareKolmogorov();
   Bool_t afunc1 = kFALSE; Bool_t afunc2 = kFALSE;
-  double sum1 = 0, sum2 = 0;
-  double ew1, ew2, w1 = 0, w2 = 0;
+  double sum1 = 0, sum2 = ref->kssum;
+  double ew1, w1 = 0, w2 = ref->ksw2;
   int bin;
   for (bin=1;bin<=ncx1;bin++)
   {
     sum1 += h->GetBinContent(bin);
-    sum2 += ref_->GetBinContent(bin);
     ew1   = h->GetBinError(bin);
-    ew2   = ref_->GetBinError(bin);
     w1   += ew1*ew1;
-    w2   += ew2*ew2;
   }
   
   if (sum1 == 0)
@@ -390,17 +504,15 @@ float Comp2RefKolmogorov::runTest(const MonitorElement *me)
     return -1;
   }
 
-  double tsum1 = sum1; double tsum2 = sum2;
+  double tsum1 = sum1; double tsum2 = ref->kstsum;
   tsum1 += h->GetBinContent(0);
-  tsum2 += ref_->GetBinContent(0);
   tsum1 += h->GetBinContent(ncx1+1);
-  tsum2 += ref_->GetBinContent(ncx1+1);
 
   // Check if histograms are weighted.
   // If number of entries = number of channels, probably histograms were
   // not filled via Fill(), but via SetBinContent()
   double ne1 = h->GetEntries();
-  double ne2 = ref_->GetEntries();
+  double ne2 = ref->entries;
   // look at first histogram
   double difsum1 = (ne1-tsum1)/tsum1;
   double esum1 = sum1;
@@ -436,7 +548,7 @@ float Comp2RefKolmogorov::runTest(const MonitorElement *me)
     }
   }
 
-  double s1 = 1/tsum1; double s2 = 1/tsum2;
+  double s1 = 1/tsum1;
   // Find largest difference for Kolmogorov Test
   double dfmax =0, rsum1 = 0, rsum2 = 0;
   // use underflow bin
@@ -446,7 +558,7 @@ float Comp2RefKolmogorov::runTest(const MonitorElement *me)
   for ( bin=first; bin<=last; bin++)
   {
     rsum1 += s1*h->GetBinContent(bin);
-    rsum2 += s2*ref_->GetBinContent(bin);
+    rsum2  = ref->cumulative[bin];
     dfmax = TMath::Max(dfmax,TMath::Abs(rsum1-rsum2));
   }
 
@@ -588,6 +700,7 @@ float ContentsYRange::runTest(const MonitorElement*me)
   // bins outside Y-range
   int fail = 0;
   int bin;
+  badChannels_.reshape(ncx);
   
   if (useEmptyBins_)///Standard test !
   {
@@ -598,8 +711,7 @@ float ContentsYRange::runTest(const MonitorElement*me)
       failure = (contents < ymin_ || contents > ymax_); // allowed y-range: [ymin_, ymax_]
       if (failure) 
       { 
-        DQMChannel chan(bin, 0, 0, contents, h->GetBinError(bin));
-        badChannels_.push_back(chan);
+        badChannels_.add(bin, 0, 0, contents, h->GetBinError(bin));
         ++fail;
       }
     }
@@ -686,6 +798,7 @@ float DeadChannel::runTest(const MonitorElement*me)
     int first = 1;
     int last  = ncx;
     int bin;
+    badChannels_.reshape(ncx);
 
     /// loop over all channels
     for (bin = first; bin <= last; ++bin)
@@ -695,8 +808,7 @@ float DeadChannel::runTest(const MonitorElement*me)
       failure = contents <= ymin_; // dead channel: equal to or less than ymin_
       if (failure)
       { 
-        DQMChannel chan(bin, 0, 0, contents, h1->GetBinError(bin));
-        badChannels_.push_back(chan);
+        badChannels_.add(bin, 0, 0, contents, h1->GetBinError(bin));
         ++fail;
       }
     }
@@ -710,6 +822,7 @@ float DeadChannel::runTest(const MonitorElement*me)
   {
     int ncx = h2->GetXaxis()->GetNbins(); // get X bins
     int ncy = h2->GetYaxis()->GetNbins(); // get Y bins
+    badChannels_.reshape(ncx, ncy);
 
     /// loop over all bins 
     for (int cx = 1; cx <= ncx; ++cx)
@@ -721,8 +834,7 @@ float DeadChannel::runTest(const MonitorElement*me)
 	failure = contents <= ymin_; // dead channel: equal to or less than ymin_
 	if (failure)
 	{ 
-          DQMChannel chan(cx, cy, 0, contents, h2->GetBinError(h2->GetBin(cx, cy)));
-          badChannels_.push_back(chan);
+          badChannels_.add(cx, cy, 0, contents, h2->GetBinError(h2->GetBin(cx, cy)));
           ++fail;
 	}
       }
@@ -818,6 +930,7 @@ float NoisyChannel::runTest(const MonitorElement *me)
   // bins outside Y-range
   int fail = 0;
   int bin;
+  badChannels_.reshape(nbins);
   for (bin = first; bin <= last; ++bin)
   {
     double contents = h->GetBinContent(bin);
@@ -829,8 +942,7 @@ float NoisyChannel::runTest(const MonitorElement *me)
     if (failure)
     {
       ++fail;
-      DQMChannel chan(bin, 0, 0, contents, h->GetBinError(bin));
-      badChannels_.push_back(chan);
+      badChannels_.add(bin, 0, 0, contents, h->GetBinError(bin));
     }
   }
 
@@ -981,6 +1093,7 @@ float ContentsWithinExpected::runTest(const MonitorElement*me)
     } // calculate average value of all bin contents
 
     int fail = 0;
+    badChannels_.reshape(ncx, ncy);
 
     for (int cx = 1; cx <= ncx; ++cx)
     {
@@ -1021,38 +1134,33 @@ float ContentsWithinExpected::runTest(const MonitorElement*me)
 
 	  if (me->kind() == MonitorElement::DQM_KIND_TH2F) 
 	  {
-            DQMChannel chan(cx, cy, 0,
-			    h->GetBinContent(h->GetBin(cx, cy)),
-			    h->GetBinError(h->GetBin(cx, cy)));
-            badChannels_.push_back(chan);
+            badChannels_.add(cx, cy, 0,
+			     h->GetBinContent(h->GetBin(cx, cy)),
+			     h->GetBinError(h->GetBin(cx, cy)));
 	  }
 	  else if (me->kind() == MonitorElement::DQM_KIND_TH2S) 
 	  {
-            DQMChannel chan(cx, cy, 0,
-			    h->GetBinContent(h->GetBin(cx, cy)),
-			    h->GetBinError(h->GetBin(cx, cy)));
-            badChannels_.push_back(chan);
+            badChannels_.add(cx, cy, 0,
+			     h->GetBinContent(h->GetBin(cx, cy)),
+			     h->GetBinError(h->GetBin(cx, cy)));
 	  }
 	  else if (me->kind() == MonitorElement::DQM_KIND_TH2D) 
 	  {
-            DQMChannel chan(cx, cy, 0,
-			    h->GetBinContent(h->GetBin(cx, cy)),
-			    h->GetBinError(h->GetBin(cx, cy)));
-            badChannels_.push_back(chan);
+            badChannels_.add(cx, cy, 0,
+			     h->GetBinContent(h->GetBin(cx, cy)),
+			     h->GetBinError(h->GetBin(cx, cy)));
 	  }
 	  else if (me->kind() == MonitorElement::DQM_KIND_TPROFILE) 
 	  {
-	    DQMChannel chan(cx, cy, int(me->getTProfile()->GetBinEntries(h->GetBin(cx))),
-			    0,
-			    h->GetBinError(h->GetBin(cx)));
-            badChannels_.push_back(chan);
+	    badChannels_.add(cx, cy, int(me->getTProfile()->GetBinEntries(h->GetBin(cx))),
+			     0,
+			     h->GetBinError(h->GetBin(cx)));
 	  }
 	  else if (me->kind() == MonitorElement::DQM_KIND_TPROFILE2D) 
 	  {
-	    DQMChannel chan(cx, cy, int(me->getTProfile2D()->GetBinEntries(h->GetBin(cx, cy))),
-			    h->GetBinContent(h->GetBin(cx, cy)),
-			    h->GetBinError(h->GetBin(cx, cy)));
-            badChannels_.push_back(chan);
+	    badChannels_.add(cx, cy, int(me->getTProfile2D()->GetBinEntries(h->GetBin(cx, cy))),
+			     h->GetBinContent(h->GetBin(cx, cy)),
+			     h->GetBinError(h->GetBin(cx, cy)));
 	  }
           ++fail;
 	}
@@ -1117,6 +1225,7 @@ void ContentsWithinExpected::setMeanRange(double xmin, double xmax)
   minMean_ = xmin;
   maxMean_ = xmax;
   checkMean_ = true;
+  ++paramVersion_;
 }
 
 /// set expected value for mean
@@ -1129,6 +1238,7 @@ void ContentsWithinExpected::setRMSRange(double xmin, double xmax)
   minRMS_ = xmin;
   maxRMS_ = xmax;
   checkRMS_ = true;
+  ++paramVersion_;
 }
 
 //----------------------------------------------------------------//
@@ -1228,6 +1338,7 @@ void MeanWithinExpected::useRange(double xmin, double xmax)
     useRange_ = true;
     useSigma_ = useRMS_ = false;
     xmin_ = xmin; xmax_ = xmax;
+    ++paramVersion_;
     if (xmin_ > xmax_)  
       if (verbose_>0) 
         std::cout << "QTest:MeanWithinExpected"
@@ -1238,6 +1349,7 @@ void MeanWithinExpected::useSigma(double expectedSigma)
   useSigma_ = true;
   useRMS_ = useRange_ = false;
   sigma_ = expectedSigma;
+  ++paramVersion_;
   if (sigma_ == 0) 
     if (verbose_>0) 
       std::cout << "QTest:MeanWithinExpected"
@@ -1248,6 +1360,7 @@ void MeanWithinExpected::useRMS()
 {
   useRMS_ = true;
   useSigma_ = useRange_ = false;
+  ++paramVersion_;
 }
 
 //----------------------------------------------------------------//
@@ -1293,6 +1406,7 @@ float CompareToMedian::runTest(const MonitorElement *me){
   
   nBinsX = h->GetNbinsX();
   nBinsY = h->GetNbinsY();
+  badChannels_.reshape(nBinsX, nBinsY);
   int entries = 0;
   float median = 0.0;
 
@@ -1331,8 +1445,7 @@ float CompareToMedian::runTest(const MonitorElement *me){
 	if ( entries == 0 )
           continue;
 	if (content > _maxMed || content < _minMed){ 
-	    DQMChannel chan(binX,binY, 0, content, h->GetBinError(bin));
-	    badChannels_.push_back(chan);
+	    badChannels_.add(binX,binY, 0, content, h->GetBinError(bin));
 	    failed++;
 	}
       }
@@ -1351,8 +1464,7 @@ float CompareToMedian::runTest(const MonitorElement *me){
 	entries = me->getTProfile2D()->GetBinEntries(bin);
          if ( entries == 0 )
           continue;
-	 DQMChannel chan(binX,binY, 0, content/median, h->GetBinError(bin));
-	 badChannels_.push_back(chan);
+	 badChannels_.add(binX,binY, 0, content/median, h->GetBinError(bin));
 	 failed++;
       }
       continue;
@@ -1368,8 +1480,7 @@ float CompareToMedian::runTest(const MonitorElement *me){
         if ( entries == 0 )
           continue;
         if (content > maxCut || content < minCut){
-          DQMChannel chan(binX,binY, 0, content/median, h->GetBinError(bin));
-          badChannels_.push_back(chan);
+          badChannels_.add(binX,binY, 0, content/median, h->GetBinError(bin));
           failed++;
         }
     }
@@ -0,0 +1,83 @@
+#include "DQMServices/Core/test/DQMTestHelpers.hpp"
+#include "DQMServices/Core/interface/MonitorElement.h"
+#include "DQMServices/Core/interface/QReport.h"
+
+/*
+ * Test case for checkpoints: restoring a checkpoint into a store where
+ * the monitor elements have been booked again brings back their
+ * contents, flags, soft reset baselines, quality reports and the
+ * quality test specifications, also when a synchronous checkpoint
+ * overlaps an asynchronous one.  A checkpoint of another run is not
+ * restored.
+ */
+
+int main(int argc, char **argv)
+{
+  DQMTestEnvironment env;
+  DQMTestFile file("DQMCheckpointTest.dqm");
+  DQMStore *dbe = env.store();
+
+  // Three entries go into the soft reset baseline, one after it.
+  dbe->setCurrentFolder("Test");
+  MonitorElement *me = dbe->book1D("h", "h", 10, 0, 10);
+  me->Fill(2);
+  me->Fill(3);
+  me->Fill(3);
+  dbe->softReset(me);
+  me->Fill(5);
+  me->setResetMe(true);
+  me->setLumiFlag();
+  const uint32_t STATE_FLAGS = (DQMNet::DQM_PROP_ACCUMULATE
+				| DQMNet::DQM_PROP_RESET
+				| DQMNet::DQM_PROP_LUMI);
+  uint32_t flags = me->flags() & STATE_FLAGS;
+  dbe->createQTest("ContentsXRange", "xrange");
+  dbe->useQTestByMatch("Test/*", "xrange");
+  dbe->runQTests();
+  int status = me->getQReport("xrange")->getStatus();
+
+  uint64_t save = dbe->checkpointAsync(file.name(), 7);
+  dbe->checkpoint(file.name(), 7);
+  dbe->waitForSave(save);
+  delete dbe;
+
+  // Restart: the quality test exists and the modules book again.
+  dbe = env.store();
+  dbe->createQTest("ContentsXRange", "xrange");
+  dbe->setCurrentFolder("Test");
+  me = dbe->book1D("h", "h", 10, 0, 10);
+
+  // A checkpoint of another run is not restored.
+  int errors = 0;
+  errors += check(dbe->restore(file.name(), 8) == 0,
+		  "checkpoint of another run restored");
+  errors += check(me->getEntries() == 0, "contents of another run restored");
+
+  dbe->restore(file.name(), 7);
+  me = dbe->get("Test/h");
+  errors += check(me && me->getEntries() == 1, "contents not restored");
+  errors += check(me && me->getBinContent(6) == 1, "bin contents not restored");
+  errors += check(me && (me->flags() & DQMNet::DQM_PROP_RESET), "reset flag not restored");
+  errors += check(me && me->getLumiFlag(), "lumi flag not restored");
+  errors += check(me && (me->flags() & STATE_FLAGS) == flags, "accumulate, reset and lumi flags not restored");
+
+  const QReport *qr = me ? me->getQReport("xrange") : 0;
+  errors += check(qr != 0, "quality report not restored");
+  errors += check(qr && qr->getStatus() == status, "quality report status not restored");
+
+  // The specification attaches the test to monitor elements booked later.
+  dbe->setCurrentFolder("Test");
+  MonitorElement *later = dbe->book1D("later", "later", 10, 0, 10);
+  errors += check(later->getQReport("xrange") != 0, "quality test specification not restored");
+
+  // Undoing the soft reset adds the baseline back.
+  if (me)
+  {
+    dbe->disableSoftReset(me);
+    errors += check(me->getEntries() == 4, "soft reset baseline has the wrong entries");
+    errors += check(me->getBinContent(4) == 2, "soft reset baseline has the wrong contents");
+  }
+
+  delete dbe;
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,370 @@
+#include "DQMServices/Core/interface/Standalone.h"
+#include "DQMServices/Core/interface/DQMStore.h"
+#include "DQMServices/Core/interface/MonitorElement.h"
+#include "classlib/utils/Time.h"
+
+#include <TRandom.h>
+
+#include <sys/stat.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+/*
+ * Benchmark for the DQMStore file I/O: books a synthetic store with a
+ * configurable number of monitor elements, mix of kinds, binning,
+ * directory depth, fraction with quality reports and fraction with
+ * references, then times save(), open() into an empty store, open()
+ * and load() overwriting existing monitor elements, open() collating
+ * into existing ones, open() of a single top directory, and merging
+ * several copies of the file the way DQMMergeFile does.
+ *
+ * Every operation is reported in MB/s of file and monitor elements/s,
+ * readably on the standard output and as one JSON object per line in
+ * the results file, for tracking regressions.
+ *
+ * Usage: DQMIOBenchmark [-n MES] [-d DEPTH] [-f FANOUT] [-b NBINS]
+ *          [-m KIND=WEIGHT,...] [-q QFRACTION] [-r REFFRACTION]
+ *          [-i ITERATIONS] [-k MERGEFILES] [-o FILE] [-j RESULTS]
+ *
+ * Kinds are th1f, th1s, th1d, th2f, th2s, th2d, th3f, tprof, tprof2d,
+ * int, real and string.  The default mix is
+ * th1f=50,th2f=20,tprof=10,int=10,real=5,string=5.
+ */
+
+struct BenchConfig
+{
+  int			nmes;
+  int			depth;
+  int			fanout;
+  int			nbins;
+  double		qfraction;
+  double		reffraction;
+  int			niter;
+  int			nmerge;
+  std::string		mix;
+  std::string		file;
+  std::string		results;
+};
+
+struct BenchKind
+{
+  std::string		name;
+  double		weight;
+};
+
+static std::vector<BenchKind>
+parseMix(const std::string &mix)
+{
+  std::vector<BenchKind> kinds;
+  std::istringstream in(mix);
+  std::string item;
+  double total = 0;
+  while (std::getline(in, item, ','))
+  {
+    size_t eq = item.find('=');
+    BenchKind k;
+    k.name = item.substr(0, eq);
+    k.weight = eq == std::string::npos ? 1 : atof(item.c_str() + eq + 1);
+    if (k.weight > 0)
+    {
+      total += k.weight;
+      kinds.push_back(k);
+    }
+  }
+
+  for (size_t i = 0; i < kinds.size(); ++i)
+    kinds[i].weight /= total;
+  return kinds;
+}
+
+static const std::string &
+pickKind(const std::vector<BenchKind> &kinds)
+{
+  double x = gRandom->Uniform();
+  for (size_t i = 0; i + 1 < kinds.size(); ++i)
+    if ((x -= kinds[i].weight) < 0)
+      return kinds[i].name;
+  return kinds.back().name;
+}
+
+// Book one monitor element of <kind> named <name> in the current
+// folder and fill it; scalars are not filled with entries.
+static MonitorElement *
+bookKind(DQMStore *dbe, const std::string &kind, const char *name, int nbins)
+{
+  int n2 = nbins > 200 ? 200 : nbins;
+  int n3 = nbins > 20 ? 20 : nbins;
+  MonitorElement *me;
+  if (kind == "th1f")
+    me = dbe->book1D(name, name, nbins, -5, 5);
+  else if (kind == "th1s")
+    me = dbe->book1S(name, name, nbins, -5, 5);
+  else if (kind == "th1d")
+    me = dbe->book1DD(name, name, nbins, -5, 5);
+  else if (kind == "th2f")
+    me = dbe->book2D(name, name, n2, -5, 5, n2, -5, 5);
+  else if (kind == "th2s")
+    me = dbe->book2S(name, name, n2, -5, 5, n2, -5, 5);
+  else if (kind == "th2d")
+    me = dbe->book2DD(name, name, n2, -5, 5, n2, -5, 5);
+  else if (kind == "th3f")
+    me = dbe->book3D(name, name, n3, -5, 5, n3, -5, 5, n3, -5, 5);
+  else if (kind == "tprof")
+    me = dbe->bookProfile(name, name, nbins, -5, 5, -100, 100);
+  else if (kind == "tprof2d")
+    me = dbe->bookProfile2D(name, name, n2, -5, 5, n2, -5, 5, -100, 100);
+  else if (kind == "int")
+  {
+    me = dbe->bookInt(name);
+    me->Fill(gRandom->Integer(1000000));
+    return me;
+  }
+  else if (kind == "real")
+  {
+    me = dbe->bookFloat(name);
+    me->Fill(gRandom->Uniform());
+    return me;
+  }
+  else if (kind == "string")
+    return dbe->bookString(name, "benchmark configuration string");
+  else
+  {
+    std::cerr << "DQMIOBenchmark: unknown kind '" << kind << "'\n";
+    exit(1);
+  }
+
+  int dim = me->getTH1()->GetDimension();
+  for (int i = 0, e = 10 * nbins; i < e; ++i)
+    if (kind == "tprof2d")
+      me->Fill(gRandom->Gaus(0, 1), gRandom->Gaus(0, 1), gRandom->Uniform(-100, 100));
+    else if (dim == 3)
+      me->Fill(gRandom->Gaus(0, 1), gRandom->Gaus(0, 1), gRandom->Gaus(0, 1));
+    else if (dim == 2)
+      me->Fill(gRandom->Gaus(0, 1), gRandom->Gaus(0, 1));
+    else
+      me->Fill(gRandom->Gaus(0, 1));
+  return me;
+}
+
+// Folder of the <i>th monitor element: a tree <depth> levels
+// deep with <fanout> branches per level.
+static std::string
+folderOf(int i, const BenchConfig &c)
+{
+  int leaves = 1;
+  for (int l = 0; l < c.depth; ++l)
+    leaves *= c.fanout;
+
+  int leaf = i % leaves;
+  std::string folder("Bench");
+  for (int l = 0; l < c.depth; ++l)
+  {
+    char part[32];
+    sprintf(part, "/L%d_%d", l, leaf % c.fanout);
+    folder += part;
+    leaf /= c.fanout;
+  }
+  return folder;
+}
+
+static double
+fileSize(const std::string &file)
+{
+  struct stat st;
+  return stat(file.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+// Print and record the result of one timed operation.
+static void
+report(std::ostream &json, const BenchConfig &c, const char *op,
+       const char *variant, double nmes, double bytes, uint64_t ns)
+{
+  double s = ns * 1e-9;
+  double mbs = s > 0 ? bytes / s / 1e6 : 0;
+  double mes = s > 0 ? nmes / s : 0;
+  printf("  %-6s %-10s %10.0f MEs %10.2f MB %9.3f s %9.2f MB/s %12.0f MEs/s\n",
+	 op, variant, nmes, bytes / 1e6, s, mbs, mes);
+  json << "{\"benchmark\":\"DQMIOBenchmark\""
+       << ",\"op\":\"" << op << "\",\"variant\":\"" << variant << "\""
+       << ",\"nmes\":" << c.nmes << ",\"depth\":" << c.depth
+       << ",\"fanout\":" << c.fanout << ",\"nbins\":" << c.nbins
+       << ",\"qfraction\":" << c.qfraction << ",\"reffraction\":" << c.reffraction
+       << ",\"mix\":\"" << c.mix << "\""
+       << ",\"mes\":" << nmes << ",\"bytes\":" << bytes
+       << ",\"seconds\":" << s << ",\"mb_per_s\":" << mbs
+       << ",\"mes_per_s\":" << mes << "}\n";
+}
+
+int main(int argc, char **argv)
+{
+  BenchConfig c;
+  c.nmes = 10000;
+  c.depth = 3;
+  c.fanout = 5;
+  c.nbins = 100;
+  c.qfraction = 0.5;
+  c.reffraction = 0.2;
+  c.niter = 3;
+  c.nmerge = 4;
+  c.mix = "th1f=50,th2f=20,tprof=10,int=10,real=5,string=5";
+  c.file = "DQMIOBenchmark.root";
+  c.results = "DQMIOBenchmark.json";
+
+  for (int arg = 1; arg < argc; ++arg)
+  {
+    const char *opt = argv[arg];
+    const char *val = arg + 1 < argc ? argv[++arg] : 0;
+    if (! val)
+      opt = "";
+    if (! strcmp(opt, "-n")) c.nmes = atoi(val);
+    else if (! strcmp(opt, "-d")) c.depth = atoi(val);
+    else if (! strcmp(opt, "-f")) c.fanout = atoi(val);
+    else if (! strcmp(opt, "-b")) c.nbins = atoi(val);
+    else if (! strcmp(opt, "-m")) c.mix = val;
+    else if (! strcmp(opt, "-q")) c.qfraction = atof(val);
+    else if (! strcmp(opt, "-r")) c.reffraction = atof(val);
+    else if (! strcmp(opt, "-i")) c.niter = atoi(val);
+    else if (! strcmp(opt, "-k")) c.nmerge = atoi(val);
+    else if (! strcmp(opt, "-o")) c.file = val;
+    else if (! strcmp(opt, "-j")) c.results = val;
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [-n MES] [-d DEPTH] [-f FANOUT]"
+		<< " [-b NBINS] [-m KIND=WEIGHT,...] [-q QFRACTION]"
+		<< " [-r REFFRACTION] [-i ITERATIONS] [-k MERGEFILES]"
+		<< " [-o FILE] [-j RESULTS]\n";
+      return 1;
+    }
+  }
+
+  std::vector<BenchKind> kinds = parseMix(c.mix);
+  if (kinds.empty() || c.nmes <= 0 || c.depth < 0 || c.fanout <= 0 || c.niter <= 0)
+  {
+    std::cerr << "DQMIOBenchmark: invalid configuration\n";
+    return 1;
+  }
+
+  edm::ParameterSet emptyps;
+  std::vector<edm::ParameterSet> emptyset;
+  edm::ServiceToken services(edm::ServiceRegistry::createSet(emptyset));
+  edm::ServiceRegistry::Operate operate(services);
+  std::auto_ptr<DQMStore> dbe(new DQMStore(emptyps));
+
+  // Book the store.  Monitor elements with quality reports get a "_q"
+  // suffix so one pattern selects them; references are booked under
+  // "Reference" with the same path and kind.
+  dbe->createQTest("ContentsXRange", "bench_xrange");
+  int total = 0;
+  int selected = 0;
+  std::string onlypath = c.depth > 0 ? "Bench/L0_0" : "Bench";
+  for (int i = 0; i < c.nmes; ++i)
+  {
+    const std::string &kind = pickKind(kinds);
+    std::string folder = folderOf(i, c);
+    bool scalar = (kind == "int" || kind == "real" || kind == "string");
+    bool qreport = ! scalar && gRandom->Uniform() < c.qfraction;
+    bool reference = ! scalar && gRandom->Uniform() < c.reffraction;
+
+    char name[64];
+    sprintf(name, "%s_%d%s", kind.c_str(), i, qreport ? "_q" : "");
+    dbe->setCurrentFolder(folder);
+    bookKind(dbe.get(), kind, name, c.nbins);
+    ++total;
+    if (folder == onlypath || folder.compare(0, onlypath.size()+1, onlypath + "/") == 0)
+      ++selected;
+
+    if (reference)
+    {
+      dbe->setCurrentFolder("Reference/" + folder);
+      bookKind(dbe.get(), kind, name, c.nbins);
+      ++total;
+    }
+  }
+  dbe->useQTestByMatch("Bench/*_q", "bench_xrange");
+  dbe->runQTests();
+
+  std::ofstream json(c.results.c_str(), std::ios::app);
+  std::cout << total << " monitor elements, " << c.niter << " iterations, "
+	    << "results appended to " << c.results << "\n";
+
+  // Save.
+  uint64_t start = lat::Time::current().ns();
+  for (int n = 0; n < c.niter; ++n)
+    dbe->save(c.file);
+  uint64_t t = lat::Time::current().ns() - start;
+  double bytes = fileSize(c.file);
+  report(json, c, "save", "full", double(total) * c.niter, bytes * c.niter, t);
+
+  // Open into an empty store.
+  t = 0;
+  for (int n = 0; n < c.niter; ++n)
+  {
+    std::auto_ptr<DQMStore> store(new DQMStore(emptyps));
+    start = lat::Time::current().ns();
+    store->open(c.file);
+    t += lat::Time::current().ns() - start;
+  }
+  report(json, c, "open", "empty", double(total) * c.niter, bytes * c.niter, t);
+
+  // Open only one top directory into an empty store.
+  t = 0;
+  for (int n = 0; n < c.niter; ++n)
+  {
+    std::auto_ptr<DQMStore> store(new DQMStore(emptyps));
+    start = lat::Time::current().ns();
+    store->open(c.file, false, onlypath);
+    t += lat::Time::current().ns() - start;
+  }
+  report(json, c, "open", "onlypath", double(selected) * c.niter, bytes * c.niter, t);
+
+  // Open and load overwriting the monitor elements in the store.
+  start = lat::Time::current().ns();
+  for (int n = 0; n < c.niter; ++n)
+    dbe->open(c.file, true);
+  t = lat::Time::current().ns() - start;
+  report(json, c, "open", "overwrite", double(total) * c.niter, bytes * c.niter, t);
+
+  start = lat::Time::current().ns();
+  for (int n = 0; n < c.niter; ++n)
+    dbe->load(c.file);
+  t = lat::Time::current().ns() - start;
+  report(json, c, "load", "overwrite", double(total) * c.niter, bytes * c.niter, t);
+
+  // Collate into existing monitor elements; the first read books them.
+  {
+    std::auto_ptr<DQMStore> store(new DQMStore(emptyps));
+    store->open(c.file, false, "", "Collate");
+    start = lat::Time::current().ns();
+    for (int n = 0; n < c.niter; ++n)
+      store->open(c.file, false, "", "Collate");
+    t = lat::Time::current().ns() - start;
+    report(json, c, "open", "collate", double(total) * c.niter, bytes * c.niter, t);
+  }
+
+  // Merge copies of the file and save the result, as DQMMergeFile.
+  t = 0;
+  double merged = 0;
+  for (int n = 0; n < c.niter; ++n)
+  {
+    std::auto_ptr<DQMStore> store(new DQMStore(emptyps));
+    std::string output = c.file + ".merged";
+    start = lat::Time::current().ns();
+    for (int k = 0; k < c.nmerge; ++k)
+      store->open(c.file, false);
+    store->save(output);
+    t += lat::Time::current().ns() - start;
+    merged += fileSize(output);
+    remove(output.c_str());
+  }
+  report(json, c, "merge", "files", double(total) * c.nmerge * c.niter,
+	 bytes * c.nmerge * c.niter + merged, t);
+
+  return 0;
+}
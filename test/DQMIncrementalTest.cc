@@ -0,0 +1,84 @@
+#include "DQMServices/Core/test/DQMTestHelpers.hpp"
+#include "DQMServices/Core/interface/MonitorElement.h"
+#include "DQMServices/Core/interface/QTest.h"
+
+/*
+ * Test case for the incremental work done on unchanged monitor
+ * elements: quality tests whose inputs did not change are not rerun,
+ * also when the tests themselves read the histograms, and delta saves
+ * leave out monitor elements which did not change since the last save.
+ */
+
+int main(int argc, char **argv)
+{
+  DQMTestEnvironment env;
+  DQMTestFile basefile("DQMIncrementalTest_base.root");
+  DQMTestFile deltafile("DQMIncrementalTest_delta.root");
+  DQMTestFile otherfile("DQMIncrementalTest_other.root");
+  DQMStore *dbe = env.store();
+
+  dbe->setCurrentFolder("Test");
+  MonitorElement *me = dbe->book1D("h", "h", 10, 0, 10);
+  me->Fill(5);
+
+  dbe->createQTest("ContentsXRange", "xrange");
+  dbe->useQTestByMatch("Test/*", "xrange");
+  const QCriterionStats &stats = dbe->getQCriterion("xrange")->getStats();
+
+  int errors = 0;
+  dbe->runQTests();
+  errors += check(stats.calls == 1, "quality test did not run on a new monitor element");
+
+  // Running the tests, which read the histogram, is not a change.
+  dbe->runQTests();
+  errors += check(stats.calls == 1, "quality test reran without a change");
+
+  // Handing out the ROOT object is a change, the caller may edit it.
+  me->getTH1F()->Scale(2);
+  dbe->runQTests();
+  errors += check(stats.calls == 2, "quality test did not rerun after access");
+
+  me->Fill(6);
+  dbe->runQTests();
+  errors += check(stats.calls == 3, "quality test did not rerun after a fill");
+
+  // Only what changed since the base save goes into a delta.
+  dbe->setCurrentFolder("Delta");
+  MonitorElement *changed = dbe->book1D("changed", "changed", 10, 0, 10);
+  dbe->book1D("unchanged", "unchanged", 10, 0, 10)->Fill(1);
+  dbe->book1D("removed", "removed", 10, 0, 10);
+  dbe->save(basefile.name());
+  changed->Fill(2);
+  dbe->removeElement("Delta", "removed");
+  dbe->saveDelta(deltafile.name());
+
+  DQMStore *delta = env.store();
+  std::string base;
+  errors += check(delta->openDelta(deltafile.name(), &base),
+		  "delta file has no manifest");
+  errors += check(base == basefile.name(), "delta file has the wrong base");
+  errors += check(delta->get("Delta/changed") != 0, "changed monitor element missing from delta");
+  errors += check(delta->get("Delta/unchanged") == 0, "unchanged monitor element saved in delta");
+  delete delta;
+
+  // Applying the delta over its base removes only what the chain
+  // removed, not what came from an unrelated file merged before.
+  DQMStore *other = env.store();
+  other->setCurrentFolder("Other");
+  other->book1D("h", "h", 10, 0, 10);
+  other->save(otherfile.name());
+  delete other;
+
+  DQMStore *merged = env.store();
+  merged->open(otherfile.name());
+  merged->open(basefile.name());
+  merged->openDelta(deltafile.name());
+  errors += check(merged->get("Other/h") != 0, "delta removed a monitor element of another file");
+  errors += check(merged->get("Delta/unchanged") != 0, "delta removed an unchanged monitor element");
+  errors += check(merged->get("Delta/changed") != 0, "changed monitor element missing after delta");
+  errors += check(merged->get("Delta/removed") == 0, "delta did not remove a removed monitor element");
+  delete merged;
+
+  delete dbe;
+  return errors ? 1 : 0;
+}
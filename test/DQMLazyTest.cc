@@ -0,0 +1,61 @@
+#include "DQMServices/Core/test/DQMTestHelpers.hpp"
+#include "DQMServices/Core/interface/MonitorElement.h"
+#include "DQMServices/Core/interface/QTest.h"
+#include "TH1F.h"
+
+/*
+ * Test case for opening a file lazily: the histograms are booked as
+ * placeholders which read their object on first use, and get their
+ * quality tests and references attached when booked.
+ */
+
+int main(int argc, char **argv)
+{
+  DQMTestEnvironment env;
+  DQMTestFile file("DQMLazyTest.root");
+  DQMStore *dbe = env.store();
+
+  dbe->setCurrentFolder("Test");
+  MonitorElement *me = dbe->book1D("h", "h", 10, 0, 10);
+  me->Fill(5);
+  me->Fill(6);
+  dbe->bookInt("i")->Fill(3);
+  dbe->setCurrentFolder("Reference/Test");
+  dbe->book1D("h", "h", 10, 0, 10)->Fill(5);
+  dbe->save(file.name());
+  delete dbe;
+
+  // Quality tests specified before the open attach to the placeholders.
+  dbe = env.store();
+  dbe->createQTest("ContentsXRange", "xrange");
+  dbe->useQTestByMatch("Test/*", "xrange");
+
+  int errors = 0;
+  errors += check(dbe->openLazy(file.name()), "lazy open failed");
+  me = dbe->get("Test/h");
+  errors += check(me != 0, "histogram not booked");
+  if (! me)
+  {
+    delete dbe;
+    return 1;
+  }
+
+  errors += check(me->kind() == MonitorElement::DQM_KIND_TH1F, "placeholder has the wrong kind");
+  errors += check(me->getQReports().size() == 1, "quality test not attached to the placeholder");
+  errors += check(dbe->get("Test/i") && dbe->get("Test/i")->getIntValue() == 3,
+		  "scalar not read right away");
+
+  // First use reads the histogram and its reference.
+  errors += check(me->getEntries() == 2, "histogram contents not read on first use");
+  errors += check(me->getTH1F() && me->getTH1F()->GetBinContent(7) == 1,
+		  "histogram bins not read on first use");
+  errors += check(me->getRefTH1F() && me->getRefTH1F()->GetEntries() == 1,
+		  "reference not linked to the placeholder");
+
+  dbe->runQTests();
+  errors += check(dbe->getQCriterion("xrange")->getStats().calls == 1,
+		  "quality test did not run on the placeholder");
+
+  delete dbe;
+  return errors ? 1 : 0;
+}
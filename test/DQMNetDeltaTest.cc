@@ -0,0 +1,76 @@
+#include "DQMServices/Core/test/DQMTestHelpers.hpp"
+#include "DQMServices/Core/interface/DQMNet.h"
+#include <cstring>
+
+/*
+ * Test case for delta updates in DQMNet: an object keeps the base of
+ * its deltas for one peer only, the last one sent the full object, so
+ * with two peers taking turns every update goes out in full, while a
+ * single peer gets deltas.  The messages are only built, not sent.
+ */
+
+class DeltaTestNet : public DQMBasicNet
+{
+public:
+  DeltaTestNet(void)
+    : DQMBasicNet("DQMNetDeltaTest")
+    {
+      deltaUpdates(10);
+      peers_[0] = createPeer((lat::Socket *) 1);
+      peers_[1] = createPeer((lat::Socket *) 2);
+      peers_[0]->caps = peers_[1]->caps = DQM_CAP_DELTA;
+      object_ = makeObject(peers_[0], "Test/h");
+      object_->flags = DQM_PROP_TYPE_TH1F;
+      object_->version = 1;
+      object_->dataversion = 1;
+      object_->rawdata.assign(1000, 0);
+    }
+
+  // Change a byte of the object data.
+  void
+  change(void)
+    {
+      object_->rawdata[object_->version % object_->rawdata.size()]++;
+      object_->dataversion = ++object_->version;
+    }
+
+  // Return the type of the update message for peer @a n.
+  uint32_t
+  send(int n)
+    {
+      Bucket msg;
+      msg.next = 0;
+      sendObjectUpdateToPeer(&msg, peers_[n], *object_, true, true);
+      uint32_t type = 0;
+      if (msg.data.size() >= 2*sizeof(uint32_t))
+	memcpy(&type, &msg.data[sizeof(uint32_t)], sizeof(type));
+      return type;
+    }
+
+private:
+  Peer *peers_[2];
+  Object *object_;
+};
+
+int main(int argc, char **argv)
+{
+  int errors = 0;
+  DeltaTestNet net;
+
+  errors += check(net.send(0) == DQMNet::DQM_REPLY_OBJECT, "first update not sent in full");
+  net.change();
+  errors += check(net.send(0) == DQMNet::DQM_REPLY_DELTA, "update to the base peer not sent as delta");
+
+  // The base moves to the other peer with its full object.
+  errors += check(net.send(1) == DQMNet::DQM_REPLY_OBJECT, "first update to a second peer not sent in full");
+  net.change();
+  errors += check(net.send(0) == DQMNet::DQM_REPLY_OBJECT, "delta sent against another peer's base");
+  net.change();
+  errors += check(net.send(1) == DQMNet::DQM_REPLY_OBJECT, "delta sent against another peer's base");
+
+  // A single peer gets deltas again.
+  net.change();
+  errors += check(net.send(1) == DQMNet::DQM_REPLY_DELTA, "update to the base peer not sent as delta");
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,104 @@
+#include "DQMServices/Core/test/DQMTestHelpers.hpp"
+#include "DQMServices/Core/interface/DQMNet.h"
+#include <cstring>
+
+/*
+ * Test case for compressed object updates in DQMNet: an object sent
+ * as a 'ZOBJECT' message arrives with its data intact, is passed on
+ * compressed by a node which does not compress itself, and a message
+ * claiming too large an uncompressed size is refused.  The messages
+ * are handed from one node to the other directly, without sockets.
+ */
+
+class ZlibTestNet : public DQMBasicNet
+{
+public:
+  ZlibTestNet(size_t compress)
+    : DQMBasicNet("DQMNetZlibTest")
+    {
+      compressUpdates(compress);
+      peer_ = createPeer((lat::Socket *) 1);
+      peer_->caps = DQM_CAP_ZLIB;
+    }
+
+  // Make an object with compressible data of @a size bytes.
+  Object *
+  make(const std::string &name, size_t size)
+    {
+      Object *o = makeObject(peer_, name);
+      o->flags = DQM_PROP_TYPE_TH1F;
+      o->version = 1;
+      o->dataversion = 1;
+      o->rawdata.resize(size);
+      for (size_t i = 0; i < size; ++i)
+	o->rawdata[i] = (i / 64) & 0xff;
+      return o;
+    }
+
+  // Put the update of object @a o for the peer into @a msg.
+  void
+  send(Bucket &msg, Object &o)
+    { sendObjectUpdateToPeer(&msg, peer_, o, true, false); }
+
+  // Receive the update in @a msg from the peer.
+  bool
+  receive(Bucket &msg)
+    {
+      Bucket reply;
+      reply.next = 0;
+      return onMessage(&reply, peer_, &msg.data[0], msg.data.size());
+    }
+
+  Object *
+  find(const std::string &name)
+    { return findObject(peer_, name); }
+
+private:
+  Peer *peer_;
+};
+
+static uint32_t
+messageType(const DQMNet::Bucket &msg)
+{
+  uint32_t type = 0;
+  if (msg.data.size() >= 2*sizeof(uint32_t))
+    memcpy(&type, &msg.data[sizeof(uint32_t)], sizeof(type));
+  return type;
+}
+
+int main(int argc, char **argv)
+{
+  int errors = 0;
+  ZlibTestNet source(1024);
+  ZlibTestNet collector(0);
+  ZlibTestNet client(0);
+
+  DQMNet::Object *o = source.make("Test/h", 100000);
+  DQMNet::Bucket msg;
+  msg.next = 0;
+  source.send(msg, *o);
+  errors += check(messageType(msg) == DQMNet::DQM_REPLY_ZOBJECT, "object not sent compressed");
+  errors += check(msg.data.size() < o->rawdata.size(), "compressed message not smaller");
+  errors += check(collector.receive(msg), "compressed object refused");
+
+  DQMNet::Object *got = collector.find("Test/h");
+  errors += check(got && got->rawdata == o->rawdata, "object data changed in transit");
+
+  // The collector does not compress, but passes on what it received.
+  DQMNet::Bucket fwd;
+  fwd.next = 0;
+  if (got)
+    collector.send(fwd, *got);
+  errors += check(messageType(fwd) == DQMNet::DQM_REPLY_ZOBJECT, "compressed object not forwarded");
+  errors += check(client.receive(fwd), "forwarded object refused");
+  got = client.find("Test/h");
+  errors += check(got && got->rawdata == o->rawdata, "forwarded object data changed");
+
+  // Claims above the limit are refused before allocating.
+  ZlibTestNet small(0);
+  small.maxUncompressedSize(1000);
+  errors += check(! small.receive(msg), "oversized compressed object accepted");
+  errors += check(! small.find("Test/h"), "oversized compressed object stored");
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+#include "DQMServices/Core/interface/Standalone.h"
+#include "DQMServices/Core/interface/DQMStore.h"
+#include "DQMServices/Core/interface/MonitorElement.h"
+#include "DQMServices/Core/interface/QTest.h"
+#include "classlib/utils/Time.h"
+
+#include <TRandom.h>
+
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+
+/*
+ * Benchmark for the quality test algorithms: books synthetic 1D and 2D
+ * histograms of configurable size together with their references,
+ * attaches every algorithm registered in the DQMStore and reports how
+ * many quality test runs per second each of them achieves.
+ *
+ * Usage: DQMQTestBenchmark [nbins [nhistos [niterations]]]
+ */
+
+static void
+fillRandom(MonitorElement *me, int nentries)
+{
+  for (int i = 0; i < nentries; ++i)
+    if (me->kind() == MonitorElement::DQM_KIND_TH2F)
+      me->Fill(gRandom->Gaus(0, 1), gRandom->Gaus(0, 1));
+    else
+      me->Fill(gRandom->Gaus(0, 1));
+}
+
+int main(int argc, char **argv)
+{
+  int nbins = argc > 1 ? atoi(argv[1]) : 100;
+  int nhistos = argc > 2 ? atoi(argv[2]) : 100;
+  int niter = argc > 3 ? atoi(argv[3]) : 10;
+  int nbins2d = nbins > 1000 ? 100 : nbins;
+
+  edm::ParameterSet emptyps;
+  std::vector<edm::ParameterSet> emptyset;
+  edm::ServiceToken services(edm::ServiceRegistry::createSet(emptyset));
+  edm::ServiceRegistry::Operate operate(services);
+  DQMStore *dbe = new DQMStore(emptyps);
+
+  // Book the references first so the test histograms pick them up.
+  const char *dirs[] = { "Reference/Bench", "Bench" };
+  std::vector<MonitorElement *> mes;
+  for (int d = 0; d < 2; ++d)
+  {
+    dbe->setCurrentFolder(dirs[d]);
+    for (int i = 0; i < nhistos; ++i)
+    {
+      char name[32];
+      sprintf(name, "h1_%d", i);
+      MonitorElement *h1 = dbe->book1D(name, name, nbins, -5, 5);
+      sprintf(name, "h2_%d", i);
+      MonitorElement *h2 = dbe->book2D(name, name, nbins2d, -5, 5, nbins2d, -5, 5);
+      fillRandom(h1, 10 * nbins);
+      fillRandom(h2, 10 * nbins2d);
+      if (d == 1)
+      {
+	mes.push_back(h1);
+	mes.push_back(h2);
+      }
+    }
+  }
+
+  // Attach every known algorithm with its default parameters.
+  std::vector<std::string> algos;
+  dbe->getAllQTestAlgorithms(algos);
+  for (size_t i = 0, e = algos.size(); i < e; ++i)
+  {
+    dbe->createQTest(algos[i], "bench_" + algos[i]);
+    dbe->useQTestByMatch("Bench/*", "bench_" + algos[i]);
+  }
+
+  // Run the tests, touching every monitor element between iterations
+  // so that all of them are rerun.
+  uint64_t total = 0;
+  for (int n = 0; n < niter; ++n)
+  {
+    for (size_t i = 0, e = mes.size(); i < e; ++i)
+      fillRandom(mes[i], 1);
+
+    uint64_t start = lat::Time::current().ns();
+    dbe->runQTests();
+    total += lat::Time::current().ns() - start;
+  }
+
+  std::cout << algos.size() << " algorithms on " << mes.size()
+	    << " monitor elements, " << nbins << " bins (1D), "
+	    << nbins2d << "x" << nbins2d << " bins (2D), "
+	    << niter << " iterations: "
+	    << (total ? niter * 1e9 / total : 0.) << " runQTests() calls per second\n";
+
+  for (size_t i = 0, e = algos.size(); i < e; ++i)
+  {
+    const QCriterionStats &s = dbe->getQCriterion("bench_" + algos[i])->getStats();
+    std::cout << "  " << algos[i] << ": "
+	      << (s.totalTime ? s.calls * 1e9 / s.totalTime : 0.) << " runs/s, "
+	      << (s.totalTime ? s.bins * 1e3 / s.totalTime : 0.) << " Mbins/s, "
+	      << "slowest " << s.maxTime * 1e-3 << " us on " << s.worstME << "\n";
+  }
+
+  delete dbe;
+  return 0;
+}
@@ -0,0 +1,174 @@
+#include "DQMServices/Core/interface/Standalone.h"
+#include "DQMServices/Core/interface/DQMStore.h"
+#include "DQMServices/Core/interface/MonitorElement.h"
+#include "DQMServices/Core/src/DQMTagString.h"
+#include "classlib/utils/RegexpMatch.h"
+#include "classlib/utils/Regexp.h"
+#include "classlib/utils/Time.h"
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TClass.h>
+#include <TObjString.h>
+#include <TRandom.h>
+
+#include <iostream>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+/*
+ * Benchmark for reading the scalar, quality report, tag and efficiency
+ * strings of a DQM file: saves a store with many scalar monitor
+ * elements and quality reports, then times parsing all the strings in
+ * the file with the regular expressions DQMStore used before and with
+ * DQMTagString, and times reading the whole file back with open().
+ *
+ * Usage: DQMTagStringBenchmark [ndirs [nmes [niterations [file]]]]
+ */
+
+static const lat::Regexp s_rxmeval ("^<(.*)>(i|f|s|e|t|qr)=(.*)</\\1>$");
+static const lat::Regexp s_rxmeqr1 ("^st:(\\d+):([-+e.\\d]+):([^:]*):(.*)$");
+static const lat::Regexp s_rxmeqr2 ("^st\\.(\\d+)\\.(.*)$");
+
+static void
+collectStrings(TDirectory *dir, std::vector<std::string> &into)
+{
+  TKey *key;
+  TIter next(dir->GetListOfKeys());
+  while ((key = (TKey *) next()))
+  {
+    TClass *cl = TClass::GetClass(key->GetClassName());
+    if (cl && cl->InheritsFrom(TDirectory::Class()))
+      collectStrings(dir->GetDirectory(key->GetName()), into);
+    else if (cl && cl->InheritsFrom(TObjString::Class()))
+      into.push_back(key->GetName());
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int ndirs = argc > 1 ? atoi(argv[1]) : 100;
+  int nmes = argc > 2 ? atoi(argv[2]) : 100;
+  int niter = argc > 3 ? atoi(argv[3]) : 10;
+  std::string file = argc > 4 ? argv[4] : "DQMTagStringBenchmark.root";
+
+  edm::ParameterSet emptyps;
+  std::vector<edm::ParameterSet> emptyset;
+  edm::ServiceToken services(edm::ServiceRegistry::createSet(emptyset));
+  edm::ServiceRegistry::Operate operate(services);
+  DQMStore *dbe = new DQMStore(emptyps);
+
+  // Book scalars of every kind with tags, and histograms with quality
+  // reports and efficiency flags, as a harvesting job would save them.
+  dbe->createQTest("ContentsXRange", "bench_xrange");
+  for (int d = 0; d < ndirs; ++d)
+  {
+    char name[64];
+    sprintf(name, "Bench/Subsystem%d/Folder", d);
+    dbe->setCurrentFolder(name);
+    for (int i = 0; i < nmes; ++i)
+    {
+      MonitorElement *me;
+      switch (i % 4)
+      {
+      case 0:
+	sprintf(name, "eventCounter_%d", i);
+	me = dbe->bookInt(name);
+	me->Fill(gRandom->Integer(1000000));
+	break;
+
+      case 1:
+	sprintf(name, "occupancyFraction_%d", i);
+	me = dbe->bookFloat(name);
+	me->Fill(gRandom->Uniform());
+	break;
+
+      case 2:
+	sprintf(name, "runConfiguration_%d", i);
+	me = dbe->bookString(name, "global-run cosmics configuration");
+	break;
+
+      default:
+	sprintf(name, "efficiency_%d", i);
+	me = dbe->book1D(name, name, 50, -5, 5);
+	me->Fill(gRandom->Gaus(0, 1));
+	me->setEfficiencyFlag();
+	break;
+      }
+      dbe->tag(me, i + 1);
+    }
+  }
+  dbe->useQTestByMatch("Bench/*/efficiency_*", "bench_xrange");
+  dbe->runQTests();
+  dbe->save(file);
+
+  std::vector<std::string> strings;
+  {
+    std::auto_ptr<TFile> f(TFile::Open(file.c_str()));
+    collectStrings(f.get(), strings);
+  }
+
+  // Parse all the strings the old way.
+  size_t nregex = 0;
+  uint64_t start = lat::Time::current().ns();
+  for (int n = 0; n < niter; ++n)
+    for (size_t i = 0, e = strings.size(); i < e; ++i)
+    {
+      lat::RegexpMatch m;
+      if (! s_rxmeval.match(strings[i], 0, 0, &m))
+	continue;
+
+      std::string label = m.matchString(strings[i], 1);
+      std::string kind = m.matchString(strings[i], 2);
+      std::string value = m.matchString(strings[i], 3);
+      if (kind == "qr")
+      {
+	lat::RegexpMatch mq;
+	if (s_rxmeqr1.match(value, 0, 0, &mq) || s_rxmeqr2.match(value, 0, 0, &mq))
+	  ++nregex;
+      }
+      else
+	++nregex;
+    }
+  uint64_t tregex = lat::Time::current().ns() - start;
+
+  // And with the hand-written parser.
+  size_t nparser = 0;
+  start = lat::Time::current().ns();
+  for (int n = 0; n < niter; ++n)
+    for (size_t i = 0, e = strings.size(); i < e; ++i)
+    {
+      DQMTagString ts;
+      if (! ts.parse(strings[i].data(), strings[i].size()))
+	continue;
+
+      if (ts.isKind("qr"))
+      {
+	DQMQualityString qs;
+	if (qs.parse(ts.value, ts.valueLen))
+	  ++nparser;
+      }
+      else
+	++nparser;
+    }
+  uint64_t tparser = lat::Time::current().ns() - start;
+
+  // Read the file back in full.
+  start = lat::Time::current().ns();
+  for (int n = 0; n < niter; ++n)
+    dbe->open(file, true, "", "Read");
+  uint64_t topen = lat::Time::current().ns() - start;
+
+  std::cout << strings.size() << " strings in " << file << ", "
+	    << niter << " iterations\n"
+	    << "  regexp: " << nregex / niter << " parsed, "
+	    << (tregex ? niter * strings.size() * 1e3 / tregex : 0.) << " Mstrings/s\n"
+	    << "  parser: " << nparser / niter << " parsed, "
+	    << (tparser ? niter * strings.size() * 1e3 / tparser : 0.) << " Mstrings/s\n"
+	    << "  open(): " << (topen ? topen * 1e-6 / niter : 0.) << " ms per file\n";
+
+  delete dbe;
+  return nregex == nparser ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+#ifndef DQMSERVICES_CORE_TEST_DQM_TEST_HELPERS_HPP
+# define DQMSERVICES_CORE_TEST_DQM_TEST_HELPERS_HPP
+
+# include "DQMServices/Core/interface/Standalone.h"
+# include "DQMServices/Core/interface/DQMStore.h"
+# include <iostream>
+# include <string>
+# include <vector>
+# include <cstdio>
+
+/*
+ * Helpers shared by the stand-alone test programs.
+ */
+
+// Report a failed check; returns the number of errors to add up.
+static int
+check(bool ok, const char *what)
+{
+  if (! ok)
+    std::cout << "Error: " << what << std::endl;
+  return ok ? 0 : 1;
+}
+
+// The services a DQMStore needs outside a job, kept for as long as
+// the environment exists, and a factory for stores using them.
+class DQMTestEnvironment
+{
+public:
+  DQMTestEnvironment(void)
+    : services_(edm::ServiceRegistry::createSet(std::vector<edm::ParameterSet>())),
+      operate_(services_)
+    {}
+
+  DQMStore *
+  store(void)
+    { return new DQMStore(ps_); }
+
+private:
+  edm::ParameterSet			ps_;
+  edm::ServiceToken			services_;
+  edm::ServiceRegistry::Operate		operate_;
+};
+
+// A file the test writes, removed when the test is done with it,
+// whichever way the test ends.
+class DQMTestFile
+{
+public:
+  DQMTestFile(const std::string &name)
+    : name_(name)
+    { remove(name_.c_str()); }
+
+  ~DQMTestFile(void)
+    { remove(name_.c_str()); }
+
+  const std::string &
+  name(void) const
+    { return name_; }
+
+private:
+  std::string				name_;
+};
+
+#endif // DQMSERVICES_CORE_TEST_DQM_TEST_HELPERS_HPP